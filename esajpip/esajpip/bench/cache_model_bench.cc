@@ -0,0 +1,346 @@
+#include <new>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <time.h>
+#include <unistd.h>
+
+#include "jpip/cache_model.h"
+
+using namespace std;
+using namespace jpip;
+
+/**
+ * Bytes currently allocated by the program, counted by the
+ * replaced global allocation functions.
+ */
+static size_t live_bytes = 0;
+
+void *operator new(size_t size) {
+    size_t *ptr = (size_t *) malloc(size + 16);
+    if (ptr == NULL) throw bad_alloc();
+    *ptr = size;
+    live_bytes += size;
+    return (char *) ptr + 16;
+}
+
+void operator delete(void *data) noexcept {
+    if (data == NULL) return;
+    size_t *ptr = (size_t *) ((char *) data - 16);
+    live_bytes -= *ptr;
+    free(ptr);
+}
+
+void operator delete(void *data, size_t) noexcept {
+    operator delete(data);
+}
+
+/**
+ * Precinct amounts of a cache model as they were stored before the
+ * bitmap: one integer per precinct of each codestream, from the first
+ * one not completely sent.
+ */
+class OldCacheModel {
+private:
+    struct Codestream {
+        int min_precinct;
+        vector<int> precincts;
+
+        Codestream() {
+            min_precinct = 0;
+        }
+
+        int &Get(int num_precinct) {
+            int n = num_precinct - min_precinct;
+            if (n >= (int) precincts.size()) precincts.resize(n + 1, 0);
+            return precincts[n];
+        }
+
+        int GetPrecinct(int num_precinct) {
+            return num_precinct < min_precinct ? INT_MAX : Get(num_precinct);
+        }
+
+        int AddToPrecinct(int num_precinct, int amount, bool complete) {
+            if (num_precinct < min_precinct) return INT_MAX;
+
+            int &p = Get(num_precinct);
+            if (p != INT_MAX) {
+                if (complete || (amount == INT_MAX)) p = INT_MAX;
+                else p += amount;
+            }
+            return p;
+        }
+
+        void Pack() {
+            size_t sum = 0;
+            while (sum < precincts.size() && precincts[sum] == INT_MAX) sum++;
+
+            if (sum > 0) {
+                precincts.erase(precincts.begin(), precincts.begin() + sum);
+                min_precinct += sum;
+            }
+        }
+    };
+
+    vector<Codestream> codestreams;
+
+    Codestream &GetCodestream(int num_codestream) {
+        if (num_codestream >= (int) codestreams.size()) codestreams.resize(num_codestream + 1);
+        return codestreams[num_codestream];
+    }
+
+public:
+    int GetPrecinct(int num_codestream, int id) {
+        return GetCodestream(num_codestream).GetPrecinct(id);
+    }
+
+    int AddToPrecinct(int num_codestream, int id, int amount, bool complete) {
+        return GetCodestream(num_codestream).AddToPrecinct(id, amount, complete);
+    }
+
+    void Pack() {
+        for (size_t i = 0; i < codestreams.size(); ++i)
+            codestreams[i].Pack();
+    }
+
+    void Clear() {
+        codestreams.clear();
+    }
+
+    OldCacheModel &operator+=(const OldCacheModel &model) {
+        for (size_t i = 0; i < model.codestreams.size(); ++i) {
+            const Codestream &codestream = model.codestreams[i];
+            for (size_t j = 0; j < codestream.precincts.size(); ++j)
+                AddToPrecinct(i, codestream.min_precinct + j, codestream.precincts[j], false);
+        }
+        return *this;
+    }
+};
+
+/**
+ * Precinct amounts of the current cache model.
+ */
+class NewCacheModel {
+private:
+    CacheModel model;
+
+public:
+    int GetPrecinct(int num_codestream, int id) {
+        return model.GetDataBin<DataBinClass::PRECINCT>(num_codestream, id);
+    }
+
+    int AddToPrecinct(int num_codestream, int id, int amount, bool complete) {
+        return model.AddToDataBin<DataBinClass::PRECINCT>(num_codestream, id, amount, complete);
+    }
+
+    void Pack() {
+        model.Pack();
+    }
+
+    void Clear() {
+        model.Clear();
+    }
+
+    NewCacheModel &operator+=(const NewCacheModel &other) {
+        model += other.model;
+        return *this;
+    }
+};
+
+enum {
+    NUM_LEVELS = 7,         ///< Resolution levels of the image
+    NUM_LAYERS = 8,         ///< Quality layers of the image
+    IMAGE_SIZE = 16384,     ///< Width and height of the image
+    PRECINCT_SIZE = 128,    ///< Width and height of the precincts
+    PACKET_LENGTH = 100     ///< Bytes added for each packet
+};
+
+/**
+ * Returns the number of precincts per row of a resolution level.
+ */
+static int GetPrecincts(int r) {
+    return ((IMAGE_SIZE >> (NUM_LEVELS - 1 - r)) + PRECINCT_SIZE - 1) / PRECINCT_SIZE;
+}
+
+/**
+ * Returns the first data-bin identifier of a resolution level.
+ */
+static int GetFirstPrecinct(int r) {
+    int res = 0;
+    for (int i = 0; i < r; ++i) res += GetPrecincts(i) * GetPrecincts(i);
+    return res;
+}
+
+static double GetTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Result of a scenario.
+ */
+struct Result {
+    double ns_op;           ///< Nanoseconds per model operation
+    size_t model_bytes;     ///< Memory of the model
+    double merge_us;        ///< Microseconds to merge the model into an empty one
+};
+
+/**
+ * Model under test, with the number of operations done.
+ */
+template<typename Model>
+struct Workload {
+    Model model;
+    long ops;
+
+    Workload() {
+        ops = 0;
+    }
+
+    /**
+     * Sends all the packets of a WOI of a codestream, layer by
+     * layer, as a response without byte limit.
+     * @param cs Codestream.
+     * @param r Resolution level of the WOI.
+     * @param x0 Horizontal position of the WOI in that level.
+     * @param y0 Vertical position of the WOI in that level.
+     * @param size Width and height of the WOI.
+     * @param num_layers Layers sent, the last one completes the precincts.
+     */
+    void Send(int cs, int r, int x0, int y0, int size, int num_layers) {
+        for (int l = 0; l < num_layers; ++l)
+            for (int rr = 0; rr <= r; ++rr) {
+                int s = r - rr, n = GetPrecincts(rr), first = GetFirstPrecinct(rr);
+                int px0 = (x0 >> s) / PRECINCT_SIZE, py0 = (y0 >> s) / PRECINCT_SIZE;
+                int px1 = min(n - 1, ((x0 + size) >> s) / PRECINCT_SIZE);
+                int py1 = min(n - 1, ((y0 + size) >> s) / PRECINCT_SIZE);
+
+                for (int y = py0; y <= py1; ++y)
+                    for (int x = px0; x <= px1; ++x) {
+                        int id = first + (y * n) + x;
+                        if (model.GetPrecinct(cs, id) != INT_MAX)
+                            model.AddToPrecinct(cs, id, PACKET_LENGTH, l == NUM_LAYERS - 1);
+                        ops++;
+                    }
+            }
+    }
+};
+
+/**
+ * Runs a scenario, measuring the time of the operations, the memory
+ * of the resulting model and the time to merge it into an empty one.
+ */
+template<typename Model, typename Scenario>
+static Result Run(Scenario scenario) {
+    Result res;
+    size_t before = live_bytes;
+    Workload<Model> workload;
+
+    double time = GetTime();
+    scenario(workload);
+    res.ns_op = (GetTime() - time) * 1e9 / workload.ops;
+    res.model_bytes = live_bytes - before;
+
+    Model model;
+    time = GetTime();
+    for (int i = 0; i < 100; ++i) {
+        model.Clear();
+        model += workload.model;
+    }
+    res.merge_us = (GetTime() - time) * 1e6 / 100;
+
+    return res;
+}
+
+template<typename Scenario>
+static void Compare(const char *name, Scenario scenario) {
+    srand(1);
+    Result old_res = Run<OldCacheModel>(scenario);
+    srand(1);
+    Result new_res = Run<NewCacheModel>(scenario);
+
+    cout << setiosflags(ios::fixed) << setprecision(1) << name << ":" << endl
+         << "  Operation: " << old_res.ns_op << " -> " << new_res.ns_op << " ns" << endl
+         << "  Model: " << old_res.model_bytes << " -> " << new_res.model_bytes << " bytes" << endl
+         << "  Merge: " << old_res.merge_us << " -> " << new_res.merge_us << " us" << endl;
+}
+
+/**
+ * Random WOIs of 1024x1024 at the four highest resolution levels.
+ */
+struct PanZoom {
+    template<typename Model>
+    void operator()(Workload<Model> &workload) const {
+        for (int i = 0; i < 300; ++i) {
+            int r = 3 + rand() % 4, size = IMAGE_SIZE >> (NUM_LEVELS - 1 - r);
+            int x = rand() % max(1, size - 1024), y = rand() % max(1, size - 1024);
+            workload.Send(0, r, x, y, 1024, NUM_LAYERS);
+            workload.model.Pack();
+        }
+    }
+};
+
+/**
+ * The whole image of 1000 frames, at the resolution 4096x4096.
+ */
+struct Movie {
+    template<typename Model>
+    void operator()(Workload<Model> &workload) const {
+        for (int f = 0; f < 1000; ++f) {
+            workload.Send(f, 4, 0, 0, 4096, NUM_LAYERS);
+            workload.model.Pack();
+        }
+    }
+};
+
+/**
+ * WOIs of 2048x2048 moving up from the bottom right corner,
+ * at the full resolution.
+ */
+struct DeepZoom {
+    template<typename Model>
+    void operator()(Workload<Model> &workload) const {
+        for (int i = 0; i < 50; ++i)
+            workload.Send(0, NUM_LEVELS - 1, IMAGE_SIZE - 2048, IMAGE_SIZE - 2048 - i * 64, 2048, NUM_LAYERS);
+        workload.model.Pack();
+    }
+};
+
+/**
+ * WOIs of 2048x2048 at the full resolution, whose responses are
+ * cut by the byte limit after 3 layers, so the precincts are only
+ * partially sent.
+ */
+struct Partial {
+    template<typename Model>
+    void operator()(Workload<Model> &workload) const {
+        for (int i = 0; i < 20; ++i) {
+            workload.Send(0, NUM_LEVELS - 1, 60 * PRECINCT_SIZE, i * 4 * PRECINCT_SIZE, 2048, 3);
+            workload.model.Pack();
+        }
+    }
+};
+
+/**
+ * Microbenchmark of the precinct amounts of the cache model, against
+ * the representation used before the bitmap of complete precincts. It
+ * simulates the requests of a client on a 16384x16384 image with 7
+ * resolution levels, precincts of 128x128 and 8 quality layers, and
+ * measures the time per operation, the memory of the resulting model
+ * and the time to merge it into an empty one.
+ */
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        cerr << "Usage: " << argv[0] << endl;
+        return -1;
+    }
+
+    Compare("Pan and zoom (300 WOIs)", PanZoom());
+    Compare("Movie (1000 frames)", Movie());
+    Compare("Deep zoom (50 WOIs)", DeepZoom());
+    Compare("Byte limited (20 WOIs)", Partial());
+
+    return 0;
+}
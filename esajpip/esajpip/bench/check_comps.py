@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Checks the selection of image components ("comps" parameter) of a server.
+
+Usage: check_comps.py port target num_components stream window
+
+For several selections, it requests the window of the target and checks that
+the response contains exactly the data-bins of the response without "comps"
+whose component is selected, plus all the headers and meta-data, ending with
+WINDOW_DONE. It also requests the components 0, then "1-", then all of them in
+one channel, and checks that the data-bins add up to the full response. The
+images can be generated with mkjp2.py, for instance:
+
+    check_comps.py 8090 rgb.jp2 3 0 fsiz=1024,1024&rsiz=1024,1024&roff=0,0
+    check_comps.py 8090 c4.jpx 4 0:4 fsiz=512,512&rsiz=512,512&roff=0,0
+"""
+import socket, sys
+
+PRECINCT = 0
+WINDOW_DONE = 2
+MAX_COMPONENT_RANGES = 16
+
+
+def read_response(f):
+    status = f.readline()
+    headers = {}
+    while True:
+        line = f.readline()
+        if line in (b'\r\n', b'\n', b''): break
+        k, v = line.decode().split(':', 1)
+        headers[k.strip().lower()] = v.strip()
+    body = b''
+    if headers.get('transfer-encoding') == 'chunked':
+        while True:
+            n = int(f.readline().strip(), 16)
+            if n == 0:
+                f.readline()
+                break
+            body += f.read(n)
+            f.readline()
+    elif 'content-length' in headers:
+        body = f.read(int(headers['content-length']))
+    return status.decode().strip(), headers, body
+
+
+def vbas(b, i):
+    v = 0
+    while True:
+        c = b[i]; i += 1
+        v = (v << 7) | (c & 0x7f)
+        if not c & 0x80: return v, i
+
+
+def parse(b):
+    """Returns the data-bins of a JPP-stream, by (codestream, class, id)."""
+    bins = {}; i = 0; cls = 0; csn = 0
+    while i < len(b):
+        c = b[i]
+        if c == 0: break
+        ind = (c >> 5) & 3; v = c & 0x0f; i += 1
+        while c & 0x80:
+            c = b[i]; i += 1; v = (v << 7) | (c & 0x7f)
+        if ind >= 2: cls, i = vbas(b, i)
+        if ind == 3: csn, i = vbas(b, i)
+        off, i = vbas(b, i); ln, i = vbas(b, i)
+        if cls & 1: _, i = vbas(b, i)
+        x = bins.setdefault((csn, cls & ~1, v), bytearray())
+        d = b[i:i + ln]; i += ln
+        if len(x) < off + len(d): x.extend(b'\0' * (off + len(d) - len(x)))
+        x[off:off + len(d)] = d
+    return {k: bytes(v) for k, v in bins.items()}
+
+
+def get(port, query):
+    s = socket.create_connection(('127.0.0.1', port)); f = s.makefile('rb')
+    s.sendall(('GET /jpip?%s HTTP/1.1\r\nHost: x\r\n\r\n' % query).encode())
+    res = read_response(f)
+    s.close()
+    return res
+
+
+def main():
+    if len(sys.argv) != 6:
+        sys.exit(__doc__)
+    port, target, nc, stream, win = int(sys.argv[1]), sys.argv[2], int(sys.argv[3]), sys.argv[4], sys.argv[5]
+    all_comps = set(range(nc))
+
+    base = 'target=%s&cnew=http&stream=%s&%s&len=900000000' % (target, stream, win)
+    _, _, full_body = get(port, base)
+    full = parse(full_body)
+
+    # Selection and expected components, None if the value is ignored
+    many = ','.join(str(2 * i) for i in range(MAX_COMPONENT_RANGES + 1))
+    selections = [
+        ('0', {0}), ('1', {1}), (str(nc - 1), {nc - 1}), ('0,2', {0, 2}), ('1-', all_comps - {0}),
+        ('0-1,3', {0, 1, 3}), ('2,0,2', {0, 2}), ('1,0', {0, 1}), ('0-%d' % (nc - 1), all_comps),
+        ('99', set()), ('0-2147483647', all_comps), (','.join(['0-'] * 50000), all_comps),
+        (','.join(str(2 * i) for i in range(MAX_COMPONENT_RANGES)), {2 * i for i in range(MAX_COMPONENT_RANGES)}),
+        (many, None), ('x', None), ('1-0', None), ('3-1', None),
+    ]
+
+    ok = True
+    for comps, sel in selections:
+        _, _, b = get(port, base + '&comps=' + comps)
+        got = parse(b)
+        sel = all_comps if sel is None else sel & all_comps
+        exp = {k: v for k, v in full.items() if k[1] != PRECINCT or (k[2] % nc) in sel}
+        good = got == exp and b[-2] == WINDOW_DONE
+        ok &= good
+        print('comps=%-12s %8d bytes, %4d bins, eor %d %s' % (comps[:12], len(b), len(got), b[-2], 'ok' if good else 'BAD'))
+
+    # Incremental in one channel: 0, then 1-, then all
+    s = socket.create_connection(('127.0.0.1', port)); f = s.makefile('rb')
+    s.sendall(('GET /jpip?%s&comps=0 HTTP/1.1\r\nHost: x\r\n\r\n' % base).encode())
+    _, h, b = read_response(f)
+    cid = h['jpip-cnew'].split(',')[0][4:]
+    bodies = [b]
+    for q in ('&comps=1-', ''):
+        s.sendall(('GET /jpip?cid=%s&stream=%s&%s&len=900000000%s HTTP/1.1\r\nHost: x\r\n\r\n' % (cid, stream, win, q)).encode())
+        _, _, b = read_response(f)
+        bodies.append(b)
+    s.close()
+
+    merged = {}
+    for b in bodies:
+        for k, v in parse(b).items():
+            if len(v) >= len(merged.get(k, b'')): merged[k] = v
+    good = merged == full
+    ok &= good
+    print('incremental %s bytes, full %d bytes %s' % ([len(b) for b in bodies], len(full_body), 'ok' if good else 'BAD'))
+
+    print('ALL OK' if ok else 'FAIL')
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
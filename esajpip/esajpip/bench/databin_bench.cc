@@ -0,0 +1,107 @@
+#include <string>
+#include <vector>
+#include <climits>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <time.h>
+#include <unistd.h>
+
+#include "jpeg2000/file_manager.h"
+#include "jpip/databin_server.h"
+#include "jpip/request.h"
+
+using namespace std;
+using namespace jpeg2000;
+using namespace jpip;
+
+#define BUFFER_SIZE (1 << 20)
+
+static void Usage(const char *app_name) {
+    cerr << "Usage: " << app_name << " [-r rounds] image_file" << endl << endl
+         << "Measures the throughput of DataBinServer::GenerateChunk when the" << endl
+         << "complete image is requested at its full resolution, with all its" << endl
+         << "layers and components. The image can be generated with mkjp2.py." << endl;
+}
+
+static double GetTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Benchmark of the generation of the data-bins of a request. It
+ * prints the number of packets per second and a hash of the data
+ * sent, to check that the output does not change.
+ */
+int main(int argc, char **argv) {
+    int rounds = 10;
+
+    for (int opt; (opt = getopt(argc, argv, "r:h")) != -1;) {
+        switch (opt) {
+            case 'r': rounds = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (optind != argc - 1 || rounds <= 0) {
+        Usage(argv[0]);
+        return -1;
+    }
+
+    FileManager file_manager;
+    string path_name = argv[optind];
+    if (!file_manager.Init("/") || !file_manager.OpenImage(path_name))
+        return CERR("The image file '" << argv[optind] << "' can not be opened");
+
+    const CodingParameters *params = file_manager.GetCodingParameters();
+    uint64_t num_packets = 0;
+    for (int r = 0; r <= params->num_levels; ++r)
+        num_packets += (uint64_t) params->GetNumPrecincts(r).x * params->GetNumPrecincts(r).y;
+    num_packets *= params->num_layers * params->num_components;
+
+    ostringstream line;
+    line << "GET /jpip?stream=0&fsiz=" << params->size.x << "," << params->size.y << "&rsiz=" << params->size.x << ","
+         << params->size.y << "&roff=0,0&len=" << INT_MAX << " HTTP/1.1";
+
+    vector<char> buf(BUFFER_SIZE);
+    vector<iovec> chunk;
+    uint64_t hash = 14695981039346656037ULL, bytes = 0;
+
+    // The first response builds the packet index, so it is not timed
+    double time = 0;
+    for (int k = 0; k <= rounds; ++k) {
+        if (k == 1) time = GetTime();
+        DataBinServer data_server;
+        data_server.Reset();
+
+        Request req;
+        if (!req.Parse(line.str()) || !data_server.SetRequest(file_manager, req))
+            return CERR("The request can not be processed");
+
+        for (bool last = false; !last;) {
+            int len = BUFFER_SIZE;
+            if (!data_server.GenerateChunk(file_manager, &buf[0], &len, &chunk, &last))
+                return CERR("The chunk can not be generated");
+
+            // FNV-1a hash of the first response
+            for (size_t i = 0; k == 0 && i < chunk.size(); ++i) {
+                const uint8_t *data = (const uint8_t *) chunk[i].iov_base;
+                for (size_t j = 0; j < chunk[i].iov_len; ++j)
+                    hash = (hash ^ data[j]) * 1099511628211ULL;
+                bytes += chunk[i].iov_len;
+            }
+        }
+    }
+    time = (GetTime() - time) / rounds;
+
+    cout << setiosflags(ios::fixed) << setprecision(2)
+         << "Packets: " << num_packets << ", bytes: " << bytes << ", hash: " << hex << hash << dec << endl
+         << "Time: " << time * 1e3 << " ms/request" << endl
+         << "Throughput: " << num_packets / time / 1e6 << " Mpackets/s" << endl;
+
+    return 0;
+}
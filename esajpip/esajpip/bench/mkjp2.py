@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+"""Generates synthetic JP2 and JPX images for the benchmarks and checks.
+
+The codestreams contain random packet data described by PLT markers, so
+they can not be decoded, but they are valid for the indexer of the server.
+The images used by check_comps.py are generated with:
+
+    mkjp2.py rgb.jp2 --comps 3 --layers 3 --prog 1 --seed 7
+    mkjp2.py c4.jpx --comps 4 --layers 2 --w 512 --h 512 --frames 5 --seed 11
+"""
+import struct, random, math, sys, argparse
+
+def precincts(W, H, L, r, pp):
+    sx = math.ceil(W / (1 << (L - r))); sy = math.ceil(H / (1 << (L - r)))
+    return math.ceil(sx / pp[r][0]), math.ceil(sy / pp[r][1])
+
+def codestream(W, H, L, layers, comps, prog, ppexp, seed, tileparts=1, maxpkt=300):
+    rnd = random.Random(seed)
+    pp = [(1 << e, 1 << e) for e in ppexp]
+    n = 0
+    for r in range(L + 1):
+        px, py = precincts(W, H, L, r, pp); n += px * py
+    npk = n * layers * comps
+    lens = [rnd.choice([1, 1, 2, rnd.randint(1, maxpkt), rnd.randint(1, maxpkt * 20)]) for _ in range(npk)]
+    out = b'\xff\x4f'
+    siz = struct.pack('>HIIIIIIIIH', 0, W, H, 0, 0, W, H, 0, 0, comps) + b'\x07\x01\x01' * comps
+    out += b'\xff\x51' + struct.pack('>H', len(siz) + 2) + siz
+    cod = struct.pack('>BBHBBBBBB', 1, prog, layers, 0, L, 4, 4, 0, 1) + bytes((e << 4) | e for e in ppexp)
+    out += b'\xff\x52' + struct.pack('>H', len(cod) + 2) + cod
+    qcd = b'\x40' + b'\x00' * (3 * L + 1)
+    out += b'\xff\x5c' + struct.pack('>H', len(qcd) + 2) + qcd
+    # Split the packets into tile-parts
+    per = math.ceil(npk / tileparts)
+    for tp in range(tileparts):
+        pl = lens[tp * per:(tp + 1) * per]
+        plts = b''
+        enc = b''
+        zi = 0
+        def flush(enc, zi):
+            return b'\xff\x58' + struct.pack('>HB', len(enc) + 3, zi) + enc
+        for ln in pl:
+            v = []
+            x = ln
+            v.append(x & 0x7f); x >>= 7
+            while x:
+                v.append((x & 0x7f) | 0x80); x >>= 7
+            b = bytes(reversed(v))
+            if len(enc) + len(b) > 60000:
+                plts += flush(enc, zi); zi += 1; enc = b''
+            enc += b
+        if enc:
+            plts += flush(enc, zi)
+        body = bytes(rnd.getrandbits(8) | 1 for _ in range(sum(pl)))
+        # Avoid 0xFF in the packet data, as it could be taken for a marker
+        body = body.replace(b'\xff', b'\xfe')
+        sot_len = 12 + len(plts) + 2 + len(body)
+        out += b'\xff\x90' + struct.pack('>HHIBB', 10, 0, sot_len, tp, tileparts) + plts + b'\xff\x93' + body
+    out += b'\xff\xd9'
+    return out
+
+def box(t, payload):
+    return struct.pack('>I', len(payload) + 8) + t + payload
+
+def jp2(cs, xml=b''):
+    out = box(b'jP  ', b'\r\n\x87\n') + box(b'ftyp', b'jp2 \x00\x00\x00\x00jp2 ')
+    out += box(b'jp2h', box(b'ihdr', b'\x00' * 14))
+    if xml:
+        out += box(b'xml ', xml)
+    out += box(b'jp2c', cs)
+    return out
+
+def jpx(css, xml=b''):
+    out = box(b'jP  ', b'\r\n\x87\n') + box(b'ftyp', b'jpx \x00\x00\x00\x00jpx jp2 ')
+    out += box(b'jp2h', box(b'ihdr', b'\x00' * 14))
+    if xml:
+        out += box(b'xml ', xml)
+    for cs in css:
+        out += box(b'jpch', b'') + box(b'jp2c', cs)
+    return out
+
+if __name__ == '__main__':
+    ap = argparse.ArgumentParser()
+    ap.add_argument('out'); ap.add_argument('--w', type=int, default=1024); ap.add_argument('--h', type=int, default=1024)
+    ap.add_argument('--levels', type=int, default=5); ap.add_argument('--layers', type=int, default=4)
+    ap.add_argument('--comps', type=int, default=1); ap.add_argument('--prog', type=int, default=2)
+    ap.add_argument('--pp', type=int, default=7); ap.add_argument('--seed', type=int, default=1)
+    ap.add_argument('--tileparts', type=int, default=1); ap.add_argument('--frames', type=int, default=0)
+    a = ap.parse_args()
+    ppexp = [a.pp] * (a.levels + 1)
+    xml = b'<meta><fits>' + b'X' * 3000 + b'</fits></meta>'
+    if a.frames:
+        data = jpx([codestream(a.w, a.h, a.levels, a.layers, a.comps, a.prog, ppexp, a.seed + i, a.tileparts) for i in range(a.frames)], xml)
+    else:
+        data = jp2(codestream(a.w, a.h, a.levels, a.layers, a.comps, a.prog, ppexp, a.seed, a.tileparts), xml)
+    open(a.out, 'wb').write(data)
@@ -0,0 +1,236 @@
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <time.h>
+#include <unistd.h>
+
+#include "jpeg2000/packet_index.h"
+
+using namespace std;
+using namespace jpeg2000;
+
+/**
+ * Packet index as it was before the blocks: a flat array of 32-bit
+ * offsets, where the values below <code>MINIMUM_OFFSET</code> are
+ * positions in an auxiliary vector with the last segment of each set
+ * of contiguous packets. It only supports files below 4 GiB and up
+ * to <code>MINIMUM_OFFSET - 1</code> gaps between the packets.
+ */
+class OldPacketIndex {
+private:
+    vector<uint32_t> offsets;
+    vector<FileSegment> aux;
+
+public:
+    enum {
+        MINIMUM_OFFSET = 64
+    };
+
+    /**
+     * Returns <code>true</code> if the segments can be stored.
+     */
+    static bool IsSupported(const vector<FileSegment> &segments) {
+        int gaps = 0;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (segments[i].offset < MINIMUM_OFFSET || segments[i].offset + segments[i].length > UINT32_MAX) return false;
+            if (i > 0 && !segments[i - 1].IsContiguousTo(segments[i])) gaps++;
+        }
+        return gaps < MINIMUM_OFFSET - 1;
+    }
+
+    OldPacketIndex &Add(const FileSegment &segment) {
+        int last = aux.size() - 1;
+
+        if (last < 0) {
+            aux.push_back(segment);
+            offsets.push_back(0);
+        } else if (aux[last].IsContiguousTo(segment)) {
+            offsets.back() = aux[last].offset;
+            offsets.push_back(last);
+            aux[last] = segment;
+        } else {
+            offsets.push_back(last + 1);
+            aux.push_back(segment);
+        }
+
+        return *this;
+    }
+
+    bool Get(int i, FileSegment *segment) const {
+        if (i < 0 || i >= (int) offsets.size())
+            return false;
+
+        uint64_t off_i = offsets[i];
+
+        if (off_i < MINIMUM_OFFSET) {
+            if (off_i >= aux.size())
+                return false;
+
+            *segment = aux[off_i];
+            return true;
+        } else {
+            if (i + 1 >= (int) offsets.size())
+                return false;
+
+            uint64_t off_i1 = offsets[i + 1];
+
+            if (off_i1 < MINIMUM_OFFSET) {
+                if (off_i1 >= aux.size())
+                    return false;
+
+                off_i1 = aux[off_i1].offset;
+            }
+
+            if (off_i1 < off_i)
+                return false;
+
+            *segment = FileSegment(off_i, off_i1 - off_i);
+            return true;
+        }
+    }
+
+    void Compact() {
+        offsets.shrink_to_fit();
+        aux.shrink_to_fit();
+    }
+
+    uint64_t GetMemoryUsage() const {
+        return offsets.capacity() * sizeof(uint32_t) + aux.capacity() * sizeof(FileSegment);
+    }
+};
+
+static void Usage(const char *app_name) {
+    cerr << "Usage: " << app_name << " [-n packets] [-l max_length] [-g gap_interval] [-o first_offset] [-r rounds]" << endl;
+}
+
+static double GetTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Result of the measures of an index.
+ */
+struct Result {
+    double memory;          ///< Bytes per packet
+    double build;           ///< Nanoseconds per added packet
+    double random;          ///< Nanoseconds per random Get
+    double sequential;      ///< Nanoseconds per sequential Get
+};
+
+/**
+ * Builds an index of the segments, checks all its segments and
+ * measures the memory used and the time of the random and the
+ * sequential lookups.
+ * @return <code>false</code> if any segment is wrong.
+ */
+template<typename Index>
+static bool Measure(const vector<FileSegment> &segments, const vector<int> &random_order, int rounds, Result *res) {
+    int num_packets = segments.size();
+
+    double time = GetTime();
+    Index index;
+    for (int i = 0; i < num_packets; ++i)
+        index.Add(segments[i]);
+    index.Compact();
+    res->build = (GetTime() - time) * 1e9 / num_packets;
+    res->memory = (double) index.GetMemoryUsage() / num_packets;
+
+    FileSegment segment;
+    for (int i = 0; i < num_packets; ++i) {
+        if (!index.Get(i, &segment) || segment != segments[i]) {
+            cerr << "Wrong segment of the packet " << i << ": " << segment << " != " << segments[i] << endl;
+            return false;
+        }
+    }
+
+    uint64_t check = 0;
+    double lookups = (double) num_packets * rounds;
+
+    time = GetTime();
+    for (int r = 0; r < rounds; ++r)
+        for (int i = 0; i < num_packets; ++i) {
+            index.Get(random_order[i], &segment);
+            check += segment.length;
+        }
+    res->random = (GetTime() - time) * 1e9 / lookups;
+
+    time = GetTime();
+    for (int r = 0; r < rounds; ++r)
+        for (int i = 0; i < num_packets; ++i) {
+            index.Get(i, &segment);
+            check += segment.length;
+        }
+    res->sequential = (GetTime() - time) * 1e9 / lookups;
+
+    // The sum is used, so the lookups are not optimized out
+    if (check == 1) cerr << endl;
+    return true;
+}
+
+static void Print(const char *name, const Result &res) {
+    cout << setiosflags(ios::fixed) << setprecision(2) << name << ": "
+         << res.memory << " B/packet, build " << res.build << " ns, random Get "
+         << res.random << " ns, sequential Get " << res.sequential << " ns" << endl;
+}
+
+/**
+ * Microbenchmark of the packet index, against the representation
+ * used before the blocks. It builds a synthetic index with packet
+ * lengths log-uniform in [1, max_length], and a gap after every
+ * <code>gap_interval</code> packets, like the ends of the tile-parts,
+ * starting at a given offset of the file. Then it measures the memory
+ * used and the time of the random and the sequential lookups. The old
+ * representation is skipped if it can not store the packets.
+ */
+int main(int argc, char **argv) {
+    int num_packets = 1 << 21, max_length = 1 << 12, gap_interval = 1 << 16, rounds = 5;
+    uint64_t first_offset = 64;
+
+    for (int opt; (opt = getopt(argc, argv, "n:l:g:o:r:h")) != -1;) {
+        switch (opt) {
+            case 'n': num_packets = atoi(optarg); break;
+            case 'l': max_length = atoi(optarg); break;
+            case 'g': gap_interval = atoi(optarg); break;
+            case 'o': first_offset = strtoull(optarg, NULL, 0); break;
+            case 'r': rounds = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (num_packets <= 0 || max_length <= 0 || gap_interval <= 0 || rounds <= 0) {
+        Usage(argv[0]);
+        return -1;
+    }
+
+    srand(1);
+    vector<FileSegment> segments;
+    uint64_t offset = first_offset;
+    for (int i = 0; i < num_packets; ++i) {
+        uint64_t length = 1;
+        for (int bits = rand() % 15; bits > 0 && length < (uint64_t) max_length; --bits) length *= 2;
+        length = min((uint64_t) max_length, length + rand() % length);
+        segments.push_back(FileSegment(offset, length));
+        offset += length;
+        if ((i + 1) % gap_interval == 0) offset += 14;
+    }
+
+    vector<int> random_order(num_packets);
+    for (int i = 0; i < num_packets; ++i) random_order[i] = rand() % num_packets;
+
+    cout << "Packets: " << num_packets << ", last offset: " << offset << endl;
+
+    Result res;
+    if (!OldPacketIndex::IsSupported(segments)) cout << "Old: not supported (offsets beyond 4 GiB or too many gaps)" << endl;
+    else if (!Measure<OldPacketIndex>(segments, random_order, rounds, &res)) return 1;
+    else Print("Old", res);
+
+    if (!Measure<PacketIndex>(segments, random_order, rounds, &res)) return 1;
+    Print("New", res);
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include <cmath>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <time.h>
+#include <unistd.h>
+
+#include "jpip/woi_composer.h"
+
+using namespace std;
+using namespace jpeg2000;
+using namespace jpip;
+
+static void Usage(const char *app_name) {
+    cerr << "Usage: " << app_name << " [-n images] [-r rounds]" << endl;
+}
+
+static double GetTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Returns a random number in [min, max].
+ */
+static int Random(int min, int max) {
+    long long value = ((long long) rand() << 31) | rand();
+    return (int) (min + value % ((long long) max - min + 1));
+}
+
+/**
+ * Number of precincts up to a point of the reference grid, as it was
+ * computed with floating point operations.
+ */
+static Size GetOldPrecincts(const CodingParameters &p, int r, const Size &point) {
+    return Size((int) ceil(ceil((double) point.x / (1L << (p.num_levels - r))) / (double) p.precinct_size[r].x),
+                (int) ceil(ceil((double) point.y / (1L << (p.num_levels - r))) / (double) p.precinct_size[r].y));
+}
+
+/**
+ * Size of the image with r resolution levels discarded, as it was
+ * computed with floating point operations.
+ */
+static Size GetOldResolutionSize(const CodingParameters &p, int r) {
+    return Size((int) ceil((double) p.size.x / (1L << r)), (int) ceil((double) p.size.y / (1L << r)));
+}
+
+static int ClampResolution(const CodingParameters &p, int r) {
+    int res = p.num_levels - r;
+    return res > p.num_levels ? p.num_levels : (res < 0 ? 0 : res);
+}
+
+static int GetOldClosestResolution(const CodingParameters &p, const Size &res_size, Size *res_image_size) {
+    int final_r = 0, min = abs(p.size.x - res_size.x) + abs(p.size.y - res_size.y);
+    *res_image_size = p.size;
+
+    for (int r = 1; r <= p.num_levels; ++r) {
+        Size size = GetOldResolutionSize(p, r);
+        int diff = abs(size.x - res_size.x) + abs(size.y - res_size.y);
+        if (diff < min) {
+            *res_image_size = size;
+            min = diff;
+            final_r = r;
+        }
+    }
+    return ClampResolution(p, final_r);
+}
+
+static int GetOldRoundUpResolution(const CodingParameters &p, const Size &res_size, Size *res_image_size) {
+    int r = p.num_levels;
+    for (; r >= 0; --r) {
+        *res_image_size = GetOldResolutionSize(p, r);
+        if (res_image_size->x >= res_size.x && res_image_size->y >= res_size.y) break;
+    }
+    return ClampResolution(p, r);
+}
+
+static int GetOldRoundDownResolution(const CodingParameters &p, const Size &res_size, Size *res_image_size) {
+    int r = 0;
+    for (; r <= p.num_levels; ++r) {
+        *res_image_size = GetOldResolutionSize(p, r);
+        if (res_image_size->x <= res_size.x && res_image_size->y <= res_size.y) break;
+    }
+    return ClampResolution(p, r);
+}
+
+/**
+ * Compares the precinct geometry of random coding parameters with
+ * the floating point computation: 0-32 levels, power of two and
+ * arbitrary precinct sizes, and negative and large coordinates.
+ * @param num_images Number of random coding parameters.
+ * @param checks Receives the number of comparisons.
+ * @return The number of differences.
+ */
+static long Verify(int num_images, long *checks) {
+    long diffs = 0;
+    *checks = 0;
+
+    for (int i = 0; i < num_images; ++i) {
+        CodingParameters p;
+        p.num_levels = Random(0, 32);
+        p.num_layers = 1;
+        p.num_components = 1;
+        p.progression = 0;
+
+        int max_size = Random(0, 3) ? 1 << 16 : 1 << 30;
+        p.size = Size(Random(1, max_size), Random(1, max_size));
+
+        for (int r = 0; r <= p.num_levels; ++r) {
+            if (Random(0, 2)) p.precinct_size.push_back(Size(1 << Random(0, 15), 1 << Random(0, 15)));
+            else p.precinct_size.push_back(Size(Random(1, 1 << 20), Random(1, 1 << 20)));
+        }
+
+        // The progression table is kept small
+        bool small = true;
+        for (int r = 0; r <= p.num_levels; ++r) {
+            Size n = GetOldPrecincts(p, r, p.size);
+            if ((double) n.x * n.y > 1e5) small = false;
+        }
+        if (!small) continue;
+
+        p.FillTotalPrecinctsVector();
+
+        for (int k = 0; k < 200; ++k) {
+            int r = Random(0, p.num_levels);
+            Size point = (k & 1) ? Size(Random(-100, 100), Random(-100, 100))
+                                 : Size(Random(-(1 << 30), 1 << 30), Random(-(1 << 30), 1 << 30));
+
+            Size old_precincts = GetOldPrecincts(p, r, point), precincts = p.GetPrecincts(r, point);
+            if (old_precincts != precincts) {
+                if (diffs < 10)
+                    cerr << "Different precincts: levels " << p.num_levels << ", r " << r << ", point " << point
+                         << ", precinct size " << p.precinct_size[r] << ": " << old_precincts << " != " << precincts << endl;
+                diffs++;
+            }
+
+            Size res_size = (k & 2) ? GetOldResolutionSize(p, Random(0, p.num_levels))
+                                    : Size(Random(0, p.size.x + 10), Random(0, p.size.y + 10));
+            Size old_size, size;
+
+            if (GetOldClosestResolution(p, res_size, &old_size) != p.GetClosestResolution(res_size, &size) || old_size != size) diffs++;
+            if (GetOldRoundUpResolution(p, res_size, &old_size) != p.GetRoundUpResolution(res_size, &size) || old_size != size) diffs++;
+            if (GetOldRoundDownResolution(p, res_size, &old_size) != p.GetRoundDownResolution(res_size, &size) || old_size != size) diffs++;
+            *checks += 4;
+        }
+
+        for (int r = 0; r <= p.num_levels; ++r) {
+            if (GetOldResolutionSize(p, p.num_levels - r) != p.GetResolutionSize(r)) diffs++;
+            (*checks)++;
+        }
+    }
+
+    return diffs;
+}
+
+/**
+ * Measures the packets per second of WOIComposer::GetNextPacket and
+ * CodingParameters::GetPrecinctDataBinId, for random WOIs of an image
+ * of 4096x4096 with 8 levels, precincts of 128x128 and 8 layers.
+ * @param max_woi Maximum width and height of the WOIs.
+ * @param rounds Number of times the WOIs are traversed.
+ */
+static void Measure(int max_woi, int rounds) {
+    CodingParameters p;
+    p.size = Size(4096, 4096);
+    p.num_levels = 8;
+    p.num_layers = 8;
+    p.num_components = 1;
+    p.progression = 0;
+    for (int r = 0; r <= p.num_levels; ++r)
+        p.precinct_size.push_back(r < 2 ? Size(32768, 32768) : Size(128, 128));
+    p.FillTotalPrecinctsVector();
+
+    vector<WOI> wois(1000);
+    for (size_t i = 0; i < wois.size(); ++i) {
+        int res_size = p.size.x >> (p.num_levels - (wois[i].resolution = Random(0, p.num_levels)));
+        wois[i].size = Size(Random(1, max_woi), Random(1, max_woi));
+        wois[i].position = Size(Random(0, res_size - 1), Random(0, res_size - 1));
+    }
+
+    long packets = 0, check = 0;
+    double time = GetTime();
+    for (int r = 0; r < rounds; ++r)
+        for (size_t i = 0; i < wois.size(); ++i) {
+            WOIComposer composer;
+            Packet packet;
+
+            composer.Reset(&p, wois[i]);
+            while (composer.GetNextPacket(&p, &packet)) {
+                check += p.GetPrecinctDataBinId(packet);
+                packets++;
+            }
+        }
+    time = GetTime() - time;
+
+    cout << setiosflags(ios::fixed) << setprecision(1)
+         << "WOI up to " << max_woi << "x" << max_woi << ": " << packets / time / 1e6
+         << " Mpackets/s (check " << check % 1000 << ")" << endl;
+}
+
+/**
+ * Randomized verification and microbenchmark of the precinct
+ * geometry. First it compares the number of precincts and the
+ * resolution sizes with the floating point computation used before,
+ * failing if there is any difference. Then it measures the packets
+ * per second generated for WOIs of different sizes.
+ */
+int main(int argc, char **argv) {
+    int num_images = 20000, rounds = 20;
+
+    for (int opt; (opt = getopt(argc, argv, "n:r:h")) != -1;) {
+        switch (opt) {
+            case 'n': num_images = atoi(optarg); break;
+            case 'r': rounds = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (num_images < 0 || rounds <= 0) {
+        Usage(argv[0]);
+        return -1;
+    }
+
+    srand(1);
+    long checks;
+    long diffs = Verify(num_images, &checks);
+    cout << "Checks: " << checks << ", differences: " << diffs << endl;
+    if (diffs > 0) return 1;
+
+    Measure(1, rounds * 50);
+    Measure(64, rounds * 10);
+    Measure(1024, rounds);
+
+    return 0;
+}
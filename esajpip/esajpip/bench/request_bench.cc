@@ -0,0 +1,79 @@
+#include <string>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <time.h>
+#include <unistd.h>
+
+#include "jpip/request.h"
+
+using namespace std;
+using namespace jpip;
+
+static void Usage(const char *app_name) {
+    cerr << "Usage: " << app_name << " [-n max_bins] [-r requests]" << endl;
+}
+
+static double GetTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Benchmark of the request parser. It parses a typical WOI request
+ * with a <code>model</code> parameter of 0, 10, 100... bin-descriptors,
+ * up to <code>max_bins</code>, and prints the number of requests and
+ * bytes parsed per second. A third of the bin-descriptors contain an
+ * amount of bytes.
+ */
+int main(int argc, char **argv) {
+    int max_bins = 10000, requests = 2000000;
+
+    for (int opt; (opt = getopt(argc, argv, "n:r:h")) != -1;) {
+        switch (opt) {
+            case 'n': max_bins = atoi(optarg); break;
+            case 'r': requests = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (max_bins < 0 || requests <= 0) {
+        Usage(argv[0]);
+        return -1;
+    }
+
+    srand(1);
+    Request req;
+
+    for (int num_bins = 0; num_bins <= max_bins; num_bins = (num_bins ? num_bins * 10 : 10)) {
+        string model;
+        for (int i = 0; i < num_bins; ++i) {
+            if (i > 0) model += ",";
+            model += "P" + to_string(rand() % 5000);
+            if (rand() % 3 == 0) model += ":" + to_string(rand() % 10000);
+        }
+
+        string line = "GET /jpip?cid=1792201965-7896-10&stream=0&fsiz=4096,4096,closest&rsiz=1024,1024&roff=512,512&len=2000000"
+                      + (num_bins > 0 ? "&model=" + model : string()) + " HTTP/1.1";
+
+        int iters = max(200, requests / (num_bins + 1));
+        double time = GetTime();
+        for (int i = 0; i < iters; ++i) {
+            if (!req.Parse(line) || (num_bins > 0 && !req.mask.items.model)) {
+                cerr << "The request can not be parsed" << endl;
+                return 1;
+            }
+        }
+        time = GetTime() - time;
+
+        cout << setiosflags(ios::fixed) << setprecision(1)
+             << "Bins: " << num_bins << " (" << line.size() << " bytes), "
+             << iters / time << " requests/s, "
+             << iters * line.size() / time / 1e6 << " MB/s" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <log4cpp/Category.hh>
+#include "jpip/request.h"
+
+using namespace std;
+using namespace jpip;
+
+/**
+ * Initialization of the fuzz target. The log messages of the
+ * invalid requests are disabled, as they are most of the inputs.
+ */
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    log4cpp::Category::getInstance("Category").setPriority(log4cpp::Priority::FATAL);
+    return 0;
+}
+
+/**
+ * Fuzz target of the request parser. The input is copied into a
+ * buffer of its exact length, so an over-read is detected when the
+ * target is built with AddressSanitizer.
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char *buf = (char *) malloc(size > 0 ? size : 1);
+    memcpy(buf, data, size);
+
+    Request req;
+    req.Parse(buf, buf + size);
+
+    free(buf);
+    return 0;
+}
+
+/*
+ * With clang, the target can be built for libFuzzer with
+ * -fsanitize=fuzzer,address -DFUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION,
+ * using the lines of request_corpus.txt as the seed corpus. Otherwise
+ * the following driver mutates the lines of the corpus randomly.
+ */
+#ifndef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+
+static void Usage(const char *app_name) {
+    cerr << "Usage: " << app_name << " [-n iterations] [-s seed] corpus_file" << endl << endl
+         << "Calls the fuzz target of the request parser with random" << endl
+         << "mutations of the requests of the corpus, one per line." << endl;
+}
+
+/**
+ * Characters inserted by the mutations, mostly the ones that are
+ * meaningful for the parser.
+ */
+static const char DICTIONARY[] = "%&=,:[]-<>*PHMmL0123456789 \r\nGET/?jpxlround-updown+";
+
+/**
+ * Standalone driver of the fuzz target, for the compilers without
+ * libFuzzer. Each iteration takes a random request of the corpus,
+ * applies up to 8 random replacements, insertions and deletions of
+ * characters, and sometimes truncates it.
+ */
+int main(int argc, char **argv) {
+    long iterations = 1000000;
+    unsigned seed = 1;
+
+    for (int opt; (opt = getopt(argc, argv, "n:s:h")) != -1;) {
+        switch (opt) {
+            case 'n': iterations = atol(optarg); break;
+            case 's': seed = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (optind != argc - 1 || iterations <= 0) {
+        Usage(argv[0]);
+        return -1;
+    }
+
+    vector<string> corpus;
+    ifstream in(argv[optind]);
+    for (string line; getline(in, line);) corpus.push_back(line);
+
+    if (corpus.empty()) {
+        cerr << "The corpus file '" << argv[optind] << "' can not be read" << endl;
+        return -1;
+    }
+
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    srand(seed);
+    for (size_t i = 0; i < corpus.size(); ++i)
+        LLVMFuzzerTestOneInput((const uint8_t *) corpus[i].data(), corpus[i].size());
+
+    for (long i = 0; i < iterations; ++i) {
+        string s = corpus[rand() % corpus.size()];
+
+        for (int n = 1 + rand() % 8; n > 0 && !s.empty(); --n) {
+            size_t pos = rand() % s.size();
+            switch (rand() % 4) {
+                case 0: s[pos] = DICTIONARY[rand() % (sizeof(DICTIONARY) - 1)]; break;
+                case 1: s.insert(pos, 1, DICTIONARY[rand() % (sizeof(DICTIONARY) - 1)]); break;
+                case 2: s.erase(pos, 1 + rand() % 4); break;
+                case 3: s[pos] = (char) (rand() & 255); break;
+            }
+        }
+
+        if (rand() % 50 == 0) s.resize(rand() % (s.size() + 1));
+        LLVMFuzzerTestOneInput((const uint8_t *) s.data(), s.size());
+    }
+
+    cout << "Inputs: " << corpus.size() + iterations << endl;
+    return 0;
+}
+
+#endif
@@ -20,10 +20,20 @@ private:
     int log_requests_;  ///< <code>true</code> if the client requests are logged
     string address_;            ///< Listening address
     string images_folder_;    ///< Directory for the images
+    string caching_folder_;    ///< Directory for the index files
     string logging_folder_;    ///< Directory for the logging files
     int max_chunk_size_;        ///< Maximum chunk size
+    int gzip_level_;          ///< Compression level of the gzip responses
     int max_connections_;        ///< Maximum number of connections
     int com_time_out_;        ///< Connection time-out
+    int num_threads_;         ///< Number of threads for the connections
+    int num_children_;        ///< Number of child processes
+    int max_rate_;            ///< Maximum output rate of the server (KB/s)
+    int client_rate_;         ///< Maximum output rate of each connection (KB/s)
+    int interactive_weight_;  ///< Weight of the interactive responses
+    int bulk_weight_;         ///< Weight of the bulk responses
+    int index_cache_size_;    ///< Memory for the image indexes (MB)
+    int cache_max_time_;      ///< Expiration time of the sessions (seconds)
 
 public:
     /**
@@ -35,10 +45,20 @@ public:
         address_ = "";
         log_requests_ = 0;
         images_folder_ = "";
+        caching_folder_ = "";
         logging_folder_ = "";
         max_chunk_size_ = 0;
+        gzip_level_ = 6;
         max_connections_ = 0;
         com_time_out_ = -1;
+        num_threads_ = 0;
+        num_children_ = 1;
+        max_rate_ = 0;
+        client_rate_ = 0;
+        interactive_weight_ = 4;
+        bulk_weight_ = 1;
+        index_cache_size_ = 0;
+        cache_max_time_ = 3600;
     }
 
     /**
@@ -53,14 +73,23 @@ public:
         out << "\tListen at: " << cfg.address_ << ":" << cfg.port_ << endl;
         out << "\tFolders:" << endl;
         out << "\t\tImages: " << cfg.images_folder_ << endl;
+        out << "\t\tCaching: " << cfg.caching_folder_ << endl;
         out << "\t\tLogging: " << cfg.logging_folder_ << endl;
         out << "\tConnections: " << endl;
         out << "\t\tMax. number: " << cfg.max_connections_ << endl;
         out << "\t\tMax. time-out: " << cfg.com_time_out() << endl;
+        out << "\t\tThreads: " << cfg.num_threads_ << endl;
+        out << "\t\tChild processes: " << cfg.num_children_ << endl;
+        out << "\t\tMax. rate: " << cfg.max_rate_ << " KB/s" << endl;
+        out << "\t\tClient max. rate: " << cfg.client_rate_ << " KB/s" << endl;
+        out << "\t\tWeights: " << cfg.interactive_weight_ << " (interactive), " << cfg.bulk_weight_ << " (bulk)" << endl;
         out << "\tGeneral:" << endl;
         out << "\t\tLogging: " << (cfg.logging_ == 1 ? "yes" : "no") << endl;
         out << "\t\tLog. requests: " << (cfg.log_requests_ == 1 ? "yes" : "no") << endl;
         out << "\t\tChunk max. size: " << cfg.max_chunk_size_ << endl;
+        out << "\t\tGzip level: " << cfg.gzip_level_ << endl;
+        out << "\t\tIndex cache size: " << cfg.index_cache_size_ << " MB" << endl;
+        out << "\t\tCache max. time: " << cfg.cache_max_time_ << endl;
         return out;
     }
 
@@ -85,6 +114,14 @@ public:
         return images_folder_;
     }
 
+    /**
+     * Returns the folder of the image index files. If it is
+     * empty, the index files are not used.
+     */
+    string caching_folder() const {
+        return caching_folder_;
+    }
+
     /**
      * Returns the folder used for the logging files.
      */
@@ -99,6 +136,14 @@ public:
         return max_chunk_size_;
     }
 
+    /**
+     * Returns the compression level of the gzip responses,
+     * from 0 (no compression) to 9 (best compression).
+     */
+    int gzip_level() const {
+        return gzip_level_;
+    }
+
     /**
      * Returns the maximum number of connections.
      */
@@ -127,6 +172,73 @@ public:
         return com_time_out_;
     }
 
+    /**
+     * Returns the number of threads used to handle the
+     * connections by each child process (0 means the number
+     * of processors divided by the number of child processes).
+     */
+    int num_threads() const {
+        return num_threads_;
+    }
+
+    /**
+     * Returns the number of child processes that handle
+     * the connections.
+     */
+    int num_children() const {
+        return num_children_;
+    }
+
+    /**
+     * Returns the maximum output rate of the server, in
+     * bytes per second (0 means no limit).
+     */
+    uint64_t max_rate() const {
+        return (uint64_t) max_rate_ << 10;
+    }
+
+    /**
+     * Returns the maximum output rate of each connection,
+     * in bytes per second (0 means no limit).
+     */
+    uint64_t client_rate() const {
+        return (uint64_t) client_rate_ << 10;
+    }
+
+    /**
+     * Returns the weight of the interactive responses (for a
+     * single codestream) when the output rate is limited.
+     */
+    int interactive_weight() const {
+        return interactive_weight_;
+    }
+
+    /**
+     * Returns the weight of the bulk responses (for several
+     * codestreams) when the output rate is limited.
+     */
+    int bulk_weight() const {
+        return bulk_weight_;
+    }
+
+    /**
+     * Returns the maximum memory, in bytes, for the image
+     * indexes shared by the client threads of each child
+     * process (0 means no limit).
+     */
+    uint64_t index_cache_size() const {
+        return (uint64_t) index_cache_size_ << 20;
+    }
+
+    /**
+     * Returns the time, in seconds, that the session of a client
+     * is kept after its connection is closed (less than zero
+     * means no expiration).
+     */
+    int cache_max_time() const {
+        return cache_max_time_;
+    }
+
     virtual ~AppConfig() {
     }
 };
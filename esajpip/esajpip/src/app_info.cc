@@ -10,6 +10,7 @@
 #include <sstream>
 #include <fstream>
 #include <fcntl.h>
+#include <cerrno>
 
 #ifndef _SC_AVPHYS_PAGES
 #include <sys/sysctl.h>
@@ -35,7 +36,16 @@ bool AppInfo::Init() {
     if ((lock_file = open(LOCK_FILE, O_WRONLY | O_CREAT, 0666)) != -1) {
         is_running_ = (fcntl(lock_file, F_SETLK, &fl) == -1);
 
-        if ((shmid = shmget(ftok(LOCK_FILE, 'c'), sizeof(Data), IPC_CREAT | 0666)) >= 0) {
+        key_t key = ftok(LOCK_FILE, 'c');
+
+        // A block of a previous version, with a different size,
+        // is removed if the application is not running
+        if ((shmid = shmget(key, sizeof(Data), IPC_CREAT | 0666)) < 0 && errno == EINVAL && !is_running_) {
+            if ((shmid = shmget(key, 0, 0666)) >= 0) shmctl(shmid, IPC_RMID, NULL);
+            shmid = shmget(key, sizeof(Data), IPC_CREAT | 0666);
+        }
+
+        if (shmid >= 0) {
             if ((data_ptr = (Data *) shmat(shmid, NULL, 0)) != (Data *) -1) {
                 if (!is_running_) data_ptr->Reset();
                 res = true;
@@ -97,22 +107,30 @@ AppInfo &AppInfo::Update() {
         double vsize = GetProcStat<double>(data_ptr->father_pid, 22);
         father_memory_ = (vsize / (1024.0 * 1024.0));
 
-        // field 23: rss. Resident Set Size
-        double rss = GetProcStat<double>(data_ptr->child_pid, 23);
-        child_memory_ = rss * 4096.0 / (1024 * 1024);
+        child_memory_ = 0;
+        child_time_ = 0;
+        num_threads_ = 0;
+
+        for (int i = 0; i < data_ptr->num_children; ++i) {
+            int child_pid = data_ptr->children[i].pid;
 
-        // field 13: utime. Amount of time that this process has been scheduled
-        // in user mode, measured in clock ticks (divide by sysconf(_SC_CLK_TCK))
-        unsigned long utime = GetProcStat<unsigned long>(data_ptr->child_pid, 13);
+            // field 23: rss. Resident Set Size
+            double rss = GetProcStat<double>(child_pid, 23);
+            child_memory_ += rss * 4096.0 / (1024 * 1024);
 
-        // field 14: stime. Amount of time that this process has been scheduled
-        // in kernel mode, measured in clock ticks (divide by sysconf(_SC_CLK_TCK))
-        unsigned long stime = GetProcStat<unsigned long>(data_ptr->child_pid, 14);
+            // field 13: utime. Amount of time that this process has been scheduled
+            // in user mode, measured in clock ticks (divide by sysconf(_SC_CLK_TCK))
+            unsigned long utime = GetProcStat<unsigned long>(child_pid, 13);
 
-        child_time_ = utime + stime;
+            // field 14: stime. Amount of time that this process has been scheduled
+            // in kernel mode, measured in clock ticks (divide by sysconf(_SC_CLK_TCK))
+            unsigned long stime = GetProcStat<unsigned long>(child_pid, 14);
 
-        // field 19: stime. Number of threads in this process (since Linux 2.6).
-        num_threads_ = GetProcStat<int>(data_ptr->child_pid, 19);
+            child_time_ += utime + stime;
+
+            // field 19: stime. Number of threads in this process (since Linux 2.6).
+            num_threads_ += GetProcStat<int>(child_pid, 19);
+        }
 #endif
     }
 
@@ -2,8 +2,10 @@
 #define _APP_INFO_H_
 
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <stdint.h>
 
 #ifndef _NO_READPROC
 #include <proc/readproc.h>
@@ -17,37 +19,96 @@ using namespace std;
  */
 class AppInfo {
 private:
+public:
+    enum {
+        MAX_CHILDREN = 64   ///< Maximum number of child processes
+    };
+
+    /**
+     * Contains the information of a child process.
+     */
+    struct Child {
+        int pid;                ///< PID of the child process
+        int num_connections;    ///< Number of open connections
+        int iterations;         ///< Number of times the child has been created
+        uint64_t interactive_bytes; ///< Bytes sent in interactive responses
+        uint64_t bulk_bytes;    ///< Bytes sent in bulk responses
+    };
+
     /**
      * Contains the data block that is maintained in
      * shared memory.
      */
     struct Data {
-        int father_pid;            ///< PID of the father process
-        int child_pid;            ///< PID of the child process
-        int num_connections;    ///< Number of open connections
-        int child_iterations;    ///< Number of iterations done by the child
+        int father_pid;                 ///< PID of the father process
+        int num_children;               ///< Number of child processes
+        Child children[MAX_CHILDREN];   ///< Information of the child processes
 
         /**
          * Clears the values.
          */
         void Reset() {
             father_pid = 0;
-            child_pid = 0;
-            num_connections = 0;
-            child_iterations = 0;
+            num_children = 0;
+            memset(children, 0, sizeof children);
+        }
+
+        /**
+         * Returns the number of open connections of all
+         * the child processes.
+         */
+        int num_connections() const {
+            int num = 0;
+            for (int i = 0; i < num_children; ++i)
+                num += children[i].num_connections;
+            return num;
+        }
+
+        /**
+         * Returns the number of bytes sent in interactive
+         * responses by all the child processes.
+         */
+        uint64_t interactive_bytes() const {
+            uint64_t num = 0;
+            for (int i = 0; i < num_children; ++i)
+                num += children[i].interactive_bytes;
+            return num;
+        }
+
+        /**
+         * Returns the number of bytes sent in bulk
+         * responses by all the child processes.
+         */
+        uint64_t bulk_bytes() const {
+            uint64_t num = 0;
+            for (int i = 0; i < num_children; ++i)
+                num += children[i].bulk_bytes;
+            return num;
+        }
+
+        /**
+         * Returns the number of iterations of all the
+         * child processes.
+         */
+        int child_iterations() const {
+            int num = 0;
+            for (int i = 0; i < num_children; ++i)
+                num += children[i].iterations;
+            return num;
         }
     };
 
+private:
     int shmid;                    ///< Identifier of the shared memory block
     int lock_file;                ///< Lock file
     Data *data_ptr;                ///< Pointer to the shared memory block
     bool is_running_;                ///< <code>true</code> if the application is running
     int num_threads_;                ///< Number of active threads
-    double child_memory_;            ///< Memory used by the child process
+    double child_memory_;            ///< Memory used by the child processes
     unsigned long time_;            ///< Time spent by the father
     double father_memory_;        ///< Memory used by the father process
     double available_memory_;        ///< Available memory in the system
-    unsigned long child_time_;    ///< Time spend by the child
+    unsigned long child_time_;    ///< Time spend by the child processes
 
     /**
      * Returns a specific field of /proc/<pid>/stat as a string.
@@ -105,10 +166,17 @@ public:
 
         if (app.is_running()) {
             out << "Father PID: " << app->father_pid << endl;
-            out << "Child PID: " << app->child_pid << endl;
+            for (int i = 0; i < app->num_children; ++i)
+                out << "Child " << i << " PID: " << app->children[i].pid
+                    << " (" << app->children[i].num_connections << " connections, "
+                    << app->children[i].iterations << " iterations, "
+                    << (app->children[i].interactive_bytes >> 20) << " MB interactive, "
+                    << (app->children[i].bulk_bytes >> 20) << " MB bulk)" << endl;
             out << "Child threads: " << app.num_threads() << endl;
-            out << "Child iterations: " << app->child_iterations << endl;
-            out << "Num. connections: " << app->num_connections << endl;
+            out << "Child iterations: " << app->child_iterations() << endl;
+            out << "Num. connections: " << app->num_connections() << endl;
+            out << "Interactive data sent: " << (app->interactive_bytes() >> 20) << " MB" << endl;
+            out << "Bulk data sent: " << (app->bulk_bytes() >> 20) << " MB" << endl;
             out << "Father used memory: " << setiosflags(ios::fixed) << setprecision(2) << app.father_memory() << " MB"
                 << endl;
             out << "Child used memory: " << setiosflags(ios::fixed) << setprecision(2) << app.child_memory() << " MB"
@@ -140,21 +208,22 @@ public:
     }
 
     /**
-     * Returns the memory used by the child process.
+     * Returns the memory used by the child processes.
      */
     double child_memory() const {
         return child_memory_;
     }
 
     /**
-     * Returns the number of active threads.
+     * Returns the number of active threads of the child
+     * processes.
      */
     int num_threads() const {
         return num_threads_;
     }
 
     /**
-     * Returns the time spent by the child process.
+     * Returns the time spent by the child processes.
      */
     unsigned long child_time() const {
         return child_time_;
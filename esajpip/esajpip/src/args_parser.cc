@@ -9,6 +9,7 @@
 
 #include "trace.h"
 #include "args_parser.h"
+#include "session_store.h"
 
 using namespace std;
 
@@ -25,11 +26,15 @@ bool ArgsParser::Parse(int argc, char **argv) {
             } else if (argc == 2) {
                 kill(app_info->father_pid, SIGKILL);
                 waitpid(app_info->father_pid, NULL, 0);
-                kill(app_info->child_pid, SIGKILL);
-                waitpid(app_info->child_pid, NULL, 0);
+                for (int i = 0; i < app_info->num_children; ++i) {
+                    kill(app_info->children[i].pid, SIGKILL);
+                    waitpid(app_info->children[i].pid, NULL, 0);
+                }
             } else if (argv2 == "child") {
-                kill(app_info->child_pid, SIGKILL);
-                waitpid(app_info->child_pid, NULL, 0);
+                for (int i = 0; i < app_info->num_children; ++i) {
+                    kill(app_info->children[i].pid, SIGKILL);
+                    waitpid(app_info->children[i].pid, NULL, 0);
+                }
             } else {
                 CERR("Invalid command");
             }
@@ -41,21 +46,24 @@ bool ArgsParser::Parse(int argc, char **argv) {
                 stringstream cmd;
 
                 cmd << "echo continue > /tmp/gdb_command;gdb " << argv[0] << " "
-                    << (argv2 == "child" ? app_info->child_pid : app_info->father_pid)
+                    << (argv2 == "child" ? app_info->children[0].pid : app_info->father_pid)
                     << " -x /tmp/gdb_command";
 
                 system(cmd.str().c_str());
             }
         } else if (argv1 == "start") {
             res = true;
+        } else if (argv1 == "clean" && argv2 == "cache") {
+            cout << SessionStore::Clean(cfg) << " expired sessions removed" << endl;
         } else if (argv1 == "status") {
             app_info.Update();
             cout << app_info;
         } else if (argv1 == "record") {
-            static double cpu = 0;
+            static double cpu = 0, inter_rate = 0, bulk_rate = 0;
             unsigned long tm_after, tm_before;
+            uint64_t inter_before, bulk_before;
 
-            cout << "Time\t\t\t Alive?\tFree\tFather\tChild\tConns\tIters\tThreads\t%CPU" << endl;
+            cout << "Time\t\t\t Alive?\tFree\tFather\tChild\tConns\tIters\tThreads\t%CPU\tInter.\tBulk" << endl;
 
             app_info.Update();
 
@@ -64,25 +72,33 @@ bool ArgsParser::Parse(int argc, char **argv) {
             for (;;) {
                 app_info.Update();
                 tm_before = app_info.child_time();
+                inter_before = app_info->interactive_bytes();
+                bulk_before = app_info->bulk_bytes();
 
                 if (!app_info.is_running())
-                    LOG("0" << "\t" << app_info.available_memory() << "\t0\t0\t0\t0\t0\t0");
+                    LOG("0" << "\t" << app_info.available_memory() << "\t0\t0\t0\t0\t0\t0\t0\t0");
                 else
                     LOG("1" << setiosflags(ios::fixed) << "\t"
                             << setprecision(2)
                             << app_info.available_memory() << "\t"
                             << app_info.father_memory() << "\t"
                             << app_info.child_memory() << "\t"
-                            << app_info->num_connections << "\t"
-                            << app_info->child_iterations << "\t"
+                            << app_info->num_connections() << "\t"
+                            << app_info->child_iterations() << "\t"
                             << app_info.num_threads() << "\t"
-                            << setiosflags(ios::fixed) << cpu
+                            << setiosflags(ios::fixed) << cpu << "\t"
+                            << inter_rate << "\t"
+                            << bulk_rate
                     );
 
                 sleep(5);
                 app_info.Update();
                 tm_after = app_info.child_time();
                 cpu = (tm_after - tm_before) / 5.0;
+
+                // Throughput of each traffic class, in KB/s
+                inter_rate = (app_info->interactive_bytes() - inter_before) / 5120.0;
+                bulk_rate = (app_info->bulk_bytes() - bulk_before) / 5120.0;
             }
         } else {
             CERR("Invalid command");
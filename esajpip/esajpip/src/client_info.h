@@ -8,19 +8,16 @@ class ClientInfo {
 private:
     int sock_;            ///< Client socket
     int base_id_;            ///< Base identifier
-    int father_sock_;        ///< Father socket
 
 public:
     /**
      * Initializes the object.
      * @param base_id Base identifier.
      * @param sock Client socket.
-     * @param father_sock Father socket.
      */
-    ClientInfo(int base_id, int sock, int father_sock) {
+    ClientInfo(int base_id, int sock) {
         sock_ = sock;
         base_id_ = base_id;
-        father_sock_ = father_sock;
     }
 
     /**
@@ -36,13 +33,6 @@ public:
     int sock() const {
         return sock_;
     }
-
-    /**
-     * Returns the father socket.
-     */
-    int father_sock() const {
-        return father_sock_;
-    }
 };
 
 #endif /* _CLIENT_INFO_H_ */
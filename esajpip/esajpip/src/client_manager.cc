@@ -1,14 +1,17 @@
 #include "trace.h"
 #include "client_manager.h"
-#include "jpeg2000/file_manager.h"
-#include "jpip/request.h"
-#include "jpip/databin_server.h"
+#include "session_store.h"
 #include "http/response.h"
-#include "net/socket_stream.h"
 
 #include "z/zfilter.h"
-#include <glib.h>
 
+#include <cstdio>
+#include <climits>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 
@@ -24,302 +27,682 @@ using namespace http;
 using namespace jpip;
 using namespace jpeg2000;
 
-static int SendChecked(Socket &socket, const void *buf, size_t len) {
-    const char *data = static_cast<const char *>(buf);
-
-    while (len > 0) {
-        ssize_t sent = socket.Send(data, len);
-        if (sent < 0) {
-            if (errno == EINTR)
-                continue;
+/**
+ * Generates the random component of a channel identifier, as
+ * 64 bits from /dev/urandom in hexadecimal.
+ * @param id Receives the random component.
+ * @return <code>true</code> if successful.
+ */
+static bool GetRandomId(string *id) {
+    uint64_t value = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    bool res = read(fd, &value, sizeof(value)) == (ssize_t) sizeof(value);
+    close(fd);
+
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) value);
+    *id = buf;
+    return res;
+}
 
-            ERROR("Could not send: " << strerror(errno));
-            return -1;
-        }
-        if (sent == 0) {
-            ERROR("Could not send: connection closed");
-            return -1;
+/**
+ * Returns a copy of a request line that can be logged safely, with
+ * the backslashes, the double quotes and the non printable characters
+ * escaped as in a C string.
+ * @param begin Beginning of the line.
+ * @param end End of the line.
+ */
+static string EscapeLine(const char *begin, const char *end) {
+    string res;
+    char buf[5];
+
+    for (const char *p = begin; p < end; ++p) {
+        unsigned char c = *p;
+        switch (c) {
+            case '\\': res += "\\\\"; break;
+            case '"': res += "\\\""; break;
+            case '\b': res += "\\b"; break;
+            case '\f': res += "\\f"; break;
+            case '\n': res += "\\n"; break;
+            case '\r': res += "\\r"; break;
+            case '\t': res += "\\t"; break;
+            case '\v': res += "\\v"; break;
+            default:
+                if (c >= 0x20 && c < 0x7F) res += (char) c;
+                else {
+                    snprintf(buf, sizeof(buf), "\\%03o", c);
+                    res += buf;
+                }
         }
-
-        data += sent;
-        len -= sent;
     }
 
-    return 0;
+    return res;
 }
 
-static int SendString(Socket &socket, const char *str) {
-    return SendChecked(socket, str, strlen(str));
+static string DataHead(bool gzip) {
+    ostringstream head_data;
+    head_data << http::Header::AccessControlAllowOrigin(CORS)
+            << http::Header::StrictTransportSecurity(STS)
+            << http::Header::CacheControl(NOCACHE)
+            << http::Header::TransferEncoding("chunked")
+            << http::Header::ContentType("image/jpp-stream");
+    if (gzip)
+        head_data << http::Header::ContentEncoding("gzip");
+    return head_data.str();
 }
 
-static int SendStream(Socket &socket, const ostringstream &stream) {
-    return SendString(socket, stream.str().c_str());
+/**
+ * Returns the length of the next request of the input (request
+ * line and headers, until the first empty line), or 0 if it has
+ * not been completely received yet.
+ */
+static size_t GetRequestLength(const string &input) {
+    for (size_t pos = input.find('\n'); pos != string::npos; pos = input.find('\n', pos + 1)) {
+        size_t next = pos + 1;
+        if (next < input.size() && input[next] == '\r') next++;
+        if (next < input.size() && input[next] == '\n') return next + 1;
+    }
+    return 0;
 }
 
-static int SendChunk(Socket &socket, const void *buf, size_t len) {
-    if (len > 0) {
-        ostringstream stream;
-        stream << hex << len << dec << http::Protocol::CRLF;
+/**
+ * Returns <code>true</code> if the headers of a request include
+ * the header <code>Accept-Encoding</code> with the value gzip.
+ */
+static bool AcceptsGzip(const char *headers, const char *end) {
+    const char *name = http::HeaderName::ACCEPT_ENCODING;
+    size_t name_len = strlen(name);
+
+    while (headers < end) {
+        const char *line_end = (const char *) memchr(headers, '\n', end - headers);
+        if (line_end == NULL) line_end = end;
 
-        if (SendStream(socket, stream) ||
-            SendChecked(socket, buf, len) ||
-            SendString(socket, http::Protocol::CRLF))
-            return -1;
+        if ((size_t) (line_end - headers) > name_len && headers[name_len] == ':' &&
+            !strncasecmp(headers, name, name_len) &&
+            memmem(headers + name_len, line_end - headers - name_len, "gzip", 4) != NULL)
+            return true;
+
+        headers = line_end + 1;
     }
-    return 0;
+    return false;
+}
+
+/**
+ * Finds the value of a parameter in the query of a request line,
+ * without decoding it.
+ * @param line Beginning of the request line.
+ * @param end End of the request line.
+ * @param name Name of the parameter.
+ * @param value Receives the beginning of the value.
+ * @param value_len Receives the length of the value.
+ * @return <code>true</code> if the parameter was found.
+ */
+static bool FindParameter(const char *line, const char *end, const char *name, const char **value, size_t *value_len) {
+    const char *query = (const char *) memchr(line, '?', end - line);
+    if (query == NULL) return false;
+
+    const char *query_end = (const char *) memchr(query, ' ', end - query);
+    if (query_end == NULL) query_end = end;
+
+    size_t name_len = strlen(name);
+    for (const char *param = query + 1, *param_end; param < query_end; param = param_end + 1) {
+        if ((param_end = (const char *) memchr(param, '&', query_end - param)) == NULL)
+            param_end = query_end;
+
+        if ((size_t) (param_end - param) > name_len && param[name_len] == '=' && !memcmp(param, name, name_len)) {
+            *value = param + name_len + 1;
+            *value_len = param_end - *value;
+            return true;
+        }
+    }
+    return false;
 }
 
 static const int true_val = 1;
 // static const int false_val = 0;
-static const int sndbuf_val = 524288;
 
-void ClientManager::Run(ClientInfo *client_info) {
+bool ClientManager::Init(ClientInfo *client_info) {
+    this->client_info = client_info;
+    socket = client_info->sock();
+    // The channel identifiers are unique between the child processes
+    // and their restarts, so that the sessions can be resumed
+    base_id = to_string(time(NULL)) + "-" + to_string(getpid()) + "-" + to_string(client_info->base_id());
+
+    // The size of the send buffer is adjusted by the kernel, and
+    // the bytes not sent yet are limited to about one chunk, so
+    // that a new response is not delayed by the previous one
     int fd = client_info->sock();
-    int sockopt_ret = setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf_val, sizeof sndbuf_val) |
-                      // setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &false_val, sizeof false_val) |
-                      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &true_val, sizeof true_val);
-    int time_out;
-    if (sockopt_ret == 0 && (time_out = cfg.com_time_out()) > 0) {
-        timeval tv;
-        tv.tv_sec = time_out;
-        tv.tv_usec = 0;
-        sockopt_ret |= setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) |
-                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
-    }
-    if (sockopt_ret != 0) {
+    int sockopt_ret = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &true_val, sizeof true_val);
+    // sockopt_ret |= setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &false_val, sizeof false_val);
+#ifdef TCP_NOTSENT_LOWAT
+    int lowat_val = cfg.max_chunk_size();
+    sockopt_ret |= setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat_val, sizeof lowat_val);
+#endif
+    if (sockopt_ret != 0 || !socket.SetBlockingMode(false)) {
         LOG("setsockopt failed: " << strerror(errno));
-        close(fd);
-        return;
+        return false;
     }
 
-    ///
-
-    bool com_error;
-    string req_line, req_line_raw;
-    jpip::Request req;
-    bool pclose = false;
-    bool is_opened = false;
-    bool send_data = false;
-    DataBinServer data_server;
-
-    FileManager file_manager;
-    if (!file_manager.Init(cfg.images_folder())) {
+    if (!file_manager.Init(cfg.images_folder(), cfg.caching_folder(), &index_manager, &index_writer)) {
         ERROR("The file manager can not be initialized");
-        return;
+        return false;
     }
 
-    ostringstream head_data, head_data_gzip;
-    head_data << http::Header::AccessControlAllowOrigin(CORS)
-            << http::Header::StrictTransportSecurity(STS)
-            << http::Header::CacheControl(NOCACHE)
-            << http::Header::TransferEncoding("chunked")
-            << http::Header::ContentType("image/jpp-stream");
-    head_data_gzip << head_data.str() << http::Header::ContentEncoding("gzip");
+    buf_len = cfg.max_chunk_size();
+    buf = new char[buf_len];
+    last_time = time(NULL);
+    bucket.SetRate(cfg.client_rate(), TokenBucket::Now());
 
-    Socket socket(fd);
-    SocketStream sock_stream(&socket, 1024);
-    string channel = to_string(client_info->base_id());
+    return true;
+}
 
-    int chunk_len = 0;
-    int log_requests = cfg.log_requests();
-    size_t buf_len = cfg.max_chunk_size();
-    char *buf = new char[buf_len];
+void ClientManager::QueueChunk(const vector<iovec> &regions, size_t len) {
+    if (len > 0) {
+        snprintf(chunk_head, sizeof chunk_head, "%zx%s", len, http::Protocol::CRLF);
 
-    while (!pclose) {
-        bool accept_gzip = false;
-        bool send_gzip = false;
+        Queue(chunk_head, strlen(chunk_head));
+        output.insert(output.end(), regions.begin(), regions.end());
+        Queue(http::Protocol::CRLF, strlen(http::Protocol::CRLF));
+    }
+}
 
-        if (log_requests)
-            LOGC(_BLUE, "Waiting for a request ...");
+bool ClientManager::Receive() {
+    char data[4096];
 
-        com_error = true;
-        if (getline(sock_stream, req_line_raw).good()) {
-            char *req_line_escape = g_strescape(req_line_raw.c_str(), NULL);
-            req_line.assign(req_line_escape);
-            g_free(req_line_escape);
+    while (!input_closed) {
+        ssize_t res = socket.Receive(data, sizeof data);
 
-            com_error = !req.Parse(req_line);
-        } else
-            req_line.assign(strerror(errno));
+        if (res > 0) {
+            input.append(data, res);
+            last_time = time(NULL);
 
-        if (com_error) {
-            LOG("Bad request or read error: " << req_line);
+            if (input.size() > MAX_INPUT_SIZE) {
+                LOG("Bad request or read error: request too long");
+                return false;
+            }
+        } else if (res == 0) {
+            input_closed = true;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
             break;
+        } else if (errno != EINTR) {
+            LOG("Bad request or read error: " << strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ClientManager::Flush() {
+    while (output_pos < output.size()) {
+        ssize_t sent = socket.SendRegions(&output[output_pos], min(output.size() - output_pos, (size_t) IOV_MAX));
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+
+            ERROR("Could not send: " << strerror(errno));
+            return false;
+        }
+        if (sent == 0) {
+            ERROR("Could not send: connection closed");
+            return false;
         }
 
-        if (log_requests)
-            LOGC(_BLUE, "Request: " << req_line);
+        last_time = time(NULL);
 
-        http::Header header;
-        while ((sock_stream >> header).good()) {
-            if (header == http::Header::AcceptEncoding() &&
-                header.value.find("gzip") != string::npos)
-                accept_gzip = true;
+        // Skips the regions completely sent and adjusts the
+        // one partially sent, if any
+        for (; output_pos < output.size() && (size_t) sent >= output[output_pos].iov_len; ++output_pos)
+            sent -= output[output_pos].iov_len;
+        if (sent > 0) {
+            output[output_pos].iov_base = (char *) output[output_pos].iov_base + sent;
+            output[output_pos].iov_len -= sent;
         }
-        sock_stream.clear();
+    }
 
-        const char *err_msg = "";
-        pclose = true;
-        send_data = false;
+    output.clear();
+    output_pos = 0;
+    return true;
+}
 
-        if (req.mask.items.metareq && accept_gzip)
-            send_gzip = true;
-
-        if (req.mask.items.cclose) {
-            if (!is_opened) {
-                err_msg = "Close request received but there is not any channel opened";
-                LOG(err_msg);
-                /* Only one channel per client supported */
-            } else if (req.parameters["cclose"] != "*" && req.parameters["cclose"] != channel) {
-                err_msg = "Close request received related to another channel";
-                LOG(err_msg);
-            } else {
-                pclose = false;
-                is_opened = false;
-                req.cache_model.Clear();
-                LOG("The channel " << channel << " has been closed");
+bool ClientManager::ProcessRequest(bool *parsed) {
+    size_t length = GetRequestLength(input);
 
-                ostringstream msg;
-                msg << http::Response(200)
-                        << http::Header::AccessControlAllowOrigin(CORS)
-                        << http::Header::StrictTransportSecurity(STS)
-                        << http::Header::CacheControl(NOCACHE)
-                        << http::Header::ContentLength("0")
-                        << http::Protocol::CRLF;
-                SendStream(socket, msg);
-                break; // break connection
-            }
-        } else if (req.mask.items.cnew) {
-            if (is_opened) {
-                err_msg = "There already is a channel opened. Only one channel per client is supported";
-                LOG(err_msg);
-            } else {
-                string file_name = req.mask.items.target ? req.parameters["target"] : req.object;
+    *parsed = (length > 0);
+    if (!*parsed) {
+        if (input_closed && !input.empty())
+            LOG("Bad request or read error: incomplete request");
+        return true;
+    }
 
-                if (!file_manager.OpenImage(file_name)) {
-                    ERROR("The image file '" << file_name << "' can not be read");
-                } else {
-                    is_opened = true;
-                    data_server.Reset();
-                    if (!data_server.SetRequest(file_manager, req)) {
-                        ERROR("The server can not process the request");
-                    } else {
-                        LOG("The channel " << channel << " has been opened for the image '" << file_name << "'");
-
-                        ostringstream msg;
-                        msg << http::Response(200)
-                                << http::Header("JPIP-cnew", "cid=" + channel + ",path=jpip,transport=http")
-                                << http::Header("JPIP-tid", file_name)
-                                << http::Header::AccessControlExposeHeaders("JPIP-cnew,JPIP-tid")
-                                << (send_gzip ? head_data_gzip.str() : head_data.str())
-                                << http::Protocol::CRLF;
-                        SendStream(socket, msg);
-                        send_data = true;
-                    }
-                }
-            }
-        } else if (req.mask.items.cid) {
-            if (!is_opened) {
-                err_msg = "Request received but no channel is opened";
-                LOG(err_msg);
-            } else {
-                if (req.parameters["cid"] != channel) {
-                    err_msg = "Request related to another channel";
-                    LOG(err_msg);
-                } else if (!data_server.SetRequest(file_manager, req)) {
+    // The request is parsed directly from the input buffer, and
+    // the values needed are copied into the members of req
+    const char *begin = input.data(), *end = begin + length;
+    const char *line_end = (const char *) memchr(begin, '\n', length);
+    const char *line_last = (line_end > begin && line_end[-1] == '\r') ? line_end - 1 : line_end;
+
+    bool com_error = !req.Parse(begin, line_last);
+    bool accept_gzip = AcceptsGzip(line_end + 1, end);
+
+    if (com_error || cfg.log_requests()) {
+        string req_line = EscapeLine(begin, line_last);
+        if (com_error) LOG("Bad request or read error: " << req_line);
+        else LOGC(_BLUE, "Request: " << req_line);
+    }
+
+    input.erase(0, length);
+
+    if (com_error)
+        return false;
+
+    const char *err_msg = "";
+    string random_id;
+    pclose = true;
+    send_data = false;
+    send_gzip = false;
+
+    if (req.mask.items.metareq && accept_gzip)
+        send_gzip = true;
+
+    if (req.mask.items.cclose) {
+        if (channels.empty()) {
+            err_msg = "Close request received but there is not any channel opened";
+            LOG(err_msg);
+        } else if (!CloseChannels(req.cclose)) {
+            err_msg = "Close request received related to another channel";
+            LOG(err_msg);
+        } else {
+            req.cache_model.Clear();
+
+            ostringstream msg;
+            msg << http::Response(200)
+                    << http::Header::AccessControlAllowOrigin(CORS)
+                    << http::Header::StrictTransportSecurity(STS)
+                    << http::Header::CacheControl(NOCACHE)
+                    << http::Header::ContentLength("0")
+                    << http::Protocol::CRLF;
+            head = msg.str();
+            Queue(head.data(), head.size());
+
+            // The connection is broken when its last channel is closed
+            pclose = channels.empty();
+            return true;
+        }
+    } else if (req.mask.items.cnew) {
+        if (channels.size() >= MAX_CHANNELS) {
+            err_msg = "There already are too many channels opened in the connection";
+            LOG(err_msg);
+        } else if (!GetRandomId(&random_id)) {
+            err_msg = "The channel identifier can not be generated";
+            ERROR(err_msg);
+        } else {
+            // The identifiers must not be guessed by other clients,
+            // as they allow to resume the sessions
+            string file_name = req.mask.items.target ? req.target : req.object;
+            Channel *channel = OpenChannel(base_id + "-" + to_string(num_channels++) + "-" + random_id, file_name);
+
+            if (channel != NULL) {
+                current = channel;
+                if (!channel->data_server.SetRequest(file_manager, req)) {
                     ERROR("The server can not process the request");
                 } else {
+                    const string &path_name = channel->image->GetPathName();
+                    LOG("The channel " << channel->id << " has been opened for the image '" << path_name << "'");
+
                     ostringstream msg;
                     msg << http::Response(200)
-                            << (send_gzip ? head_data_gzip.str() : head_data.str())
+                            << http::Header("JPIP-cnew", "cid=" + channel->id + ",path=jpip,transport=http")
+                            << http::Header("JPIP-tid", path_name)
+                            << http::Header::AccessControlExposeHeaders("JPIP-cnew,JPIP-tid")
+                            << DataHead(send_gzip)
                             << http::Protocol::CRLF;
-                    SendStream(socket, msg);
+                    head = msg.str();
+                    Queue(head.data(), head.size());
                     send_data = true;
                 }
             }
-        } else {
-            err_msg = "Invalid request (channel parameter not found)";
-            LOG(err_msg);
         }
+    } else if (req.mask.items.cid) {
+        Channel *channel = FindChannel(req.cid);
 
-        pclose = pclose && !send_data;
+        if (channel == NULL && channels.size() < MAX_CHANNELS)
+            channel = ResumeChannel(req.cid);
 
-        if (pclose) {
-            size_t err_msg_len = strlen(err_msg);
-            ostringstream msg;
-            msg << http::Response(500)
-                    << http::Header::AccessControlAllowOrigin(CORS)
-                    << http::Header::StrictTransportSecurity(STS)
-                    << http::Header::CacheControl(NOCACHE)
-                    << http::Header::ContentLength(to_string(err_msg_len))
-                    << http::Protocol::CRLF;
-            if (err_msg_len)
-                msg << err_msg;
-            SendStream(socket, msg);
-        } else if (send_data) {
-            if (!send_gzip) {
-                for (bool last = false; !last;) {
-                    chunk_len = buf_len;
-
-                    if (!data_server.GenerateChunk(file_manager, buf, &chunk_len, &last)) {
-                        ERROR("A new data chunk could not be generated");
-                        pclose = true;
-                        break;
-                    }
-                    if (chunk_len <= 0 && !last) {
-                        ERROR("No JPIP data chunk was generated before response completion");
-                        pclose = true;
-                        break;
-                    }
-                    if (SendChunk(socket, buf, chunk_len)) {
-                        pclose = true;
-                        break;
-                    }
-                }
+        if (channel == NULL) {
+            err_msg = "Request related to a channel not opened";
+            LOG(err_msg);
+        } else {
+            current = channel;
+            file_manager.SetImage(channel->image);
+
+            if (!channel->data_server.SetRequest(file_manager, req)) {
+                ERROR("The server can not process the request");
             } else {
-                void *obj = zfilter_new();
-
-                for (bool last = false; !last;) {
-                    chunk_len = buf_len;
-
-                    if (!data_server.GenerateChunk(file_manager, buf, &chunk_len, &last)) {
-                        ERROR("A new data chunk could not be generated");
-                        pclose = true;
-                        break;
-                    }
-                    if (chunk_len <= 0 && !last) {
-                        ERROR("No JPIP data chunk was generated before response completion");
-                        pclose = true;
-                        break;
-                    }
-
-                    if (chunk_len > 0)
-                        zfilter_write(obj, buf, chunk_len);
-                }
+                ostringstream msg;
+                msg << http::Response(200)
+                        << DataHead(send_gzip)
+                        << http::Protocol::CRLF;
+                head = msg.str();
+                Queue(head.data(), head.size());
+                send_data = true;
+            }
+        }
+    } else {
+        err_msg = "Invalid request (channel parameter not found)";
+        LOG(err_msg);
+    }
+
+    pclose = pclose && !send_data;
+
+    if (pclose) {
+        size_t err_msg_len = strlen(err_msg);
+        ostringstream msg;
+        msg << http::Response(500)
+                << http::Header::AccessControlAllowOrigin(CORS)
+                << http::Header::StrictTransportSecurity(STS)
+                << http::Header::CacheControl(NOCACHE)
+                << http::Header::ContentLength(to_string(err_msg_len))
+                << http::Protocol::CRLF;
+        if (err_msg_len)
+            msg << err_msg;
+        head = msg.str();
+        Queue(head.data(), head.size());
+    } else if (send_gzip) {
+        if ((zobj = zfilter_new(cfg.gzip_level())) == NULL) {
+            ERROR("The compression filter can not be created");
+            return false;
+        }
 
-                size_t nbytes;
-                const uint8_t *out = (uint8_t *) zfilter_bytes(obj, &nbytes);
+        if (!QueueMetadata())
+            return false;
+    }
 
-                while (nbytes > buf_len) {
-                    if (SendChunk(socket, out, buf_len)) {
-                        pclose = true;
-                        goto zend;
-                    }
-                    nbytes -= buf_len;
-                    out += buf_len;
-                }
-                if (nbytes > 0 && SendChunk(socket, out, nbytes))
-                    pclose = true;
+    return true;
+}
+
+ClientManager::Channel *ClientManager::FindChannel(const string &cid) {
+    for (list<Channel>::iterator i = channels.begin(); i != channels.end(); ++i)
+        if (i->id == cid)
+            return &(*i);
+    return NULL;
+}
+
+ClientManager::Channel *ClientManager::OpenChannel(const string &cid, const string &file_name) {
+    // The name is stored as requested, before the file
+    // manager completes it with the images folder
+    string path_name = file_name;
+
+    if (!file_manager.OpenImage(path_name)) {
+        ERROR("The image file '" << file_name << "' can not be read");
+        return NULL;
+    }
+
+    channels.emplace_back();
+    Channel &channel = channels.back();
+    channel.id = cid;
+    channel.target = file_name;
+    channel.image = file_manager.GetImage();
+    channel.data_server.SetPlanCache(&plan_cache);
+    return &channel;
+}
+
+bool ClientManager::CloseChannels(const string &cclose) {
+    vector<string> ids;
+
+    if (cclose != "*") {
+        for (size_t pos = 0, next; pos <= cclose.size(); pos = next + 1) {
+            if ((next = cclose.find(',', pos)) == string::npos) next = cclose.size();
+            ids.push_back(cclose.substr(pos, next - pos));
+            if (FindChannel(ids.back()) == NULL) return false;
+        }
+    }
+
+    for (list<Channel>::iterator i = channels.begin(); i != channels.end();) {
+        if (cclose != "*" && find(ids.begin(), ids.end(), i->id) == ids.end()) ++i;
+        else {
+            SessionStore::Remove(cfg, i->id);
+            LOG("The channel " << i->id << " has been closed");
+
+            if (current == &(*i)) current = NULL;
+            i = channels.erase(i);
+        }
+    }
+
+    return true;
+}
+
+ClientManager::Channel *ClientManager::ResumeChannel(const string &cid) {
+    string file_name;
+    CacheModel cache_model;
+
+    if (!SessionStore::Load(cfg, cid, &file_name, &cache_model))
+        return NULL;
+
+    if (req.mask.items.target && req.target != file_name) {
+        LOG("The channel " << cid << " can not be resumed for another image");
+        return NULL;
+    }
+
+    Channel *channel = OpenChannel(cid, file_name);
+    if (channel == NULL)
+        return NULL;
+
+    channel->data_server.SetCacheModel(cache_model);
+    LOG("The channel " << cid << " has been resumed for the image '" << file_name << "'");
+
+    return channel;
+}
+
+bool ClientManager::QueueMetadata() {
+    vector<char> meta_buf;
+
+    if (!current->data_server.HasMetadataAtOnce(file_manager))
+        return true;
+
+    size_t length;
+    unsigned long crc;
+    const ImageIndex::Ptr image = file_manager.GetImage();
 
-            zend:
-                zfilter_del(obj);
+    if ((zmeta = metadata_cache.Get(image, &crc, &length)) != NULL) {
+        // The compressed data ends with a sync flush, so a new
+        // stream can continue it
+        current->data_server.SetMetadataSent(file_manager, length);
+        zfilter_resume(zobj, crc, length);
+    } else {
+        if (!current->data_server.GenerateMetadata(file_manager, &meta_buf, &chunk))
+            return true;
+
+        crc = MetadataCache::GetCRC(chunk, &length);
+
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            if (!zfilter_write(zobj, chunk[i].iov_base, chunk[i].iov_len)) {
+                ERROR("The meta-data could not be compressed");
+                return false;
             }
+        }
+
+        size_t zlen;
+        const char *zdata = (const char *) zfilter_flush(zobj, 0, &zlen);
+        if (zdata == NULL) {
+            ERROR("The meta-data could not be compressed");
+            return false;
+        }
+
+        zmeta = make_shared<const string>(zdata, zlen);
+        metadata_cache.Add(image, crc, length, zmeta);
+    }
+
+    chunk.assign(1, iovec());
+    chunk[0].iov_base = (void *) zmeta->data();
+    chunk[0].iov_len = zmeta->size();
+    QueueChunk(chunk, zmeta->size());
+
+    return true;
+}
 
-            if (pclose || SendString(socket, ZERO))
-                break;
+bool ClientManager::IsPreempted() const {
+    size_t length = GetRequestLength(input);
+    if (length == 0 || current == NULL)
+        return false;
+
+    const char *line = input.data(), *value;
+    const char *line_end = (const char *) memchr(line, '\n', length);
+    size_t value_len;
+
+    if (FindParameter(line, line_end, "wait", &value, &value_len) && value_len == 3 && !memcmp(value, "yes", 3))
+        return false;
+    else if (FindParameter(line, line_end, "cclose", &value, &value_len)) {
+        if (value_len == 1 && *value == '*')
+            return true;
+
+        // The identifiers are compared as CloseChannels does
+        for (const char *id = value, *value_end = value + value_len, *next; id <= value_end; id = next + 1) {
+            if ((next = (const char *) memchr(id, ',', value_end - id)) == NULL) next = value_end;
+            if ((size_t) (next - id) == current->id.size() && !memcmp(id, current->id.data(), next - id))
+                return true;
         }
+        return false;
+    } else if (FindParameter(line, line_end, "cid", &value, &value_len))
+        return value_len == current->id.size() && !memcmp(value, current->id.data(), value_len);
+    else
+        return false;
+}
+
+int ClientManager::GetDelay() {
+    traffic_class = (current->data_server.GetNumCodestreams() > 1 ? EgressScheduler::BULK : EgressScheduler::INTERACTIVE);
+
+    int delay = bucket.GetDelay(TokenBucket::Now());
+    if (delay == 0)
+        delay = scheduler.GetDelay(traffic_class);
+
+    // The connection is handled again at least every
+    // second, so that it is not closed as inactive
+    return min(delay, (int) MAX_DELAY);
+}
+
+int ClientManager::GetChunkSize() {
+    int queued, window;
+    if (!socket.GetSendState(&queued, &window))
+        return buf_len;
+
+    // The chunk fills the send queue up to two congestion windows,
+    // one being sent and one ready to be sent, so the data is not
+    // generated long before it can be sent
+    return min((int) buf_len, max(2 * window - queued, (int) MIN_CHUNK_SIZE));
+}
+
+bool ClientManager::GenerateChunk() {
+    bool last = false;
+    int chunk_len = GetChunkSize();
+
+    // The response is ended at a message boundary when the client
+    // sends a new request for the channel, so that it is served
+    // without waiting for the rest of the previous one
+    if (IsPreempted()) {
+        TRACE("The response of the channel " << current->id << " has been preempted by a new request");
+        current->data_server.Preempt();
+    }
+
+    if (!current->data_server.GenerateChunk(file_manager, buf, &chunk_len, &chunk, &last)) {
+        ERROR("A new data chunk could not be generated");
+        return false;
+    }
+    if (chunk_len <= 0 && !last) {
+        ERROR("No JPIP data chunk was generated before response completion");
+        return false;
     }
 
+    if (!send_gzip) QueueChunk(chunk, chunk_len);
+    else {
+        // Each chunk is compressed and flushed, so that the client
+        // can decompress the data received until now
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            if (!zfilter_write(zobj, chunk[i].iov_base, chunk[i].iov_len)) {
+                ERROR("The data chunk could not be compressed");
+                return false;
+            }
+        }
+
+        size_t zlen;
+        const void *zdata = zfilter_flush(zobj, last, &zlen);
+        if (zdata == NULL) {
+            ERROR("The data chunk could not be compressed");
+            return false;
+        }
+
+        chunk.assign(1, iovec());
+        chunk[0].iov_base = (void *) zdata;
+        chunk[0].iov_len = zlen;
+        QueueChunk(chunk, zlen);
+        chunk_len = (int) zlen;
+    }
+
+    if (chunk_len > 0) {
+        bucket.Consume(chunk_len, TokenBucket::Now());
+        scheduler.Consume(traffic_class, chunk_len);
+    }
+
+    if (last) {
+        Queue(ZERO, strlen(ZERO));
+        send_data = false;
+    }
+
+    return true;
+}
+
+int ClientManager::Process(int *delay) {
+    *delay = 0;
+    if (!Receive())
+        return 0;
+
+    for (int num_chunks = 0;;) {
+        if (!Flush())
+            return 0;
+        if (!output.empty())
+            return EPOLLOUT;
+
+        if (zobj != NULL && !send_data) {
+            zfilter_del(zobj);
+            zobj = NULL;
+            zmeta.reset();
+        }
+
+        if (send_data) {
+            // The socket is released after some chunks, so
+            // that the other connections are not delayed
+            if (num_chunks++ >= MAX_CHUNKS_PER_EVENT)
+                return EPOLLOUT;
+            if ((*delay = GetDelay()) > 0) {
+                last_time = time(NULL);
+                return EPOLLOUT;
+            }
+            if (!GenerateChunk())
+                return 0;
+        } else if (pclose) {
+            return 0;
+        } else {
+            bool parsed;
+            if (!ProcessRequest(&parsed))
+                return 0;
+            if (!parsed) {
+                if (input_closed) return 0;
+                else return EPOLLIN;
+            }
+        }
+    }
+}
+
+ClientManager::~ClientManager() {
+    for (list<Channel>::iterator i = channels.begin(); i != channels.end(); ++i)
+        SessionStore::Save(cfg, i->id, i->target, i->data_server.GetCacheModel());
+
+    if (zobj != NULL)
+        zfilter_del(zobj);
     delete[] buf;
 
     socket.Close(); // closes fd
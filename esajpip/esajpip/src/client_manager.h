@@ -1,18 +1,207 @@
 #ifndef _CLIENT_MANAGER_H_
 #define _CLIENT_MANAGER_H_
 
+#include <ctime>
+#include <list>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
 #include "app_info.h"
 #include "app_config.h"
 #include "client_info.h"
+#include "metadata_cache.h"
+#include "egress_scheduler.h"
+#include "net/socket.h"
+#include "jpip/request.h"
+#include "jpip/databin_server.h"
+#include "jpeg2000/file_manager.h"
+#include "jpeg2000/index_manager.h"
+#include "jpeg2000/index_writer.h"
 
 /**
- * Handles a client connection with a dedicated
- * thread.
+ * Handles a client connection. The socket of the connection
+ * is non-blocking, and the object keeps the state of the
+ * connection (the bytes received but not yet parsed, and the
+ * response being sent) between calls, so that a thread is
+ * only needed when the socket is ready. Several JPIP channels
+ * can be opened in the same connection.
+ *
+ * @see ClientPool
  */
 class ClientManager {
 private:
     AppConfig &cfg;                ///< Application configuration
     AppInfo &app_info;            ///< Application run-time information
+    jpeg2000::IndexManager &index_manager;    ///< Index manager
+    jpeg2000::IndexWriter &index_writer;      ///< Writer of the index files
+    MetadataCache &metadata_cache;  ///< Cache of the compressed meta-data
+    jpip::PlanCache &plan_cache;    ///< Cache of the response plans
+    EgressScheduler &scheduler;     ///< Scheduler of the data sent
+
+    enum {
+        MAX_INPUT_SIZE = 1048576,   ///< Maximum size of the input not parsed
+        MAX_CHUNKS_PER_EVENT = 16,  ///< Maximum chunks sent per call of <code>Process</code>
+        MAX_CHANNELS = 32,          ///< Maximum channels opened in a connection
+        MAX_DELAY = 1000,           ///< Maximum delay, in milliseconds, due to the rate limits
+        MIN_CHUNK_SIZE = 4096       ///< Minimum size of the chunks
+    };
+
+    /**
+     * JPIP channel opened in the connection. Each channel has
+     * its own image and cache model, and the rest of the
+     * resources of the connection are shared.
+     */
+    struct Channel {
+        string id;                          ///< Channel identifier
+        string target;                      ///< Image of the channel, as requested
+        jpeg2000::ImageIndex::Ptr image;    ///< Index of the image
+        jpip::DataBinServer data_server;    ///< Data-bin server of the channel
+    };
+
+    ClientInfo *client_info;        ///< Client information
+    net::Socket socket;             ///< Client socket
+    string base_id;                 ///< Base of the channel identifiers
+    int num_channels;               ///< Number of channels created
+
+    jpip::Request req;              ///< Last request received
+    list<Channel> channels;         ///< Opened channels
+    Channel *current;               ///< Channel of the last request
+    jpeg2000::FileManager file_manager; ///< File manager of the connection
+    bool send_data;                 ///< <code>true</code> if the response data is being sent
+    bool send_gzip;                 ///< <code>true</code> if the response data is compressed
+    bool pclose;                    ///< <code>true</code> if the connection must be closed
+    bool input_closed;              ///< <code>true</code> if the client closed its side
+    time_t last_time;               ///< Time of the last activity
+    TokenBucket bucket;             ///< Rate limit of the connection
+    EgressScheduler::TrafficClass traffic_class;  ///< Traffic class of the response being sent
+
+    string input;                   ///< Bytes received not yet parsed
+    string head;                    ///< Head of the response being sent
+    char *buf;                      ///< Buffer for the chunks
+    size_t buf_len;                 ///< Length of the buffer
+    vector<iovec> chunk;            ///< Memory regions of the last chunk
+    char chunk_head[32];            ///< Length line of the last chunk
+    vector<iovec> output;           ///< Memory regions pending to be sent
+    size_t output_pos;              ///< First region of <code>output</code> not sent
+
+    void *zobj;                     ///< Compression filter of the response
+    MetadataCache::Ptr zmeta;       ///< Compressed meta-data being sent
+
+    /**
+     * Adds a memory region to the output.
+     * @param data Pointer to the data.
+     * @param len Length of the data.
+     */
+    void Queue(const void *data, size_t len) {
+        if (len > 0) {
+            iovec region;
+            region.iov_base = (void *) data;
+            region.iov_len = len;
+            output.push_back(region);
+        }
+    }
+
+    /**
+     * Adds a HTTP chunk to the output, framing included.
+     * @param regions Memory regions of the chunk.
+     * @param len Length of the chunk.
+     */
+    void QueueChunk(const vector<iovec> &regions, size_t len);
+
+    /**
+     * Reads all the bytes available in the socket.
+     * @return <code>false</code> if there was an error.
+     */
+    bool Receive();
+
+    /**
+     * Sends the pending output, until the socket is full.
+     * @return <code>false</code> if there was an error.
+     */
+    bool Flush();
+
+    /**
+     * Parses and processes the next request of the input, if
+     * it has been completely received, queueing the head of
+     * the response.
+     * @param parsed Set to <code>true</code> if a request
+     * was parsed.
+     * @return <code>false</code> if the request is not valid.
+     */
+    bool ProcessRequest(bool *parsed);
+
+    /**
+     * Returns <code>true</code> if the response being sent must be
+     * ended because the next request of the input, completely
+     * received, is related to the same channel, and it does not
+     * contain the parameter <code>wait=yes</code>.
+     */
+    bool IsPreempted() const;
+
+    /**
+     * Returns the time, in milliseconds, to wait before
+     * generating the next chunk of the response data, due
+     * to the rate limits, or 0 if it can be generated now.
+     */
+    int GetDelay();
+
+    /**
+     * Returns the size of the next chunk of the response data,
+     * according to the state of the connection, so that the
+     * slow connections receive smaller chunks. It is not
+     * greater than the configured maximum chunk size.
+     */
+    int GetChunkSize();
+
+    /**
+     * Generates the next chunk of the response data and
+     * adds it to the output.
+     * @return <code>false</code> if there was an error.
+     */
+    bool GenerateChunk();
+
+    /**
+     * Adds to the output the compressed meta-data of the image,
+     * when it is sent at the beginning of a gzip response. The
+     * compressed data is taken from the cache if possible.
+     * @return <code>false</code> if there was an error.
+     */
+    bool QueueMetadata();
+
+    /**
+     * Returns the opened channel with the given identifier,
+     * or <code>NULL</code> if it does not exist.
+     * @param cid Channel identifier.
+     */
+    Channel *FindChannel(const string &cid);
+
+    /**
+     * Opens a new channel for an image.
+     * @param cid Channel identifier.
+     * @param file_name Image file name, as requested.
+     * @return The new channel, or <code>NULL</code> if the
+     * image can not be opened.
+     */
+    Channel *OpenChannel(const string &cid, const string &file_name);
+
+    /**
+     * Closes the channels given by the parameter <code>cclose</code>
+     * of a request (a list of identifiers, or <code>*</code> for all
+     * of them), removing their stored sessions. No channel is
+     * closed if any of them is not opened.
+     * @param cclose Value of the parameter.
+     * @return <code>true</code> if successful.
+     */
+    bool CloseChannels(const string &cclose);
+
+    /**
+     * Resumes a channel of a previous connection, whose session
+     * was stored when the connection was closed.
+     * @param cid Channel identifier.
+     * @return The channel, or <code>NULL</code> if it can not
+     * be resumed.
+     */
+    Channel *ResumeChannel(const string &cid);
 
 public:
     /**
@@ -20,21 +209,76 @@ public:
      * @param _cfg Application configuration.
      * @param _app_info Application run-time information.
      * @param _index_manager Index manager.
+     * @param _index_writer Writer of the index files.
+     * @param _metadata_cache Cache of the compressed meta-data.
+     * @param _plan_cache Cache of the response plans.
+     * @param _scheduler Scheduler of the data sent.
      */
     ClientManager(
             AppConfig &_cfg,
-            AppInfo &_app_info)
-            : cfg(_cfg), app_info(_app_info) {
+            AppInfo &_app_info,
+            jpeg2000::IndexManager &_index_manager,
+            jpeg2000::IndexWriter &_index_writer,
+            MetadataCache &_metadata_cache,
+            jpip::PlanCache &_plan_cache,
+            EgressScheduler &_scheduler)
+            : cfg(_cfg), app_info(_app_info), index_manager(_index_manager),
+              index_writer(_index_writer), metadata_cache(_metadata_cache), plan_cache(_plan_cache), scheduler(_scheduler) {
+        client_info = NULL;
+        num_channels = 0;
+        current = NULL;
+        send_data = false;
+        send_gzip = false;
+        pclose = false;
+        input_closed = false;
+        last_time = time(NULL);
+        traffic_class = EgressScheduler::INTERACTIVE;
+        buf = NULL;
+        buf_len = 0;
+        output_pos = 0;
+        zobj = NULL;
     }
 
     /**
-     * Starts the handling of a client connection.
+     * Starts the handling of a client connection, configuring
+     * its socket as non-blocking.
      * @param client_info Client information.
+     * @return <code>true</code> if successful.
+     */
+    bool Init(ClientInfo *client_info);
+
+    /**
+     * Handles the connection when its socket is ready:
+     * receives the requests and sends the responses, until
+     * the socket would block, or the rate limits are reached.
+     * @param delay Receives the time, in milliseconds, to wait
+     * before handling the connection again, or 0 if it must be
+     * handled as soon as the socket is ready.
+     * @return The <code>epoll</code> events to wait for
+     * (<code>EPOLLIN</code> or <code>EPOLLOUT</code>), or 0 if
+     * the connection must be closed.
      */
-    void Run(ClientInfo *client_info);
+    int Process(int *delay);
 
-    virtual ~ClientManager() {
+    /**
+     * Returns the time of the last activity of the connection.
+     */
+    time_t GetLastTime() const {
+        return last_time;
     }
+
+    /**
+     * Returns the client information.
+     */
+    ClientInfo *GetClientInfo() const {
+        return client_info;
+    }
+
+    /**
+     * Stores the sessions of the opened channels, and closes
+     * the socket of the connection.
+     */
+    virtual ~ClientManager();
 };
 
 #endif /* _CLIENT_MANAGER_H_ */
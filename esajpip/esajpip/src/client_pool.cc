@@ -0,0 +1,190 @@
+#include <sys/epoll.h>
+#include "trace.h"
+#include "client_pool.h"
+
+using namespace std;
+
+bool ClientPool::Init(int num_threads) {
+    scheduler.Init(cfg, app_info->num_children);
+
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        ERROR("The epoll instance can not be created: " << strerror(errno));
+        return false;
+    }
+
+    if (!cfg.caching_folder().empty() && !index_writer.Init(&index_manager))
+        return false;
+
+    threads.resize(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+        if (pthread_create(&threads[i], NULL, ThreadFunction, this) != 0) {
+            ERROR("The client threads can not be created");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ClientPool::Add(ClientInfo *client_info) {
+    ClientManager *manager = new ClientManager(cfg, app_info, index_manager, index_writer, metadata_cache, plan_cache, scheduler);
+
+    if (!manager->Init(client_info)) {
+        Close(manager);
+        return false;
+    }
+
+    mutex.Wait();
+    uint64_t id = next_id++;
+
+    // The identifier is used instead of a pointer, so that the
+    // events of the connections already closed are discarded
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.u64 = id;
+
+    bool res = (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_info->sock(), &event) != -1);
+    if (res) {
+        Client &client = clients[id];
+        client.manager = manager;
+        client.busy = false;
+    }
+    mutex.Release();
+
+    if (!res) {
+        ERROR("The connection [" << client_info->sock() << "] can not be polled: " << strerror(errno));
+        Close(manager);
+        return false;
+    }
+
+    return true;
+}
+
+void ClientPool::Close(ClientManager *manager) {
+    ClientInfo *client_info = manager->GetClientInfo();
+
+    LOG("Closing the connection [" << client_info->sock() << "]");
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_info->sock(), NULL);
+    delete manager;
+    delete client_info;
+}
+
+void ClientPool::CloseInactive() {
+    int time_out = cfg.com_time_out();
+    if (time_out <= 0)
+        return;
+
+    vector<ClientManager *> inactive;
+    time_t now = time(NULL);
+
+    mutex.Wait();
+    for (map<uint64_t, Client>::iterator i = clients.begin(); i != clients.end();) {
+        if (!i->second.busy && (now - i->second.manager->GetLastTime()) > time_out) {
+            inactive.push_back(i->second.manager);
+            clients.erase(i++);
+        } else ++i;
+    }
+    mutex.Release();
+
+    for (size_t i = 0; i < inactive.size(); ++i) {
+        LOG("Closing the inactive connection [" << inactive[i]->GetClientInfo()->sock() << "]");
+        Close(inactive[i]);
+    }
+}
+
+int ClientPool::WakeDelayed() {
+    vector<ClientManager *> failed;
+    uint64_t now = TokenBucket::Now();
+    int time_out = -1;
+
+    mutex.Wait();
+    while (!delayed.empty()) {
+        multimap<uint64_t, uint64_t>::iterator first = delayed.begin();
+        if (first->first > now) {
+            time_out = (int) ((first->first - now + 999) / 1000);
+            break;
+        }
+
+        // The connection may have been closed as inactive meanwhile
+        map<uint64_t, Client>::iterator client = clients.find(first->second);
+        if (client != clients.end() && !client->second.busy) {
+            epoll_event event;
+            event.events = EPOLLOUT | EPOLLONESHOT;
+            event.data.u64 = first->second;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->second.manager->GetClientInfo()->sock(), &event) == -1) {
+                ERROR("The connection [" << client->second.manager->GetClientInfo()->sock() << "] can not be polled: " << strerror(errno));
+                failed.push_back(client->second.manager);
+                clients.erase(client);
+            }
+        }
+        delayed.erase(first);
+    }
+    mutex.Release();
+
+    for (size_t i = 0; i < failed.size(); ++i)
+        Close(failed[i]);
+
+    return time_out;
+}
+
+void *ClientPool::ThreadFunction(void *arg) {
+    ((ClientPool *) arg)->Run();
+    return NULL;
+}
+
+void ClientPool::Run() {
+    for (;;) {
+        // While there are delayed connections, the threads wait with
+        // a time-out, so that they are registered again on time
+        epoll_event event;
+        int res = epoll_wait(epoll_fd, &event, 1, WakeDelayed());
+
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+
+            ERROR("Error waiting for the connections: " << strerror(errno));
+            break;
+        }
+        if (res == 0)
+            continue;
+
+        uint64_t id = event.data.u64;
+
+        mutex.Wait();
+        map<uint64_t, Client>::iterator client = clients.find(id);
+        if (client == clients.end() || client->second.busy) {
+            mutex.Release();
+            continue;
+        }
+        client->second.busy = true;
+        ClientManager *manager = client->second.manager;
+        mutex.Release();
+
+        int delay;
+        int events = manager->Process(&delay);
+
+        mutex.Wait();
+        if (events == 0) clients.erase(client);
+        else if (delay > 0) {
+            client->second.busy = false;
+            delayed.insert(make_pair(TokenBucket::Now() + (uint64_t) delay * 1000, id));
+        } else {
+            client->second.busy = false;
+
+            // The connection is registered again with the mutex held,
+            // so that it can not be closed meanwhile as inactive
+            event.events = events | EPOLLONESHOT;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, manager->GetClientInfo()->sock(), &event) == -1) {
+                ERROR("The connection [" << manager->GetClientInfo()->sock() << "] can not be polled: " << strerror(errno));
+                clients.erase(client);
+                events = 0;
+            }
+        }
+        mutex.Release();
+
+        if (events == 0)
+            Close(manager);
+    }
+}
@@ -0,0 +1,138 @@
+#ifndef _CLIENT_POOL_H_
+#define _CLIENT_POOL_H_
+
+#include <map>
+#include <vector>
+#include <pthread.h>
+#include "app_info.h"
+#include "app_config.h"
+#include "client_info.h"
+#include "client_manager.h"
+#include "metadata_cache.h"
+#include "egress_scheduler.h"
+#include "ipc/mutex.h"
+#include "jpeg2000/index_manager.h"
+#include "jpeg2000/index_writer.h"
+
+/**
+ * Handles the client connections of the child process with
+ * a fixed pool of threads. The sockets of the connections are
+ * registered in an <code>epoll</code> instance in one-shot
+ * mode, so that each ready connection is processed by only
+ * one thread of the pool, which registers it again when the
+ * socket would block. The connections delayed by the rate
+ * limits are registered again when their delay expires.
+ *
+ * @see ClientManager
+ */
+class ClientPool {
+private:
+    /**
+     * Connection registered in the pool.
+     */
+    struct Client {
+        ClientManager *manager; ///< Client manager of the connection
+        bool busy;              ///< <code>true</code> if a thread is processing it
+    };
+
+    AppConfig &cfg;             ///< Application configuration
+    AppInfo &app_info;          ///< Application run-time information
+    jpeg2000::IndexManager &index_manager;  ///< Index manager
+    jpeg2000::IndexWriter index_writer;     ///< Writer of the index files
+    MetadataCache metadata_cache;   ///< Cache of the compressed meta-data
+    jpip::PlanCache plan_cache;     ///< Cache of the response plans
+    EgressScheduler scheduler;      ///< Scheduler of the data sent
+
+    int epoll_fd;               ///< Descriptor of the epoll instance
+    uint64_t next_id;           ///< Identifier of the next connection
+    ipc::Mutex mutex;           ///< Mutex for the connections map
+    map<uint64_t, Client> clients;  ///< Connections, by identifier
+    multimap<uint64_t, uint64_t> delayed;   ///< Identifiers of the delayed connections, by time
+    vector<pthread_t> threads;  ///< Threads of the pool
+
+    /**
+     * Main function of the threads of the pool.
+     */
+    static void *ThreadFunction(void *arg);
+
+    /**
+     * Waits for ready connections and processes them.
+     */
+    void Run();
+
+    /**
+     * Registers again the delayed connections whose delay
+     * has expired.
+     * @return The time, in milliseconds, until the next
+     * delay expires, or -1 if there are no delayed connections.
+     */
+    int WakeDelayed();
+
+    /**
+     * Closes a connection already removed from the map.
+     * @param manager Client manager of the connection.
+     */
+    void Close(ClientManager *manager);
+
+public:
+    /**
+     * Initializes the object.
+     * @param _cfg Application configuration.
+     * @param _app_info Application run-time information.
+     * @param _index_manager Index manager.
+     */
+    ClientPool(
+            AppConfig &_cfg,
+            AppInfo &_app_info,
+            jpeg2000::IndexManager &_index_manager)
+            : cfg(_cfg), app_info(_app_info), index_manager(_index_manager) {
+        epoll_fd = -1;
+        next_id = 0;
+    }
+
+    /**
+     * Creates the epoll instance, the threads of the pool and
+     * the thread that writes the index files.
+     * @param num_threads Number of threads.
+     * @return <code>true</code> if successful.
+     */
+    bool Init(int num_threads);
+
+    /**
+     * Adds a new connection to the pool. The pool releases
+     * the client information when the connection is closed.
+     * @param client_info Client information.
+     * @return <code>true</code> if successful. Otherwise the
+     * connection is closed.
+     */
+    bool Add(ClientInfo *client_info);
+
+    /**
+     * Closes the connections that have been inactive for
+     * more time than the configured time-out.
+     */
+    void CloseInactive();
+
+    /**
+     * Returns the number of bytes sent by a traffic class.
+     * @param tc Traffic class.
+     */
+    uint64_t GetBytesSent(EgressScheduler::TrafficClass tc) {
+        return scheduler.GetBytesSent(tc);
+    }
+
+    /**
+     * Returns the number of open connections.
+     */
+    int GetNumConnections() {
+        mutex.Wait();
+        int num = clients.size();
+        mutex.Release();
+        return num;
+    }
+
+    virtual ~ClientPool() {
+    }
+};
+
+#endif /* _CLIENT_POOL_H_ */
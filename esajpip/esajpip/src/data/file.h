@@ -90,6 +90,21 @@ namespace data {
             return size;
         }
 
+        /**
+         * Returns a pointer to the mapped content of the file,
+         * which remains valid until the file is closed.
+         * @param _offset Offset of the content.
+         * @param length Length of the content.
+         * @return <code>NULL</code> if the content is out of
+         * the file.
+         */
+        const char *GetData(uint64_t _offset, uint64_t length) const {
+            assert(address != MAP_FAILED);
+            if (_offset > size || length > size - _offset)
+                return NULL;
+            return address + _offset;
+        }
+
         /**
          * Reads a value from the file.
          * @param value Pointer to the value where to store.
@@ -0,0 +1,49 @@
+#include <algorithm>
+#include "egress_scheduler.h"
+
+using namespace std;
+
+void EgressScheduler::Init(const AppConfig &cfg, int num_children) {
+    max_rate = (double) cfg.max_rate() / (num_children > 0 ? num_children : 1);
+
+    classes[INTERACTIVE].weight = max(1, cfg.interactive_weight());
+    classes[BULK].weight = max(1, cfg.bulk_weight());
+}
+
+void EgressScheduler::UpdateRates(TrafficClass tc, uint64_t now) {
+    classes[tc].last_time = now;
+
+    int total_weight = 0;
+    for (int i = 0; i < NUM_CLASSES; ++i) {
+        if (now - classes[i].last_time < ACTIVE_TIME)
+            total_weight += classes[i].weight;
+    }
+
+    for (int i = 0; i < NUM_CLASSES; ++i) {
+        if (now - classes[i].last_time < ACTIVE_TIME)
+            classes[i].bucket.SetRate(max_rate * classes[i].weight / total_weight, now);
+    }
+}
+
+int EgressScheduler::GetDelay(TrafficClass tc) {
+    if (max_rate <= 0)
+        return 0;
+
+    uint64_t now = TokenBucket::Now();
+
+    mutex.Wait();
+    UpdateRates(tc, now);
+    int delay = classes[tc].bucket.GetDelay(now);
+    mutex.Release();
+
+    return delay;
+}
+
+void EgressScheduler::Consume(TrafficClass tc, size_t bytes) {
+    uint64_t now = TokenBucket::Now();
+
+    mutex.Wait();
+    classes[tc].bucket.Consume(bytes, now);
+    classes[tc].bytes_sent += bytes;
+    mutex.Release();
+}
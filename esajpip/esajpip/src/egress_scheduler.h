@@ -0,0 +1,212 @@
+#ifndef _EGRESS_SCHEDULER_H_
+#define _EGRESS_SCHEDULER_H_
+
+#include <ctime>
+#include <stdint.h>
+#include "app_config.h"
+#include "ipc/mutex.h"
+
+using namespace std;
+
+/**
+ * Token bucket used to limit the rate of the data sent. The
+ * bytes are consumed after being sent, so the tokens can be
+ * negative, and the time to wait is the time required to pay
+ * this debt back. A rate of zero means no limit.
+ */
+class TokenBucket {
+private:
+    double rate;        ///< Rate, in bytes per second
+    double burst;       ///< Maximum number of tokens
+    double tokens;      ///< Current number of tokens
+    uint64_t last_time; ///< Time of the last update, in microseconds
+
+    enum {
+        BURST_TIME = 100    ///< Time of the maximum burst, in milliseconds
+    };
+
+    /**
+     * Adds the tokens generated since the last update.
+     * @param now Current time, in microseconds.
+     */
+    void Update(uint64_t now) {
+        if (now > last_time) {
+            tokens += rate * (now - last_time) / 1000000.0;
+            if (tokens > burst) tokens = burst;
+        }
+        last_time = now;
+    }
+
+public:
+    /**
+     * Initializes the object without limit.
+     */
+    TokenBucket() {
+        rate = 0;
+        burst = 0;
+        tokens = 0;
+        last_time = 0;
+    }
+
+    /**
+     * Returns the current time, in microseconds, of a
+     * monotonic clock.
+     */
+    static uint64_t Now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    /**
+     * Sets the rate of the bucket, keeping the tokens
+     * generated until now with the previous one.
+     * @param rate Rate, in bytes per second (0 means no limit).
+     * @param now Current time, in microseconds.
+     */
+    void SetRate(double rate, uint64_t now) {
+        Update(now);
+        this->rate = rate;
+        burst = rate * BURST_TIME / 1000;
+        if (tokens > burst) tokens = burst;
+    }
+
+    /**
+     * Returns <code>true</code> if the bucket limits the rate.
+     */
+    bool IsLimited() const {
+        return rate > 0;
+    }
+
+    /**
+     * Consumes the tokens of the bytes sent.
+     * @param bytes Number of bytes.
+     * @param now Current time, in microseconds.
+     */
+    void Consume(size_t bytes, uint64_t now) {
+        if (rate > 0) {
+            Update(now);
+            tokens -= bytes;
+        }
+    }
+
+    /**
+     * Returns the time, in milliseconds, to wait until the
+     * tokens are not negative, or 0 if more data can be sent.
+     * @param now Current time, in microseconds.
+     */
+    int GetDelay(uint64_t now) {
+        if (rate <= 0) return 0;
+
+        Update(now);
+        if (tokens >= 0) return 0;
+        else return (int) (-tokens * 1000 / rate) + 1;
+    }
+};
+
+/**
+ * Schedules the data sent by all the connections of the child
+ * process, limiting their total rate. The responses are divided
+ * in two traffic classes: the interactive ones, for a single
+ * codestream, and the bulk ones, for several codestreams (like
+ * the movies). Each class has its own token bucket, whose rate
+ * is a share of the total rate proportional to the weight of
+ * the class, only among the classes with data to send recently,
+ * so the bandwidth not used by a class is used by the other.
+ * The number of bytes sent by each class is also counted.
+ *
+ * @see ClientManager
+ * @see TokenBucket
+ */
+class EgressScheduler {
+public:
+    /**
+     * Traffic classes of the responses.
+     */
+    enum TrafficClass {
+        INTERACTIVE,    ///< WOI of a single codestream
+        BULK,           ///< Several codestreams
+        NUM_CLASSES     ///< Number of classes
+    };
+
+private:
+    enum {
+        ACTIVE_TIME = 200000    ///< Time, in microseconds, that a class is active after sending data
+    };
+
+    /**
+     * Information of a traffic class.
+     */
+    struct Class {
+        int weight;             ///< Weight of the class
+        TokenBucket bucket;     ///< Token bucket of the class
+        uint64_t last_time;     ///< Time of the last request of the class
+        uint64_t bytes_sent;    ///< Number of bytes sent
+    };
+
+    ipc::Mutex mutex;           ///< Mutex for the classes
+    double max_rate;            ///< Total rate, in bytes per second
+    Class classes[NUM_CLASSES]; ///< Traffic classes
+
+    /**
+     * Sets the rates of the token buckets according to the
+     * classes currently active. The mutex must be held.
+     * @param tc Class that requests to send data.
+     * @param now Current time, in microseconds.
+     */
+    void UpdateRates(TrafficClass tc, uint64_t now);
+
+public:
+    /**
+     * Initializes the object without limit.
+     */
+    EgressScheduler() {
+        max_rate = 0;
+        for (int i = 0; i < NUM_CLASSES; ++i) {
+            classes[i].weight = 1;
+            classes[i].last_time = 0;
+            classes[i].bytes_sent = 0;
+        }
+    }
+
+    /**
+     * Sets the limits and the weights of the configuration.
+     * The total rate of the server is divided among the
+     * child processes, as they have a similar number of
+     * connections.
+     * @param cfg Application configuration.
+     * @param num_children Number of child processes.
+     */
+    void Init(const AppConfig &cfg, int num_children);
+
+    /**
+     * Returns the time, in milliseconds, that a connection must
+     * wait before sending more data of a class, or 0 if it can
+     * send it now.
+     * @param tc Traffic class.
+     */
+    int GetDelay(TrafficClass tc);
+
+    /**
+     * Consumes the tokens of the bytes sent by a class.
+     * @param tc Traffic class.
+     * @param bytes Number of bytes.
+     */
+    void Consume(TrafficClass tc, size_t bytes);
+
+    /**
+     * Returns the number of bytes sent by a class.
+     * @param tc Traffic class.
+     */
+    uint64_t GetBytesSent(TrafficClass tc) {
+        mutex.Wait();
+        uint64_t bytes = classes[tc].bytes_sent;
+        mutex.Release();
+        return bytes;
+    }
+
+    virtual ~EgressScheduler() {
+    }
+};
+
+#endif /* _EGRESS_SCHEDULER_H_ */
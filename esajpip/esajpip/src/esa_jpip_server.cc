@@ -2,46 +2,43 @@
 #include <sys/prctl.h>
 #endif
 
+#include <ctime>
 #include <sys/wait.h>
+#include <sys/resource.h>
 
 #include <csignal>
+#include <cstring>
 #include "trace.h"
 #include "app_info.h"
 #include "app_config.h"
 #include "args_parser.h"
 #include "client_info.h"
-#include "client_manager.h"
-#include "net/poll_table.h"
-#include "net/socket_stream.h"
+#include "client_pool.h"
+#include "session_store.h"
+#include "net/socket.h"
+#include "jpeg2000/index_manager.h"
 
 using namespace std;
 using namespace net;
+using namespace jpeg2000;
 
 #define SERVER_VERSION    "1.8.2"
 #define SERVER_NAME       "ESA JPIP Server"
 #define SERVER_APP_NAME   "esa_jpip_server"
 #define CONFIG_FILE       "server.cfg"
-
-#ifndef POLLRDHUP
-#define POLLRDHUP         (0)
-#endif
+#define CLEAN_INTERVAL    600
 
 static AppConfig cfg;
 static int base_id = 0;
 static AppInfo app_info;
-static Socket child_socket;
-static PollTable poll_table;
-static bool child_lost = false;
-static UnixAddress child_address("/tmp/child_unix_address");
-static UnixAddress father_address("/tmp/father_unix_address");
-
-static int ChildProcess(const pthread_attr_t *pattr);
+static IndexManager index_manager;
+static ClientPool client_pool(cfg, app_info, index_manager);
+static volatile sig_atomic_t clean_sessions = 0;
 
-static void *ClientThread(void *arg);
+static int ChildProcess(int num_child, const InetAddress &listen_addr);
 
-static void SIGCHLD_handler(int signal) {
-    wait(NULL);
-    child_lost = true;
+static void AlarmHandler(int) {
+    clean_sessions = 1;
 }
 
 int main(int argc, char **argv) {
@@ -62,116 +59,100 @@ int main(int argc, char **argv) {
     if (cfg.logging())
         TraceSystem::AppendToFile(cfg.logging_folder() + SERVER_APP_NAME);
 
-    int max_connections = cfg.max_connections();
+    // Each connection requires a descriptor
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    int num_children = cfg.num_children();
+    if (num_children < 1) num_children = 1;
+    else if (num_children > AppInfo::MAX_CHILDREN) num_children = AppInfo::MAX_CHILDREN;
 
+    // The child processes listen with their own sockets, so the
+    // address is only checked by the father
     Socket listen_socket;
     InetAddress listen_addr = cfg.address().empty()
                                   ? InetAddress(cfg.port())
                                   : InetAddress(cfg.address().c_str(), cfg.port());
     if (!listen_socket.OpenInet())
         return CERR("The server listen socket can not be created");
-    if (!listen_socket.ListenAt(listen_addr))
+    if (!listen_socket.ListenAt(listen_addr, SOMAXCONN, true))
         return CERR("The server listen socket can not be initialized");
+    listen_socket.Close();
 
     LOG(SERVER_NAME << " " << SERVER_VERSION << " started");
 
-    signal(SIGCHLD, SIG_IGN);
+    app_info->num_children = num_children;
+    vector<time_t> start_times(num_children);
 
-    poll_table.Add(listen_socket, POLLIN);
+    for (int i = 0; i < num_children; ++i) {
+        pid_t pid = fork();
+        if (pid == 0)
+            return ChildProcess(i, listen_addr);
 
-    Socket father_socket;
-    if (!father_socket.OpenUnix(SOCK_DGRAM)) {
-        ERROR("The father unix socket can not be created");
-        return -1;
+        app_info->children[i].pid = pid;
+        start_times[i] = time(NULL);
     }
-    if (!father_socket.BindTo(father_address.Reset())) {
-        ERROR("The father unix socket can not be bound");
-        return -1;
-    }
-
-    poll_table.Add(father_socket, POLLIN);
 
-    pthread_attr_t pattr;
-    pthread_attr_init(&pattr);
-    pthread_attr_setdetachstate(&pattr, PTHREAD_CREATE_DETACHED);
-
-father_begin:
-
-    if (!fork())
-        return ChildProcess(&pattr);
-
-    // in father
-    signal(SIGCHLD, SIGCHLD_handler);
+    // The expired sessions are removed periodically by the father. The
+    // alarm interrupts the wait, so the handler is set without SA_RESTART
+    bool sessions = !cfg.caching_folder().empty() && cfg.cache_max_time() >= 0;
+    if (sessions) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = AlarmHandler;
+        sigaction(SIGALRM, &action, NULL);
+        alarm(CLEAN_INTERVAL);
+    }
 
+    // The father only waits for the child processes, creating
+    // a new one when any of them finishes
     for (;;) {
-        int res = poll_table.Poll();
+        pid_t pid = wait(NULL);
+        if (pid == -1) {
+            if (errno == EINTR) {
+                if (sessions && clean_sessions) {
+                    clean_sessions = 0;
+                    LOG(SessionStore::Clean(cfg) << " expired sessions removed");
+                    alarm(CLEAN_INTERVAL);
+                }
+                continue;
+            }
 
-        if (child_lost) {
-            child_lost = false;
-            goto father_begin;
+            ERROR("Error waiting for the child processes: " << strerror(errno));
+            break;
         }
 
-        if (res > 0) {
-            if (poll_table[0].revents & POLLIN) {
-                InetAddress from_addr;
-                Socket new_conn = listen_socket.Accept(&from_addr);
-
-                if (new_conn == -1) {
-                    ERROR("Error accepting a new connection: " << strerror(errno));
-                } else if (app_info->num_connections >= max_connections) {
-                    LOG("Connection refused because the limit has been reached");
-                    new_conn.Close();
-                } else {
-                    LOG("New connection from " << from_addr.GetPath() << ":" << from_addr.GetPort() << " [" << (int) new_conn << "]");
-
-                    if (!father_socket.SendDescriptor(child_address, new_conn, new_conn)) {
-                        ERROR("The new socket can not be sent to the child process: " << strerror(errno));
-                        new_conn.Close();
-                    } else {
-                        poll_table.Add(new_conn, POLLRDHUP | POLLERR | POLLHUP | POLLNVAL);
-                        app_info->num_connections++;
-                    }
-                }
-            }
+        for (int i = 0; i < num_children; ++i) {
+            if (app_info->children[i].pid == pid) {
+                LOG("The child process " << i << " (PID = " << pid << ") has finished");
+                app_info->children[i].num_connections = 0;
 
-            if (poll_table[1].revents & POLLIN) {
-                int fd;
-                if (father_socket.Receive(&fd, sizeof fd) == sizeof fd) {
-                    LOG("Closing the connection [" << fd << "] from child");
-                    app_info->num_connections--;
-                    close(fd);
-                    poll_table.Remove(fd);
-                } else
-                    ERROR("Could not receive descriptor");
-            }
+                // Avoids a busy loop if the child fails at the beginning
+                if (time(NULL) - start_times[i] < 1)
+                    sleep(1);
 
-            for (int i = 2; i < poll_table.GetSize(); ++i) {
-                if (poll_table[i].revents) {
-                    LOG("Closing the connection [" << poll_table[i].fd << "]");
-                    app_info->num_connections--;
-                    close(poll_table[i].fd);
-                    poll_table.RemoveAt(i);
-                }
-            }
+                pid = fork();
+                if (pid == 0)
+                    return ChildProcess(i, listen_addr);
 
-            if (app_info->num_connections < 0)
-                app_info->num_connections = 0;
+                app_info->children[i].pid = pid;
+                start_times[i] = time(NULL);
+                break;
+            }
         }
     }
 
-    pthread_attr_destroy(&pattr);
-
-    listen_socket.Close();
     return 0;
 }
 
-static int ChildProcess(const pthread_attr_t *pattr) {
-    int sock;
-    pthread_t service_tid;
-    ClientInfo *client_info;
+static int ChildProcess(int num_child, const InetAddress &listen_addr) {
+    AppInfo::Child &child = app_info->children[num_child];
 
-    app_info->child_iterations++;
-    app_info->child_pid = getpid();
+    child.iterations++;
+    child.pid = getpid();
 
     signal(SIGPIPE, SIG_IGN);
 
@@ -179,60 +160,74 @@ static int ChildProcess(const pthread_attr_t *pattr) {
     prctl(PR_SET_PDEATHSIG, SIGHUP);
 #endif
 
-    LOG("Child process created (PID = " << getpid() << ")");
+    LOG("Child process " << num_child << " created (PID = " << getpid() << ")");
 
-    if (!child_socket.OpenUnix(SOCK_DGRAM)) {
-        ERROR("The child unix socket can not be created");
+    index_manager.Init(cfg.index_cache_size());
+
+    // The kernel distributes the new connections between the
+    // sockets of all the child processes
+    Socket listen_socket;
+    if (!listen_socket.OpenInet()) {
+        ERROR("The child listen socket can not be created");
         return -1;
     }
-    if (!child_socket.BindTo(child_address.Reset())) {
-        ERROR("The child unix socket can not be bound");
+    if (!listen_socket.ListenAt(listen_addr, SOMAXCONN, true) || !listen_socket.SetBlockingMode(false)) {
+        ERROR("The child listen socket can not be initialized: " << strerror(errno));
         return -1;
     }
 
-    for (int i = 2; i < poll_table.GetSize(); ++i) {
-        sock = poll_table[i].fd;
-        client_info = new ClientInfo(0, sock, sock);
-
-        LOG("Creating a client thread for the old connection [" << sock << "]");
+    int num_threads = cfg.num_threads();
+    if (num_threads <= 0) {
+        int num_children = app_info->num_children;
+        num_threads = max(1, (int) (sysconf(_SC_NPROCESSORS_ONLN) + num_children - 1) / num_children);
+    }
 
-        if (pthread_create(&service_tid, pattr, ClientThread, client_info) == -1) {
-            ERROR("A new client thread for the old connection [" << sock << "] can not be created");
-            delete client_info;
-            return -1;
-        }
+    if (!client_pool.Init(num_threads)) {
+        ERROR("The client threads can not be created");
+        return -1;
     }
 
+    int max_connections = cfg.max_connections();
+    uint64_t interactive_bytes = 0, bulk_bytes = 0, last_check = 0;
+
     for (;;) {
-        int father_sock;
-        if (!child_socket.ReceiveDescriptor(&sock, &father_sock)) {
-            ERROR("The new socket can not be received by the child process: " << strerror(errno));
-            continue;
+        // The inactive connections are checked every second,
+        // not on every new connection
+        uint64_t now = TokenBucket::Now();
+        if (now - last_check >= 1000000) {
+            client_pool.CloseInactive();
+            child.num_connections = client_pool.GetNumConnections();
+            last_check = now;
         }
-        client_info = new ClientInfo(base_id++, sock, father_sock);
 
-        LOG("Creating a client thread for the new connection [" << sock << "|" << father_sock << "]");
+        // The counters of the data sent are accumulated, so that
+        // they are kept when the child process is created again
+        uint64_t bytes = client_pool.GetBytesSent(EgressScheduler::INTERACTIVE);
+        child.interactive_bytes += bytes - interactive_bytes;
+        interactive_bytes = bytes;
+        bytes = client_pool.GetBytesSent(EgressScheduler::BULK);
+        child.bulk_bytes += bytes - bulk_bytes;
+        bulk_bytes = bytes;
 
-        if (pthread_create(&service_tid, pattr, ClientThread, client_info) == -1) {
-            LOG("A new client thread for the new connection [" << sock << "|" << father_sock << "] can not be created");
-            delete client_info;
-            return -1;
-        }
-    }
-
-    return 0;
-}
+        if (listen_socket.WaitForInput(1000) <= 0)
+            continue;
 
-static void *ClientThread(void *arg) {
-    ClientInfo *client_info = (ClientInfo *) arg;
+        InetAddress from_addr;
+        Socket new_conn = listen_socket.Accept(&from_addr);
 
-    ClientManager(cfg, app_info).Run(client_info);
+        if (new_conn == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR)
+                ERROR("Error accepting a new connection: " << strerror(errno));
+        } else if (app_info->num_connections() >= max_connections) {
+            LOG("Connection refused because the limit has been reached");
+            new_conn.Close();
+        } else {
+            LOG("New connection from " << from_addr.GetPath() << ":" << from_addr.GetPort() << " [" << (int) new_conn << "]");
 
-    int sock = client_info->father_sock();
-    if (child_socket.SendTo(father_address, &sock, sizeof sock) != sizeof sock)
-        ERROR("The connection [" << sock << "] could not be closed");
+            if (client_pool.Add(new ClientInfo(base_id++, new_conn)))
+                child.num_connections++;
+        }
+    }
 
-    delete client_info;
-    pthread_exit(NULL);
-    return NULL;
+    return 0;
 }
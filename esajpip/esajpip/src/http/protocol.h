@@ -2,6 +2,7 @@
 #define _HTTP_PROTOCOL_H_
 
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <string>
 
@@ -55,14 +56,28 @@ namespace http {
         friend istream &operator>>(istream &in, Protocol &protocol) {
             string cad;
 
-            in >> cad;
-            if (!cad.compare(0, 8, "HTTP/1.0")) protocol = Protocol(1, 0);
-            else if (!cad.compare(0, 8, "HTTP/1.1")) protocol = Protocol(1, 1);
-            else in.setstate(istream::failbit);
+            if ((in >> cad) && !protocol.Parse(cad.data(), cad.size()))
+                in.setstate(istream::failbit);
 
             return in;
         }
 
+        /**
+         * Parses the protocol from a string, which must start
+         * with the protocol name and version.
+         * @param cad String to parse.
+         * @param len Length of the string.
+         * @return <code>true</code> if successful.
+         */
+        bool Parse(const char *cad, size_t len) {
+            if (len < 8 || strncmp(cad, "HTTP/1.", 7) != 0) return false;
+            else if (cad[7] == '0') *this = Protocol(1, 0);
+            else if (cad[7] == '1') *this = Protocol(1, 1);
+            else return false;
+
+            return true;
+        }
+
         /**
          * Returns the major number of the protocol version.
          */
@@ -1,43 +1,58 @@
 //#define SHOW_TRACES
 #include "trace.h"
+#include <cctype>
 #include "request.h"
 
-#define MAX_URI 1023
-
 namespace http {
 
-    void Request::ParseParameter(istream &stream, const string &param, string &value) {
-        getline(stream, value, '&');
+    /**
+     * Returns the next token of a buffer, delimited by white spaces.
+     * @param p Position to start at, updated after the token.
+     * @param end End of the buffer.
+     * @param len Receives the length of the token.
+     * @return The beginning of the token.
+     */
+    static const char *GetToken(const char *&p, const char *end, size_t *len) {
+        while (p < end && isspace((unsigned char) *p)) p++;
+        const char *token = p;
+        while (p < end && !isspace((unsigned char) *p)) p++;
+        *len = p - token;
+        return token;
     }
 
-    void Request::ParseParameters(istream &stream) {
-        string param, value;
+    void Request::ParseParameter(const char *param, size_t param_len, const char *value, size_t value_len) {
+        parameters[string(param, param_len)].assign(value, value_len);
+    }
 
+    void Request::ParseParameters(const char *begin, const char *end) {
         parameters.clear();
 
-        while (stream.good()) {
-            value.clear();
-            getline(stream, param, '=');
-            ParseParameter(stream, param, value);
-            if (stream) parameters[param] = value;
+        while (begin < end) {
+            const char *next = (const char *) memchr(begin, '&', end - begin);
+            if (next == NULL) next = end;
+
+            const char *value = (const char *) memchr(begin, '=', next - begin);
+            if (value == NULL) ParseParameter(begin, next - begin, next, 0);
+            else ParseParameter(begin, value - begin, value + 1, next - value - 1);
+
+            begin = next + 1;
         }
     }
 
-    bool Request::Parse(const string &line) {
-        string cad, uri;
+    bool Request::Parse(const char *line, const char *end) {
+        size_t method_len, uri_len, protocol_len;
+        const char *method = GetToken(line, end, &method_len);
+        const char *uri = GetToken(line, end, &uri_len);
+        const char *protocol_str = GetToken(line, end, &protocol_len);
 
         type = Request::UNKNOWN;
 
-        if (!line.empty()) {
-            istringstream in(line);
-
-            if (in >> cad >> uri >> protocol) {
-                if (cad == "GET") type = Request::GET;
+        if (uri_len > 0 && protocol.Parse(protocol_str, protocol_len)) {
+            if (method_len == 3 && !memcmp(method, "GET", 3)) type = Request::GET;
 
-                if (type != Request::UNKNOWN) {
-                    ParseURI(uri.substr(0, MAX_URI));
-                    return true;
-                }
+            if (type != Request::UNKNOWN) {
+                ParseURI(uri, uri + uri_len);
+                return true;
             }
         }
         return false;
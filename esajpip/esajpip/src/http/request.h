@@ -4,9 +4,9 @@
 #include <map>
 #include <string>
 #include <vector>
-#include <sstream>
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 #include "header.h"
 #include "protocol.h"
 
@@ -48,39 +48,56 @@ namespace http {
             this->type = type;
             this->protocol = protocol;
 
-            ParseURI(uri);
+            ParseURI(uri.data(), uri.data() + uri.size());
         }
 
+        /**
+         * Parses a request from a buffer, in only one pass and
+         * without copying it.
+         * @param line Beginning of the request line.
+         * @param end End of the request line.
+         * @return <code>true</code> if successful.
+         */
+        bool Parse(const char *line, const char *end);
+
         /**
          * Parses a request from a string.
          * @param line String that contains the request to parse.
          * @return <code>true</code> if successful.
          */
-        bool Parse(const string &line);
+        bool Parse(const string &line) {
+            return Parse(line.data(), line.data() + line.size());
+        }
 
         /**
-         * Parses a URI from a string.
-         * @param uri String that contains the URI to parse.
+         * Parses a URI from a buffer.
+         * @param uri Beginning of the URI.
+         * @param end End of the URI.
          */
-        void ParseURI(const string &uri) {
-            istringstream uri_str(uri);
-            getline(uri_str, object, '?');
-            ParseParameters(uri_str);
+        void ParseURI(const char *uri, const char *end) {
+            const char *query = (const char *) memchr(uri, '?', end - uri);
+
+            object.assign(uri, query ? query : end);
+            ParseParameters(query ? query + 1 : end, end);
         }
 
         /**
-         * Parses the parameters from an input stream.
-         * @param stream Input stream.
+         * Parses the parameters from a buffer, separated
+         * by the character '&'.
+         * @param begin Beginning of the parameters.
+         * @param end End of the parameters.
          */
-        virtual void ParseParameters(istream &stream);
+        virtual void ParseParameters(const char *begin, const char *end);
 
         /**
-         * Parses one parameter from an input stream.
-         * @param stream Input stream.
+         * Parses one parameter. By default it is stored in
+         * the map <code>parameters</code>.
          * @param param Parameter name.
+         * @param param_len Length of the parameter name.
          * @param value Parameter value.
+         * @param value_len Length of the parameter value.
          */
-        virtual void ParseParameter(istream &stream, const string &param, string &value);
+        virtual void ParseParameter(const char *param, size_t param_len, const char *value, size_t value_len);
 
         friend istream &operator>>(istream &in, Request &request);
 
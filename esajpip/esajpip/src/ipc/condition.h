@@ -0,0 +1,59 @@
+#ifndef _IPC_CONDITION_H_
+#define _IPC_CONDITION_H_
+
+#include <pthread.h>
+#include "mutex.h"
+
+namespace ipc {
+
+    /**
+     * Wrapper of the <code>pthread_cond</code> functions that
+     * implements a condition variable. It is always used together
+     * with a <code>Mutex</code> object, which protects the state the
+     * threads wait for. This class can not be copied.
+     *
+     * @see Mutex
+     */
+    class Condition {
+    private:
+        pthread_cond_t cond;    ///< Condition variable
+
+        Condition(const Condition &);
+
+        Condition &operator=(const Condition &);
+
+    public:
+        /**
+         * Initializes the condition variable.
+         */
+        Condition() {
+            pthread_cond_init(&cond, NULL);
+        }
+
+        /**
+         * Releases the mutex and blocks the calling thread until
+         * the condition is signaled. The mutex is held again when
+         * the method returns. The state must be checked again after
+         * returning, since the wake-ups can be spurious.
+         * @param mutex Mutex held by the calling thread.
+         * @return <code>true</code> if successful.
+         */
+        bool Wait(Mutex &mutex) {
+            return pthread_cond_wait(&cond, &mutex.mutex) == 0;
+        }
+
+        /**
+         * Wakes up all the threads waiting for the condition.
+         * @return <code>true</code> if successful.
+         */
+        bool Broadcast() {
+            return pthread_cond_broadcast(&cond) == 0;
+        }
+
+        virtual ~Condition() {
+            pthread_cond_destroy(&cond);
+        }
+    };
+}
+
+#endif /* _IPC_CONDITION_H_ */
@@ -0,0 +1,52 @@
+#ifndef _IPC_MUTEX_H_
+#define _IPC_MUTEX_H_
+
+#include <pthread.h>
+
+namespace ipc {
+
+    /**
+     * Wrapper of the <code>pthread_mutex</code> functions that
+     * implements a mutex lock. This class can not be copied.
+     */
+    class Mutex {
+    private:
+        friend class Condition;
+
+        pthread_mutex_t mutex;    ///< Mutex
+
+        Mutex(const Mutex &);
+
+        Mutex &operator=(const Mutex &);
+
+    public:
+        /**
+         * Initializes the mutex.
+         */
+        Mutex() {
+            pthread_mutex_init(&mutex, NULL);
+        }
+
+        /**
+         * Blocks the calling thread until the mutex is held.
+         * @return <code>true</code> if successful.
+         */
+        bool Wait() {
+            return pthread_mutex_lock(&mutex) == 0;
+        }
+
+        /**
+         * Releases the mutex.
+         * @return <code>true</code> if successful.
+         */
+        bool Release() {
+            return pthread_mutex_unlock(&mutex) == 0;
+        }
+
+        virtual ~Mutex() {
+            pthread_mutex_destroy(&mutex);
+        }
+    };
+}
+
+#endif /* _IPC_MUTEX_H_ */
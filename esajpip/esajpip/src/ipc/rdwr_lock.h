@@ -0,0 +1,67 @@
+#ifndef _IPC_RDWR_LOCK_H_
+#define _IPC_RDWR_LOCK_H_
+
+#include <pthread.h>
+
+/**
+ * Set of classes for the synchronization of the threads
+ * of the child process.
+ */
+namespace ipc {
+
+    /**
+     * Wrapper of the <code>pthread_rwlock</code> functions that
+     * implements a reader/writer lock. Multiple threads can hold
+     * the lock for reading at the same time, whilst only one can
+     * hold it for writing. This class can not be copied.
+     */
+    class RdWrLock {
+    private:
+        pthread_rwlock_t rwlock;    ///< Reader/writer lock
+
+        RdWrLock(const RdWrLock &);
+
+        RdWrLock &operator=(const RdWrLock &);
+
+    public:
+        /**
+         * Initializes the lock.
+         */
+        RdWrLock() {
+            pthread_rwlock_init(&rwlock, NULL);
+        }
+
+        /**
+         * Blocks the calling thread until the lock can be
+         * held for reading.
+         * @return <code>true</code> if successful.
+         */
+        bool WaitForReading() {
+            return pthread_rwlock_rdlock(&rwlock) == 0;
+        }
+
+        /**
+         * Blocks the calling thread until the lock can be
+         * held for writing.
+         * @return <code>true</code> if successful.
+         */
+        bool WaitForWriting() {
+            return pthread_rwlock_wrlock(&rwlock) == 0;
+        }
+
+        /**
+         * Releases the lock, previously held for reading
+         * or for writing.
+         * @return <code>true</code> if successful.
+         */
+        bool Release() {
+            return pthread_rwlock_unlock(&rwlock) == 0;
+        }
+
+        virtual ~RdWrLock() {
+            pthread_rwlock_destroy(&rwlock);
+        }
+    };
+}
+
+#endif /* _IPC_RDWR_LOCK_H_ */
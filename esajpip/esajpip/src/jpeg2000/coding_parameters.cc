@@ -1,19 +1,196 @@
+#include <algorithm>
 #include "coding_parameters.h"
 
 namespace jpeg2000 {
 
+    /**
+     * Position of a packet in the progression order. The
+     * packets are sorted by the keys in lexicographic order.
+     */
+    struct PacketOrder {
+        int64_t keys[5];    ///< Sorting keys
+        int id;         ///< Position in the lookup table
+
+        bool operator<(const PacketOrder &order) const {
+            return lexicographical_compare(keys, keys + 5, order.keys, order.keys + 5);
+        }
+    };
+
+    /**
+     * Returns the base-2 logarithm of a value if it is
+     * a power of two, or -1 otherwise.
+     */
+    static int Log2(int value) {
+        int res = 0;
+
+        if (value <= 0 || (value & (value - 1)) != 0)
+            return -1;
+        while ((1 << res) < value) res++;
+        return res;
+    }
+
+    /**
+     * Returns the coordinate in the reference grid where a precinct
+     * is reached by the position-driven progressions (PCRL and CPRL),
+     * according to the Annex B.12 of the standard, in one dimension.
+     * @param origin Origin of the tile in the reference grid.
+     * @param subsampling Subsampling factor of the component.
+     * @param levels Number of decompositions below the resolution level.
+     * @param log_size Base-2 logarithm of the precinct size.
+     * @param p Index of the precinct.
+     */
+    static int64_t GetPrecinctPosition(int64_t origin, int64_t subsampling, int levels, int log_size, int p) {
+        // Origin of the tile-component and of the resolution level
+        int64_t origin_c = (origin + subsampling - 1) / subsampling;
+        int64_t origin_r = (origin_c + ((int64_t) 1 << levels) - 1) >> levels;
+        int64_t start = ((origin_r >> log_size) + p) << log_size;
+
+        // The first precinct is reached at the origin of the tile
+        // when the resolution level is not aligned with it
+        if (start < origin_r) return origin;
+        else return (start << levels) * subsampling;
+    }
+
     void CodingParameters::FillTotalPrecinctsVector() {
         int pa = 0;
         Size precinct_point;
 
+        // The geometry of each resolution level is computed only
+        // once, so that only integer shifts are used afterwards
+        resolution_sizes.clear();
+        precinct_shifts.clear();
+        precinct_divisors.clear();
+
+        for (int i = 0; i <= num_levels; ++i) {
+            int levels = num_levels - i;
+            int log_x = Log2(precinct_size[i].x);
+            int log_y = Log2(precinct_size[i].y);
+
+            resolution_sizes.emplace_back(CeilShift(size.x, levels), CeilShift(size.y, levels));
+            precinct_shifts.emplace_back(levels + max(log_x, 0), levels + max(log_y, 0));
+            precinct_divisors.emplace_back(log_x >= 0 ? 1 : max(precinct_size[i].x, 1),
+                                           log_y >= 0 ? 1 : max(precinct_size[i].y, 1));
+        }
+
         total_precincts.clear();
         total_precincts.push_back(pa);
+        num_precincts.clear();
 
         for (int i = 0; i <= num_levels; ++i) {
             precinct_point = GetPrecincts(i, size);
             pa += precinct_point.x * precinct_point.y;
             total_precincts.push_back(pa);
+            num_precincts.push_back(precinct_point);
+        }
+
+        BuildProgressionTable();
+    }
+
+    bool CodingParameters::NeedsProgressionIndexes() const {
+        if (progression == LRCP_PROGRESSION || progression == RLCP_PROGRESSION) return false;
+        if (progression != RPCL_PROGRESSION) return true;
+
+        // With the same subsampling, all the components reach the
+        // precincts at the same positions, in the order of their indexes
+        Size first = subsampling.empty() ? Size(1, 1) : subsampling[0];
+        for (int c = 1; c < num_components; ++c) {
+            Size sub = c < (int) subsampling.size() ? subsampling[c] : Size(1, 1);
+            if (sub != first) return true;
+        }
+
+        return false;
+    }
+
+    void CodingParameters::BuildProgressionTable() {
+        shared_ptr<ProgressionTable> table = make_shared<ProgressionTable>();
+
+        if (!NeedsProgressionIndexes()) {
+            int nc = num_components, nl = num_layers;
+
+            for (int r = 0; r <= num_levels; ++r) {
+                if (progression == LRCP_PROGRESSION)
+                    table->last_indexes.push_back(((nl - 1) * total_precincts[num_levels + 1] * nc) +
+                                                  (total_precincts[r + 1] * nc) - 1);
+                else
+                    table->last_indexes.push_back((total_precincts[r + 1] * nc * nl) - 1);
+            }
+
+            progression_table = table;
+            return;
         }
+
+        vector<PacketOrder> orders;
+        orders.reserve(total_precincts[num_levels + 1] * num_components * num_layers);
+
+        for (int r = 0; r <= num_levels; ++r) {
+            int levels = num_levels - r;
+
+            // Without user defined precincts, there is a single one
+            // per resolution level, with the maximum size
+            int log_x = Log2(precinct_size[r].x);
+            int log_y = Log2(precinct_size[r].y);
+            if (log_x < 0) log_x = 15;
+            if (log_y < 0) log_y = 15;
+
+            for (int c = 0; c < num_components; ++c) {
+                Size sub = c < (int) subsampling.size() ? subsampling[c] : Size(1, 1);
+
+                for (int py = 0; py < num_precincts[r].y; ++py) {
+                    int64_t y = GetPrecinctPosition(origin.y, sub.y, levels, log_y, py);
+
+                    for (int px = 0; px < num_precincts[r].x; ++px) {
+                        int64_t x = GetPrecinctPosition(origin.x, sub.x, levels, log_x, px);
+                        int bin_id = c + ((total_precincts[r] + (py * num_precincts[r].x) + px) * num_components);
+
+                        for (int l = 0; l < num_layers; ++l) {
+                            PacketOrder order;
+                            order.id = (bin_id * num_layers) + l;
+
+                            int64_t *k = order.keys;
+                            switch (progression) {
+                                case LRCP_PROGRESSION:
+                                    k[0] = l; k[1] = r; k[2] = c; k[3] = py; k[4] = px;
+                                    break;
+                                case RLCP_PROGRESSION:
+                                    k[0] = r; k[1] = l; k[2] = c; k[3] = py; k[4] = px;
+                                    break;
+                                case RPCL_PROGRESSION:
+                                    k[0] = r; k[1] = y; k[2] = x; k[3] = c; k[4] = l;
+                                    break;
+                                case PCRL_PROGRESSION:
+                                    k[0] = y; k[1] = x; k[2] = c; k[3] = r; k[4] = l;
+                                    break;
+                                default:
+                                    k[0] = c; k[1] = y; k[2] = x; k[3] = r; k[4] = l;
+                            }
+
+                            orders.push_back(order);
+                        }
+                    }
+                }
+            }
+        }
+
+        sort(orders.begin(), orders.end());
+
+        table->indexes.resize(orders.size());
+        for (size_t i = 0; i < orders.size(); ++i)
+            table->indexes[orders[i].id] = i;
+
+        // The packets of each resolution level are contiguous
+        // in the lookup table, as it is indexed by data-bin
+        int last = -1;
+        for (int r = 0; r <= num_levels; ++r) {
+            int first = total_precincts[r] * num_components * num_layers;
+            int end = total_precincts[r + 1] * num_components * num_layers;
+
+            for (int i = first; i < end; ++i)
+                last = max(last, table->indexes[i]);
+
+            table->last_indexes.push_back(last);
+        }
+
+        progression_table = table;
     }
 
     int CodingParameters::GetClosestResolution(const Size &res_size, Size *res_image_size) const {
@@ -26,8 +203,8 @@ namespace jpeg2000 {
         res_image_size->y = size.y;
 
         for (int r = 1; r <= num_levels; ++r) {
-            res_image_x = (int) ceil((double) size.x / (1L << r));
-            res_image_y = (int) ceil((double) size.y / (1L << r));
+            res_image_x = resolution_sizes[num_levels - r].x;
+            res_image_y = resolution_sizes[num_levels - r].y;
             distance_x = res_image_x - res_size.x;
             distance_y = res_image_y - res_size.y;
             distance = abs(distance_x) + abs(distance_y);
@@ -53,8 +230,7 @@ namespace jpeg2000 {
         bool bigger = false;
 
         while (!bigger && r >= 0) {
-            res_image_size->x = (int) ceil((double) size.x / (1L << r));
-            res_image_size->y = (int) ceil((double) size.y / (1L << r));
+            *res_image_size = resolution_sizes[num_levels - r];
             if ((res_image_size->x >= res_size.x) &&
                 (res_image_size->y >= res_size.y))
                 bigger = true;
@@ -74,8 +250,7 @@ namespace jpeg2000 {
         bool smaller = false;
 
         while (!smaller && r <= num_levels) {
-            res_image_size->x = (int) ceil((double) size.x / (1L << r));
-            res_image_size->y = (int) ceil((double) size.y / (1L << r));
+            *res_image_size = resolution_sizes[num_levels - r];
             if ((res_image_size->x <= res_size.x) &&
                 (res_image_size->y <= res_size.y))
                 smaller = true;
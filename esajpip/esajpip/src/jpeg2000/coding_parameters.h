@@ -2,7 +2,10 @@
 #define _JPEG2000_CODING_PARAMETERS_H_
 
 #include <vector>
+#include <memory>
 #include <cmath>
+#include <cassert>
+#include <cstdint>
 
 #include "point.h"
 #include "trace.h"
@@ -15,6 +18,25 @@ namespace jpeg2000 {
      */
     class CodingParameters {
     private:
+        /**
+         * Contains the lookup tables of the progression order.
+         * They are shared by all the copies of an object.
+         */
+        struct ProgressionTable {
+            /**
+             * Progression index of each packet, indexed by the
+             * data-bin identifier and the quality layer. It is
+             * empty when the index has a closed form.
+             */
+            vector<int> indexes;
+
+            /**
+             * Last progression index of the packets of each
+             * resolution level and the lower ones.
+             */
+            vector<int> last_indexes;
+        };
+
         /**
          * Contains the number of precincts of each
          * resolution level.
@@ -22,51 +44,80 @@ namespace jpeg2000 {
         vector<int> total_precincts;
 
         /**
-         * Returns the index of a packet according to the RPCL progression.
-         * @param l Quality layer.
-         * @param r Resolution level.
-         * @param c Component.
-         * @param px Precinct position X.
-         * @param py Precinct position Y.
+         * Number of precincts of each resolution level,
+         * in both dimensions.
          */
-        int GetProgressionIndexRPCL(int l, int r, int c, int px, int py) const {
-            Size precinct_point = GetPrecincts(r, size);
-            return (total_precincts[r] * num_components * num_layers) +
-                   (py * precinct_point.x * num_components * num_layers) +
-                   (px * num_components * num_layers) + (c * num_layers) + l;
-        }
+        vector<Size> num_precincts;
 
         /**
-         * Returns the index of a packet according to the RLCP progression.
-         * @param l Quality layer.
-         * @param r Resolution level.
-         * @param c Component.
-         * @param px Precinct position X.
-         * @param py Precinct position Y.
+         * Image size of each resolution level.
+         */
+        vector<Size> resolution_sizes;
+
+        /**
+         * Shift of each resolution level, in both dimensions, that
+         * converts a coordinate of the reference grid into a precinct
+         * coordinate. It includes the precinct size when it is a
+         * power of two.
+         */
+        vector<Size> precinct_shifts;
+
+        /**
+         * Precinct size of each resolution level, in both dimensions,
+         * that is not included in the shift (1 if it is a power of two).
+         */
+        vector<Size> precinct_divisors;
+
+        /**
+         * Lookup tables of the progression order.
+         */
+        shared_ptr<const ProgressionTable> progression_table;
+
+        /**
+         * Builds the lookup tables of the progression order.
+         */
+        void BuildProgressionTable();
+
+        /**
+         * Returns <code>true</code> if the progression index of the
+         * packets can not be computed with a closed form, so it must
+         * be looked up in the table. This is the case of PCRL and CPRL,
+         * and of RPCL when the components have different subsamplings.
          */
-        int GetProgressionIndexRLCP(int l, int r, int c, int px, int py) const {
-            Size precinct_point = GetPrecincts(r, size);
-            return (total_precincts[r] * num_components * num_layers) +
-                   (l * num_components * precinct_point.x * precinct_point.y) +
-                   (c * precinct_point.x * precinct_point.y) + (py * precinct_point.x) + px;
+        bool NeedsProgressionIndexes() const;
+
+        /**
+         * Returns the ceiling of the division of a value by
+         * a power of two.
+         * @param value Value to divide.
+         * @param shift Base-2 logarithm of the divisor.
+         */
+        static int CeilShift(int value, int shift) {
+            if (value >= 0) return (int) (((int64_t) value + ((int64_t) 1 << shift) - 1) >> shift);
+            else return -(int) (-(int64_t) value >> shift);
         }
 
         /**
-         * Returns the index of a packet according to the LRCP progression.
-         * @param l Quality layer.
-         * @param r Resolution level.
-         * @param c Component.
-         * @param px Precinct position X.
-         * @param py Precinct position Y.
+         * Returns the ceiling of the division of a value by
+         * a positive divisor.
+         * @param value Value to divide.
+         * @param divisor Divisor.
          */
-        int GetProgressionIndexLRCP(int l, int r, int c, int px, int py) const {
-            Size precinct_point = GetPrecincts(r, size);
-            return (l * total_precincts[num_levels + 1] * num_components) + (num_components * total_precincts[r]) +
-                   (c * precinct_point.x * precinct_point.y) + (py * precinct_point.x) + px;
+        static int CeilDiv(int value, int divisor) {
+            if (value >= 0) return (int) (((int64_t) value + divisor - 1) / divisor);
+            else return -(int) (-(int64_t) value / divisor);
         }
 
     public:
+        /**
+         * Maximum number of decomposition levels (JPEG2000 Part 1).
+         */
+        enum {
+            MAX_LEVELS = 32
+        };
+
         Size size;                ///< Image size
+        Size origin;            ///< Origin of the image in the reference grid
         int num_levels;            ///< Number of resolution levels
         int num_layers;            ///< Number of quality layers
         int progression;        ///< Progression order
@@ -77,6 +128,11 @@ namespace jpeg2000 {
          */
         vector<Size> precinct_size;
 
+        /**
+         * Subsampling factors of each component.
+         */
+        vector<Size> subsampling;
+
         /**
          * All the progression orders defined in the JPEG2000
          * standard (Part 1).
@@ -107,7 +163,10 @@ namespace jpeg2000 {
         }
 
         /**
-         * Fills the vector <code>total_precincts</code>.
+         * Fills the vector <code>total_precincts</code>, the geometry
+         * of the resolution levels and the lookup tables of the
+         * progression order. It must be called once the parameters
+         * are set.
          */
         void FillTotalPrecinctsVector();
 
@@ -116,12 +175,19 @@ namespace jpeg2000 {
          */
         CodingParameters &operator=(const CodingParameters &cod_params) {
             size = cod_params.size;
+            origin = cod_params.origin;
             num_levels = cod_params.num_levels;
             num_layers = cod_params.num_layers;
             progression = cod_params.progression;
             num_components = cod_params.num_components;
             precinct_size = cod_params.precinct_size;
+            subsampling = cod_params.subsampling;
             total_precincts = cod_params.total_precincts;
+            num_precincts = cod_params.num_precincts;
+            resolution_sizes = cod_params.resolution_sizes;
+            precinct_shifts = cod_params.precinct_shifts;
+            precinct_divisors = cod_params.precinct_divisors;
+            progression_table = cod_params.progression_table;
             return *this;
         }
 
@@ -148,16 +214,64 @@ namespace jpeg2000 {
             return progression == RLCP_PROGRESSION || progression == RPCL_PROGRESSION;
         }
 
+        /**
+         * Returns <code>true</code> if the packets of the quality
+         * layers of a precinct are consecutive in the progression
+         * order (RPCL, PCRL or CPRL).
+         */
+        bool HasConsecutiveLayers() const {
+            return progression == RPCL_PROGRESSION || progression == PCRL_PROGRESSION ||
+                   progression == CPRL_PROGRESSION;
+        }
+
         /**
          * Returns a precinct coordinate adjusted to a given resolution level.
          * @param r Resolution level.
          * @param point Precinct coordinate.
          */
         Size GetPrecincts(int r, const Size &point) const {
-            return Size(
-                    (int) ceil(ceil((double) point.x / (1L << (num_levels - r))) / (double) precinct_size[r].x),
-                    (int) ceil(ceil((double) point.y / (1L << (num_levels - r))) / (double) precinct_size[r].y)
-            );
+            const Size &shift = precinct_shifts[r];
+            const Size &divisor = precinct_divisors[r];
+            Size res(CeilShift(point.x, shift.x), CeilShift(point.y, shift.y));
+
+            if (divisor.x != 1) res.x = CeilDiv(res.x, divisor.x);
+            if (divisor.y != 1) res.y = CeilDiv(res.y, divisor.y);
+            return res;
+        }
+
+        /**
+         * Returns the number of precincts of a resolution
+         * level, in both dimensions.
+         * @param r Resolution level.
+         */
+        const Size &GetNumPrecincts(int r) const {
+            return num_precincts[r];
+        }
+
+        /**
+         * Returns the number of precinct data-bins of a resolution
+         * level and the lower ones, that is, the first data-bin
+         * identifier of the next resolution level.
+         * @param r Resolution level.
+         */
+        int GetNumPrecinctDataBins(int r) const {
+            return total_precincts[r + 1] * num_components;
+        }
+
+        /**
+         * Returns the image size of a resolution level.
+         * @param r Resolution level.
+         */
+        const Size &GetResolutionSize(int r) const {
+            return resolution_sizes[r];
+        }
+
+        /**
+         * Returns <code>true</code> if the progression order
+         * is supported.
+         */
+        bool IsProgressionSupported() const {
+            return progression >= LRCP_PROGRESSION && progression <= CPRL_PROGRESSION;
         }
 
         /**
@@ -166,19 +280,44 @@ namespace jpeg2000 {
          * @param packet Packet information.
          */
         int GetProgressionIndex(const Packet &packet) const {
-            //if (total_precincts.empty())
-            //    FillTotalPrecinctsVector();
-            switch (progression) {
-                case LRCP_PROGRESSION:
-                    return GetProgressionIndexLRCP(packet.layer, packet.resolution, packet.component, packet.precinct_xy.x, packet.precinct_xy.y);
-                case RLCP_PROGRESSION:
-                    return GetProgressionIndexRLCP(packet.layer, packet.resolution, packet.component, packet.precinct_xy.x, packet.precinct_xy.y);
-                case RPCL_PROGRESSION:
-                    return GetProgressionIndexRPCL(packet.layer, packet.resolution, packet.component, packet.precinct_xy.x, packet.precinct_xy.y);
-                default:
-                    ERROR("Progression (" << progression << ") not supported");
-            }
-            return 0;
+            assert(progression_table != NULL);
+
+            if (!progression_table->indexes.empty())
+                return progression_table->indexes[GetPrecinctDataBinId(packet) * num_layers + packet.layer];
+
+            int r = packet.resolution;
+            int nc = num_components, nl = num_layers;
+            int pp = num_precincts[r].x * num_precincts[r].y;
+            int p = (num_precincts[r].x * packet.precinct_xy.y) + packet.precinct_xy.x;
+
+            if (progression == LRCP_PROGRESSION)
+                return (packet.layer * total_precincts[num_levels + 1] * nc) + (total_precincts[r] * nc) +
+                       (packet.component * pp) + p;
+            else if (progression == RLCP_PROGRESSION)
+                return (total_precincts[r] * nc * nl) + (packet.layer * nc * pp) + (packet.component * pp) + p;
+            else
+                return (total_precincts[r] * nc * nl) + (p * nc * nl) + (packet.component * nl) + packet.layer;
+        }
+
+        /**
+         * Returns the memory used by the lookup tables of the
+         * progression order, in bytes.
+         */
+        uint64_t GetProgressionTableMemoryUsage() const {
+            if (progression_table == NULL) return 0;
+            else return sizeof(ProgressionTable) + (progression_table->indexes.capacity() +
+                                                    progression_table->last_indexes.capacity()) * sizeof(int);
+        }
+
+        /**
+         * Returns the last progression index of the packets of
+         * a resolution level and the lower ones. The packet index
+         * must be built until this index to contain all of them.
+         * @param r Resolution level.
+         */
+        int GetLastProgressionIndex(int r) const {
+            assert(progression_table != NULL);
+            return progression_table->last_indexes[r];
         }
 
         /**
@@ -187,10 +326,7 @@ namespace jpeg2000 {
          * @param packet Packet information.
          */
         int GetPrecinctDataBinId(const Packet &packet) const {
-            //if (total_precincts.empty())
-            //    FillTotalPrecinctsVector();
-            Size precinct_point = GetPrecincts(packet.resolution, size);
-            int s = total_precincts[packet.resolution] + (precinct_point.x * packet.precinct_xy.y) +
+            int s = total_precincts[packet.resolution] + (num_precincts[packet.resolution].x * packet.precinct_xy.y) +
                     packet.precinct_xy.x;
             return (packet.component + (s * num_components));
         }
@@ -1,37 +1,171 @@
 #include "file_manager.h"
 
-#include <glib.h>
-
 namespace jpeg2000 {
 
     using namespace std;
     using namespace data;
 
+    /**
+     * Returns the value of a hexadecimal digit, or -1.
+     */
+    static int HexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    /**
+     * Decodes the escaped characters (%xx) of an URL.
+     * @param url URL to decode.
+     * @param res Receives the decoded URL.
+     * @return <code>false</code> if an escaped character is not
+     * valid or it is a null character.
+     */
+    static bool UnescapeUrl(const string &url, string *res) {
+        int high, low;
+
+        res->clear();
+        for (size_t i = 0; i < url.size(); ++i) {
+            if (url[i] != '%') res->push_back(url[i]);
+            else if (i + 2 >= url.size() || (high = HexValue(url[i + 1])) < 0 || (low = HexValue(url[i + 2])) < 0 ||
+                     (high == 0 && low == 0)) return false;
+            else {
+                res->push_back((char) ((high << 4) | low));
+                i += 2;
+            }
+        }
+
+        return true;
+    }
+
     bool FileManager::OpenImage(string &path_image_file) {
         if (path_image_file[0] == '/') path_image_file = path_image_file.substr(1, path_image_file.size() - 1);
         path_image_file = root_dir_ + path_image_file;
 
+        image = OpenIndex(path_image_file);
+        return image != NULL;
+    }
+
+    ImageIndex::Ptr FileManager::OpenIndex(const string &path_name) {
+        struct stat file_stat;
+        if (stat(path_name.c_str(), &file_stat) != 0) {
+            ERROR("The image file '" << path_name << "' can not be read");
+            return ImageIndex::Ptr();
+        }
+
+        ImageIndex::Ptr index;
+        if (index_manager != NULL) {
+            index = index_manager->Get(path_name, file_stat);
+            if (index != NULL) return index;
+        }
+
+        index = ReadIndex(path_name, file_stat);
+        if (index != NULL) index->UpdateMemoryUsage();
+
+        if (index_manager != NULL) {
+            if (index == NULL) index_manager->Cancel(path_name);
+            else index = index_manager->Add(path_name, file_stat, index);
+        }
+
+        return index;
+    }
+
+    ImageIndex::Ptr FileManager::ReadIndex(const string &path_name, const struct stat &file_stat) {
+        string index_file_name = GetIndexFileName(path_name);
+
+        if (!index_file_name.empty()) {
+            ImageIndex::Ptr index = ImageIndex::Ptr(new ImageIndex());
+            if (IndexFile::Load(index_file_name, path_name, file_stat, index.get())) {
+                TRACE("The index of the image file '" << path_name << "' has been loaded from '" << index_file_name << "'");
+                return index;
+            }
+        }
+
         // Get image info
         ImageInfo image_info;
-        if (!ReadImage(path_image_file, &image_info)) {
-            ERROR("The image file '" << path_image_file << "' can not be read");
-            return false;
+        if (!ReadImage(path_name, &image_info)) {
+            ERROR("The image file '" << path_name << "' can not be read");
+            return ImageIndex::Ptr();
         }
-        coding_parameters = image_info.coding_parameters;
 
-        image = ImageIndex::Ptr(new ImageIndex());
-        image->Init(path_image_file, image_info);
+        ImageIndex::Ptr index = ImageIndex::Ptr(new ImageIndex());
+        index->Init(path_name, image_info);
 
-        // Repeat the process with the image hyperlinks
         if (!image_info.paths.empty()) {
-            image->hyper_links.resize(image_info.paths.size());
+            // Repeat the process with the image hyperlinks
+            index->hyper_links.resize(image_info.paths.size());
             for (multimap<string, int>::const_iterator i = image_info.paths.begin(); i != image_info.paths.end(); ++i) {
-                ImageIndex::Ptr linked = ImageIndex::Ptr(new ImageIndex());
-                linked->Init(i->first, image_info, i->second);
-                image->hyper_links[i->second] = linked;
+                ImageIndex::Ptr linked = OpenIndex(i->first);
+                if (linked == NULL)
+                    return ImageIndex::Ptr();
+
+                index->coding_parameters = linked->coding_parameters;
+                index->hyper_links[i->second] = linked;
+            }
+
+        } else if (!index_file_name.empty()) {
+            // The complete index is built for the index file, in the
+            // background if possible, so that the index is built
+            // incrementally meanwhile
+            if (index_writer != NULL && index_writer->Add(index, index_file_name, file_stat)) {
+                TRACE("The index file of the image file '" << path_name << "' has been queued");
+            } else if (!index->BuildIndex(*this)) {
+                ERROR("The packet index of the image file '" << path_name << "' could not be created");
+            } else if (IndexFile::Save(index_file_name, file_stat, *index)) {
+                TRACE("The index of the image file '" << path_name << "' has been saved into '" << index_file_name << "'");
+
+                for (size_t i = 0; i < index->codestreams.size(); ++i) {
+                    const vector<FileSegment> &plt = index->codestreams[i].PLT_markers;
+                    for (size_t j = 0; j < plt.size(); ++j)
+                        plt_bytes += plt[j].length;
+                }
             }
         }
-        return true;
+
+        return index;
+    }
+
+    bool FileManager::UpdateIndexFile(const string &path_name, uint64_t *plt_bytes) {
+        *plt_bytes = 0;
+        this->plt_bytes = 0;
+
+        string index_file_name = GetIndexFileName(path_name);
+        if (index_file_name.empty())
+            return false;
+
+        struct stat file_stat;
+        if (stat(path_name.c_str(), &file_stat) != 0) {
+            ERROR("The image file '" << path_name << "' can not be read");
+            return false;
+        }
+
+        if (IndexFile::IsUpToDate(index_file_name, path_name, file_stat))
+            return true;
+
+        ImageIndex::Ptr index = ReadIndex(path_name, file_stat);
+        if (index == NULL)
+            return false;
+
+        // Only the images whose index file has been written are counted
+        *plt_bytes = this->plt_bytes;
+
+        return !index->hyper_links.empty() || IndexFile::IsUpToDate(index_file_name, path_name, file_stat);
+    }
+
+    string FileManager::GetIndexFileName(const string &path_name) const {
+        if (cache_dir_.empty())
+            return string();
+
+        // The escaping keeps the names of different paths different
+        string file_name;
+        for (size_t i = 0; i < path_name.size(); ++i) {
+            if (path_name[i] == '/') file_name += "%2F";
+            else if (path_name[i] == '%') file_name += "%25";
+            else file_name += path_name[i];
+        }
+
+        return cache_dir_ + file_name + ".jpipidx";
     }
 
 #define EOC_MARKER 0xFFD9
@@ -65,20 +199,20 @@ namespace jpeg2000 {
                 ERROR("Unable to open file: '" << name_image_file << "'...");
                 return false;
             }
-            res = res && ReadJP2(file, image_info);
+            res = res && file->Seek(0) && ReadJP2(file, image_info);
         } else if (extension == ".jpx") { // JPX image
             File::Ptr file = GetFile(name_image_file);
             if (file == NULL) {
                 ERROR("Unable to open file: '" << name_image_file << "'...");
                 return false;
             }
-            res = res && ReadJPX(file, image_info);
+            res = res && file->Seek(0) && ReadJPX(file, image_info);
         } else {
             ERROR("File type not supported...");
             return false;
         }
 
-        if (res)
+        if (res && image_info->paths.empty())
             image_info->coding_parameters.FillTotalPrecinctsVector();
 
         return res;
@@ -152,12 +286,24 @@ namespace jpeg2000 {
         uint32_t tiling[4];
         for (int i = 0; i < 4; ++i)
             res = res && file->ReadReverse(&tiling[i]);
+        // Only one tile is supported, so the tile origin is
+        // the origin of the image area
+        params->origin = Size(max(FE[2], tiling[2]), max(FE[3], tiling[3]));
         // Get number of components
         uint16_t num_components = 0;
         res = res && file->ReadReverse(&num_components);
         params->num_components = num_components;
-        // To jump to the end of the marker
-        res = res && file->Seek(3 * num_components, SEEK_CUR);
+        // Get the subsampling of each component, jumping Ssiz
+        uint8_t XRsiz = 0, YRsiz = 0;
+        params->subsampling.clear();
+        for (int i = 0; res && i < num_components; ++i) {
+            res = file->Seek(1, SEEK_CUR) && file->ReadReverse(&XRsiz) && file->ReadReverse(&YRsiz);
+            if (res && (XRsiz == 0 || YRsiz == 0)) {
+                ERROR("The subsampling of the component " << i << " is not valid");
+                return false;
+            }
+            params->subsampling.emplace_back(XRsiz, YRsiz);
+        }
 
         return res;
     }
@@ -171,6 +317,10 @@ namespace jpeg2000 {
         uint8_t progression = 0;
         res = res && file->ReadReverse(&progression);
         params->progression = progression;
+        if (res && !params->IsProgressionSupported()) {
+            ERROR("Progression (" << (int) progression << ") not supported");
+            return false;
+        }
         // Get number of quality layers
         uint16_t quality_layers = 0;
         // To jump MC
@@ -181,6 +331,10 @@ namespace jpeg2000 {
         // To jump 4 bytes (ECB2,ECB1,MS,WT)
         res = res && file->ReadReverse(&transform_levels) && file->Seek(4, SEEK_CUR);
         params->num_levels = transform_levels;
+        if (res && params->num_levels > CodingParameters::MAX_LEVELS) {
+            ERROR("Number of decomposition levels (" << params->num_levels << ") not supported");
+            return false;
+        }
         // Get precint sizes for each resolution
         int height, width;
         uint8_t size_precinct;
@@ -266,7 +420,7 @@ namespace jpeg2000 {
         // Get boxes
         uint32_t type_box;
         uint64_t length_box;
-        int pini = 0, plen = 0, pini_box = 0, plen_box = 0;
+        uint64_t pini = 0, plen = 0, pini_box = 0, plen_box = 0;
         //int metadata_bin=1;
 
         image_info->codestreams.emplace_back();
@@ -312,9 +466,10 @@ namespace jpeg2000 {
         uint16_t data_reference;
         vector<uint16_t> v_data_reference;
         vector<string> v_path_file;
-        int pini = 0, plen = 0, pini_box = 0, plen_box = 0;
+        uint64_t pini = 0, plen = 0, pini_box = 0, plen_box = 0;
         //int metadata_bin=1;
-        int num_flst = 0, pini_ftbl = 0, plen_ftbl = 0;
+        int num_flst = 0;
+        uint64_t pini_ftbl = 0, plen_ftbl = 0;
 
         while (file->GetOffset() != file->GetSize() && res) {
             pini_box = file->GetOffset();
@@ -389,23 +544,6 @@ namespace jpeg2000 {
             image_info->paths.insert(pair<string, int>(v_path_file[i], i));
         }
 
-        if (!image_info->paths.empty()) {
-            image_info->codestreams.resize(image_info->paths.size());
-            image_info->coding_parameters_hyperlinks.resize(image_info->paths.size());
-            image_info->meta_data_hyperlinks.resize(image_info->paths.size());
-        }
-        // Get image info of the hyperlinked images
-        for (multimap<string, int>::const_iterator i = image_info->paths.begin(); i != image_info->paths.end() && res; ++i) {
-            ImageInfo image_info_hyperlink;
-            res = res && ReadImage(i->first, &image_info_hyperlink);
-            if (!res)
-                break;
-
-            image_info->coding_parameters = image_info_hyperlink.coding_parameters;
-            image_info->coding_parameters_hyperlinks[i->second] = image_info_hyperlink.coding_parameters;
-            image_info->codestreams[i->second] = image_info_hyperlink.codestreams.back();
-            image_info->meta_data_hyperlinks[i->second] = image_info_hyperlink.meta_data;
-        }
         return res;
     }
 
@@ -451,9 +589,10 @@ namespace jpeg2000 {
             if (pos != string::npos) local_path = local_path.substr(0, pos) + root_dir_ + local_path.substr(pos + 2);
 
             // undo possible URI character substitutions
-            char *unescaped = g_uri_unescape_string(local_path.c_str(), NULL);
-            *path_file = unescaped;
-            g_free(unescaped);
+            if (!UnescapeUrl(local_path, path_file)) {
+                ERROR("The URL '" << path_char << "' is not valid");
+                res = false;
+            }
         }
 
         return res;
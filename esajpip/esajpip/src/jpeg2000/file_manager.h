@@ -2,6 +2,9 @@
 #define _JPEG2000_FILE_MANAGER_H_
 
 #include "image_index.h"
+#include "index_file.h"
+#include "index_manager.h"
+#include "index_writer.h"
 
 namespace jpeg2000 {
 
@@ -12,9 +15,12 @@ namespace jpeg2000 {
     class FileManager {
     private:
         string root_dir_;    ///< Root directory of the repository
+        string cache_dir_;   ///< Directory of the index files
+        IndexManager *index_manager;    ///< Shared image indexes
+        IndexWriter *index_writer;      ///< Writer of the index files
+        uint64_t plt_bytes;             ///< Bytes of PLT markers parsed to write index files
 
-        ImageIndex::Ptr image;
-        CodingParameters coding_parameters; ///< Image coding parameters
+        ImageIndex::Ptr image;  ///< Current image
 
         map<const string, File::Ptr> file_map;
 
@@ -128,19 +134,69 @@ namespace jpeg2000 {
          */
         bool ReadImage(const string &name_image_file, ImageInfo *image_info);
 
+        /**
+         * Returns the index of an image file. The index is taken
+         * from the index manager, if it is used, or from the index
+         * file of the image, if it exists and it is up to date.
+         * Otherwise the image file is read.
+         * @param path_name Path name of the image.
+         * @return The image index, or a null pointer if error.
+         */
+        ImageIndex::Ptr OpenIndex(const string &path_name);
+
+        /**
+         * Reads the index of an image file, from its index file or
+         * from the image file itself. In the last case, the index
+         * file is generated if the index files are used.
+         * @param path_name Path name of the image.
+         * @param file_stat Status of the image file.
+         * @return The image index, or a null pointer if error.
+         */
+        ImageIndex::Ptr ReadIndex(const string &path_name, const struct stat &file_stat);
+
+        /**
+         * Returns the name of the index file of an image, or an
+         * empty string if the index files are not used. The name
+         * is the full path of the image, replacing each '/' by "%2F"
+         * and each '%' by "%25", within the directory of the index
+         * files.
+         * @param path_name Path name of the image.
+         */
+        string GetIndexFileName(const string &path_name) const;
+
     public:
         /**
          * Initializes the object.
          */
         FileManager() {
+            index_manager = NULL;
+            index_writer = NULL;
+            plt_bytes = 0;
         }
 
         /**
          * Initializes the object.
          * @param root_dir Root directory of the image repository.
+         * @param cache_dir Directory of the index files, or an empty
+         * string if the index files must not be used.
+         * @param index_manager Index manager shared with other
+         * threads, or <code>NULL</code> if the image indexes must
+         * not be shared.
+         * @param index_writer Writer of the index files in the
+         * background, or <code>NULL</code> if they must be written
+         * when the images are opened.
          * @return <code>true</code> if successful
          */
-        bool Init(const string &root_dir) {
+        bool Init(const string &root_dir, const string &cache_dir = "", IndexManager *index_manager = NULL,
+                  IndexWriter *index_writer = NULL) {
+            this->index_manager = index_manager;
+            this->index_writer = index_writer;
+
+            if (cache_dir.empty() || cache_dir.at(cache_dir.size() - 1) == '/')
+                cache_dir_ = cache_dir;
+            else
+                cache_dir_ = cache_dir + '/';
+
             if (root_dir.empty()) return false;
             else {
                 if (root_dir.at(root_dir.size() - 1) == '/')
@@ -162,15 +218,54 @@ namespace jpeg2000 {
             return image;
         }
 
+        /**
+         * Sets the current image, which must have been opened
+         * before by the object. It allows to switch between the
+         * images of several channels.
+         * @param image Image index.
+         */
+        void SetImage(const ImageIndex::Ptr &image) {
+            this->image = image;
+        }
+
         /**
          * Returns a pointer to the coding parameters.
          */
         const CodingParameters *GetCodingParameters() const {
-            return &coding_parameters;
+            return &image->coding_parameters;
         }
 
+        /**
+         * Opens an image of the repository. If an index manager is
+         * used and it already contains the index of the image, or
+         * the image has an up to date index file, the image file is
+         * not read again.
+         * @param path_image_file Path of the image relative to the
+         * root directory. Receives the complete path name.
+         * @return <code>true</code> if successful.
+         */
         bool OpenImage(string &path_image_file);
 
+        /**
+         * Generates the index file of an image, if it does not
+         * exist or it is out of date. The index files must be used.
+         * @param path_name Path name of the image.
+         * @param plt_bytes Receives the number of bytes of PLT
+         * markers parsed, only of the images whose index file was
+         * generated, so zero if the index files were up to date.
+         * @return <code>true</code> if successful.
+         */
+        bool UpdateIndexFile(const string &path_name, uint64_t *plt_bytes);
+
+        /**
+         * Notifies that the packet index of an image has been
+         * extended, so that the index manager, if any, accounts
+         * again the memory used by the shared indexes.
+         */
+        void IndexExtended() {
+            if (index_manager != NULL) index_manager->Update();
+        }
+
         File::Ptr GetFile(const string &path_file) {
             try {
                 return file_map.at(path_file);
@@ -1,3 +1,4 @@
+#include <climits>
 #include "trace.h"
 #include "file_manager.h"
 
@@ -19,59 +20,80 @@ namespace jpeg2000 {
                 last_offset_PLT.push_back(0);
                 last_offset_packet.push_back(0);
                 packet_indexes.emplace_back();
+                bin_offsets.emplace_back();
             }
         }
     }
 
-    void ImageIndex::Init(const string &path_name, const ImageInfo &image_info, int index) {
-        this->path_name = path_name;
-
-        meta_data = image_info.meta_data_hyperlinks[index];
-        coding_parameters = image_info.coding_parameters_hyperlinks[index];
-        codestreams.push_back(image_info.codestreams[index]);
-        max_resolution.push_back(-1);
-
-        last_plt.push_back(0);
-        last_packet.push_back(0);
-        last_offset_PLT.push_back(0);
-        last_offset_packet.push_back(0);
-        packet_indexes.emplace_back();
-    }
-
-    bool ImageIndex::BuildIndex(FileManager &file_manager, int ind_codestream, int r) {
+    bool ImageIndex::BuildIndex(FileManager &file_manager, int ind_codestream, int r, PacketIndex *packet_index) {
         File::Ptr file = file_manager.GetFile(path_name);
-        // Check if PacketIndex has been created
-        if (packet_indexes[ind_codestream].Size() == 0)
-            packet_indexes[ind_codestream] = PacketIndex(file->GetSize());
-
-        // Check the upper top of the index (to build)
-        int max_index;
-        const CodingParameters *coding_parameters = &this->coding_parameters;
-        if (r < coding_parameters->num_levels && coding_parameters->IsResolutionProgression()) {
-            // The max_index is the last packet index of the resolution r
-            Packet packet(0, r + 1, 0, Size(0, 0));
-            max_index = coding_parameters->GetProgressionIndex(packet) - 1;
-        } else {
-            // The max_index is the last packet of the image file
-            Size precinct_point =
-                    coding_parameters->GetPrecincts(coding_parameters->num_levels, coding_parameters->size) - 1;
-            Packet packet(coding_parameters->num_layers - 1, coding_parameters->num_levels,
-                          coding_parameters->num_components - 1, precinct_point);
-            max_index = coding_parameters->GetProgressionIndex(packet);
-        }
+
+        // The index is built until the last packet of the resolution r
+        int max_index = coding_parameters.GetLastProgressionIndex(min(r, coding_parameters.num_levels));
 
         uint64_t length_packet = 0;
         bool res = true;
-        while (res && packet_indexes[ind_codestream].Size() <= max_index) {
+        while (res && packet_index->Size() <= max_index) {
             res = GetPLTLength(file, ind_codestream, &length_packet);
             if (!res)
                 break;
-            res = GetOffsetPacket(file, ind_codestream, length_packet);
+            res = GetOffsetPacket(file, ind_codestream, length_packet, packet_index);
         }
 
+        packet_index->Compact();
+        return res;
+    }
+
+    bool ImageIndex::BuildIndex(FileManager &file_manager) {
+        bool res = true;
+
+        // The offsets of the packets are computed later, only
+        // for the resolution levels requested
+        for (size_t i = 0; res && i < codestreams.size(); ++i)
+            res = BuildIndex(file_manager, i, coding_parameters.num_levels, &packet_indexes[i]);
+
         return res;
     }
 
+    bool ImageIndex::BuildBinOffsets(int ind_codestream, int min_r, int max_r, const PacketIndex &packet_index, vector<uint32_t> *offsets) {
+        if (coding_parameters.HasConsecutiveLayers())
+            return true;
+
+        int num_layers = coding_parameters.num_layers;
+        offsets->resize(coding_parameters.GetNumPrecinctDataBins(max_r) * num_layers, 0);
+
+        for (int r = max(min_r, 0); r <= max_r; ++r) {
+            const Size &precincts = coding_parameters.GetNumPrecincts(r);
+
+            for (int c = 0; c < coding_parameters.num_components; ++c) {
+                for (int py = 0; py < precincts.y; ++py) {
+                    for (int px = 0; px < precincts.x; ++px) {
+                        Packet packet(0, r, c, Size(px, py));
+                        int bin = coding_parameters.GetPrecinctDataBinId(packet) * num_layers;
+                        uint64_t offset = 0;
+
+                        for (int l = 0; l < num_layers; ++l) {
+                            packet.layer = l;
+                            int idx = coding_parameters.GetProgressionIndex(packet);
+                            if (idx >= packet_index.Size())
+                                break;
+
+                            if (offset > INT_MAX) {
+                                ERROR("The data-bin of the precinct " << packet << " is larger than 2 GiB");
+                                return false;
+                            }
+
+                            (*offsets)[bin + l] = offset;
+                            offset += packet_index[idx].length;
+                        }
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+
     bool ImageIndex::GetPLTLength(File::Ptr &file, int ind_codestream, uint64_t *length_packet) {
         bool res = true;
         vector<FileSegment> &plt = codestreams[ind_codestream].PLT_markers;
@@ -104,7 +126,7 @@ namespace jpeg2000 {
         return res;
     }
 
-    bool ImageIndex::GetOffsetPacket(File::Ptr &file, int ind_codestream, uint64_t length_packet) {
+    bool ImageIndex::GetOffsetPacket(File::Ptr &file, int ind_codestream, uint64_t length_packet, PacketIndex *packet_index) {
         uint64_t offset;
         vector<FileSegment> &packets = codestreams[ind_codestream].packets;
         if (last_packet[ind_codestream] >= (int) packets.size())
@@ -113,7 +135,7 @@ namespace jpeg2000 {
         if (last_offset_packet[ind_codestream] == 0) offset = packets[last_packet[ind_codestream]].offset;
         else offset = last_offset_packet[ind_codestream];
 
-        packet_indexes[ind_codestream].Add(FileSegment(offset, length_packet));
+        packet_index->Add(FileSegment(offset, length_packet));
         last_offset_packet[ind_codestream] = offset + length_packet;
 
         if (last_offset_packet[ind_codestream] ==
@@ -124,50 +146,149 @@ namespace jpeg2000 {
         return true;
     }
 
-    bool ImageIndex::GetPacket(FileManager &file_manager, int num_codestream, const Packet &packet, FileSegment *segment, int *offset) {
-        bool linked = !hyper_links.empty();
-        if (linked) {
-            if (packet.resolution > hyper_links[num_codestream]->max_resolution.back()) {
-                if (!hyper_links[num_codestream]->BuildIndex(file_manager, 0, packet.resolution)) {
-                    ERROR("The packet index could not be created");
-                    return false;
-                }
-                hyper_links[num_codestream]->max_resolution.back() = packet.resolution;
+    bool ImageIndex::ExtendIndex(FileManager &file_manager, int num_codestream, int r, bool with_offsets) {
+        build_mutex.Wait();
+
+        // Another thread could have extended the index meanwhile. The
+        // packet index can be complete without the offsets, when it
+        // has been loaded from an index file
+        int max_index = coding_parameters.GetLastProgressionIndex(min(r, coding_parameters.num_levels));
+        bool extend_index = packet_indexes[num_codestream].Size() <= max_index;
+        bool extend_offsets = with_offsets && r > max_resolution[num_codestream];
+
+        bool res = true;
+        if (extend_index || extend_offsets) {
+            // The index is extended on a copy, so that the threads
+            // reading the lower resolutions are not blocked
+            PacketIndex packet_index;
+            vector<uint32_t> offsets;
+
+            if (extend_index) {
+                packet_index = packet_indexes[num_codestream];
+                res = BuildIndex(file_manager, num_codestream, r, &packet_index);
             }
-        } else {
-            if (packet.resolution > max_resolution[num_codestream]) {
-                if (!BuildIndex(file_manager, num_codestream, packet.resolution)) {
-                    ERROR("The packet index could not be created");
-                    return false;
-                }
-                max_resolution[num_codestream] = packet.resolution;
+
+            if (extend_offsets) {
+                offsets = bin_offsets[num_codestream];
+                res = res && BuildBinOffsets(num_codestream, max_resolution[num_codestream] + 1, r,
+                                             extend_index ? packet_index : packet_indexes[num_codestream], &offsets);
+            }
+
+            rdwr_lock.WaitForWriting();
+            if (extend_index) packet_indexes[num_codestream].Swap(packet_index);
+            if (extend_offsets && res) {
+                bin_offsets[num_codestream].swap(offsets);
+                max_resolution[num_codestream] = r;
             }
+            UpdateMemoryUsage();
+            rdwr_lock.Release();
         }
 
+        build_mutex.Release();
+
+        // The index has grown, so the shared indexes are accounted again
+        if (extend_index || extend_offsets) file_manager.IndexExtended();
+
+        return res;
+    }
+
+    bool ImageIndex::LockIndex(FileManager &file_manager, int num_codestream, int r) {
+        rdwr_lock.WaitForReading();
+
+        if (r > max_resolution[num_codestream]) {
+            rdwr_lock.Release();
+
+            if (!ExtendIndex(file_manager, num_codestream, r, true)) {
+                ERROR("The packet index could not be created");
+                return false;
+            }
+
+            rdwr_lock.WaitForReading();
+        }
+
+        return true;
+    }
+
+    bool ImageIndex::FindPacket(int num_codestream, const Packet &packet, FileSegment *segment, int *offset) {
         const CodingParameters *coding_parameters = GetCodingParameters(num_codestream);
         int idx = coding_parameters->GetProgressionIndex(packet);
-        PacketIndex &packet_index = linked ? hyper_links[num_codestream]->packet_indexes[0] : packet_indexes[num_codestream];
+        PacketIndex &packet_index = packet_indexes[num_codestream];
         if (!packet_index.Get(idx, segment)) {
             ERROR("Invalid packet index: codestream=" << num_codestream << ", index=" << idx << ", size=" << packet_index.Size() << ", packet=" << packet);
             return false;
         }
 
         if (offset != NULL) {
-            *offset = 0;
-
-            if (coding_parameters->progression == CodingParameters::RPCL_PROGRESSION) {
-                for (int l = packet.layer; l > 0; --l)
-                    *offset += packet_index[--idx].length;
-            } else {
-                Packet p_aux = packet;
-                for (int l = 0; l < packet.layer; ++l) {
-                    p_aux.layer = l;
-                    idx = coding_parameters->GetProgressionIndex(p_aux);
-                    *offset += packet_index[idx].length;
+            if (packet.layer == 0) *offset = 0;
+            else if (!coding_parameters->HasConsecutiveLayers())
+                *offset = bin_offsets[num_codestream][coding_parameters->GetPrecinctDataBinId(packet) * coding_parameters->num_layers + packet.layer];
+            else {
+                // The packets of the lower layers of the precinct are
+                // just before, and usually contiguous in the file
+                uint64_t length;
+                if (!packet_index.GetContiguousLength(idx - packet.layer, idx, &length)) {
+                    length = 0;
+                    for (int l = 1; l <= packet.layer; ++l)
+                        length += packet_index[idx - l].length;
                 }
+
+                if (length > INT_MAX) {
+                    ERROR("The data-bin of the precinct " << packet << " is larger than 2 GiB");
+                    return false;
+                }
+                *offset = length;
             }
         }
+
         return true;
     }
 
+    bool ImageIndex::GetPacket(FileManager &file_manager, int num_codestream, const Packet &packet, FileSegment *segment, int *offset) {
+        if (!hyper_links.empty())
+            return hyper_links[num_codestream]->GetPacket(file_manager, 0, packet, segment, offset);
+
+        if (!LockIndex(file_manager, num_codestream, packet.resolution))
+            return false;
+
+        bool res = FindPacket(num_codestream, packet, segment, offset);
+        rdwr_lock.Release();
+        return res;
+    }
+
+    bool ImageIndex::GetPackets(FileManager &file_manager, int num_codestream, const vector<Packet> &packets,
+                                vector<FileSegment> *segments, vector<int> *offsets) {
+        if (!hyper_links.empty())
+            return hyper_links[num_codestream]->GetPackets(file_manager, 0, packets, segments, offsets);
+
+        int max_r = 0;
+        for (size_t i = 0; i < packets.size(); ++i)
+            max_r = max(max_r, packets[i].resolution);
+
+        segments->resize(packets.size());
+        if (offsets != NULL) offsets->resize(packets.size());
+
+        if (!LockIndex(file_manager, num_codestream, max_r))
+            return false;
+
+        bool res = true;
+        for (size_t i = 0; res && i < packets.size(); ++i)
+            res = FindPacket(num_codestream, packets[i], &(*segments)[i], offsets != NULL ? &(*offsets)[i] : NULL);
+
+        rdwr_lock.Release();
+        return res;
+    }
+
+    void ImageIndex::UpdateMemoryUsage() {
+        uint64_t memory = sizeof(ImageIndex);
+
+        for (size_t i = 0; i < packet_indexes.size(); ++i)
+            memory += packet_indexes[i].GetMemoryUsage() + bin_offsets[i].capacity() * sizeof(uint32_t);
+        for (size_t i = 0; i < codestreams.size(); ++i)
+            memory += (codestreams[i].packets.capacity() + codestreams[i].PLT_markers.capacity()) * sizeof(FileSegment);
+        memory += hyper_links.capacity() * sizeof(Ptr);
+        memory += coding_parameters.GetProgressionTableMemoryUsage();
+
+        memory_usage = memory;
+    }
+
 }
@@ -5,17 +5,34 @@
 #include "trace.h"
 
 #include <vector>
+#include <atomic>
 #include "image_info.h"
 #include "packet_index.h"
+#include "ipc/mutex.h"
+#include "ipc/rdwr_lock.h"
 
 namespace jpeg2000 {
     using namespace std;
 
     class FileManager;
 
+    class IndexFile;
+
+    /**
+     * Contains the indexing information of a JPEG2000 image file.
+     * The packet indexes are built incrementally, as the packets
+     * of higher resolutions are requested. An object of this class
+     * can be shared by several threads, since the access to the
+     * packet indexes is synchronized by a reader/writer lock.
+     *
+     * @see IndexManager
+     */
     class ImageIndex {
     private:
         friend class FileManager;
+        friend class IndexFile;
+        friend class IndexManager;
+        friend class IndexWriter;
 
         vector<int> last_plt;
         vector<int> last_packet;
@@ -25,13 +42,29 @@ namespace jpeg2000 {
         string path_name;           ///< Image file name
         Metadata meta_data;         ///< Image Metadata
         CodingParameters coding_parameters; ///< Coding parameters
-        vector<int> max_resolution; ///< Maximum resolution number
+        vector<int> max_resolution; ///< Maximum resolution number ready for reading
 
         vector<PacketIndex> packet_indexes;  ///< Code-stream packet index
+
+        /**
+         * Offsets of the packets within their precinct data-bins,
+         * for each codestream, indexed by the data-bin identifier
+         * and the quality layer. They are computed only until the
+         * resolution level <code>max_resolution</code>, and only for
+         * the progressions in which the layers of a precinct are
+         * not consecutive.
+         */
+        vector<vector<uint32_t>> bin_offsets;
+
         vector<CodestreamIndex> codestreams; ///< Image code-streams
 
         vector<shared_ptr<ImageIndex>> hyper_links; ///< Image hyperlinks
 
+        ipc::RdWrLock rdwr_lock;    ///< Lock for the packet indexes
+        ipc::Mutex build_mutex;     ///< Mutex for building the packet indexes
+
+        atomic<uint64_t> memory_usage;  ///< Memory used by the index, without the hyperlinks
+
         /**
          * Gets the packet lengths from a PLT marker.
          * @param file File where to read the data from.
@@ -46,17 +79,85 @@ namespace jpeg2000 {
          * @param file File where to read the data from.
          * @param ind_codestream Codestream index.
          * @param length_packet Packet length.
+         * @param packet_index Packet index to extend.
          * @return <code>true</code> if successful.
          */
-        bool GetOffsetPacket(File::Ptr &file, int ind_codestream, uint64_t length_packet);
+        bool GetOffsetPacket(File::Ptr &file, int ind_codestream, uint64_t length_packet, PacketIndex *packet_index);
 
         /**
          * Builds the required index for the required resolution levels.
+         * The mutex <code>build_mutex</code> must be held by the caller.
          * @param ind_codestream Codestream index.
          * @param max_index Maximum resolution level.
+         * @param packet_index Packet index to extend. It must be a copy
+         * of the current packet index of the codestream.
          * @return <code>true</code> if successful
          */
-        bool BuildIndex(FileManager &file_manager, int ind_codestream, int max_index);
+        bool BuildIndex(FileManager &file_manager, int ind_codestream, int max_index, PacketIndex *packet_index);
+
+        /**
+         * Computes the offsets of the packets of some resolution
+         * levels within their precinct data-bins. It does nothing
+         * if the layers of a precinct are consecutive. The offsets
+         * are sent as <code>int</code> values, so a data-bin can
+         * not be larger than 2 GiB. As the data-bins are ordered by
+         * resolution level, the offsets only cover the resolution
+         * levels requested.
+         * @param ind_codestream Codestream index.
+         * @param min_r First resolution level.
+         * @param max_r Last resolution level.
+         * @param packet_index Packet index of the codestream, built
+         * at least until the resolution level <code>max_r</code>.
+         * @param offsets Offsets to extend.
+         * @return <code>false</code> if an offset is too large.
+         */
+        bool BuildBinOffsets(int ind_codestream, int min_r, int max_r, const PacketIndex &packet_index, vector<uint32_t> *offsets);
+
+        /**
+         * Extends the packet index of a codestream until the given
+         * resolution level, if it does not reach it yet, and the
+         * offsets of the packets within their data-bins if it is
+         * requested. The lock of the packet indexes must not be
+         * held by the caller.
+         * @param num_codestream Codestream number.
+         * @param r Resolution level.
+         * @param with_offsets <code>true</code> if the offsets of
+         * the packets must be also extended.
+         * @return <code>true</code> if successful.
+         */
+        bool ExtendIndex(FileManager &file_manager, int num_codestream, int r, bool with_offsets);
+
+        /**
+         * Acquires the lock of the packet indexes for reading,
+         * building before the index of a codestream until the
+         * given resolution level if it is necessary. The lock is
+         * not held if the index can not be built.
+         * @param num_codestream Codestream number.
+         * @param r Resolution level.
+         * @return <code>true</code> if successful.
+         */
+        bool LockIndex(FileManager &file_manager, int num_codestream, int r);
+
+        /**
+         * Returns the file segment of a packet from the index of
+         * its codestream. The lock of the packet indexes must be
+         * held for reading by the caller. It fails if the offset
+         * of the packet in its data-bin is larger than 2 GiB.
+         * @param num_codestream Codestream number.
+         * @param packet Packet information.
+         * @param offset If it is not <code>NULL</code> receives the
+         * offset of the packet.
+         * @return <code>true</code> if successful.
+         */
+        bool FindPacket(int num_codestream, const Packet &packet, FileSegment *segment, int *offset);
+
+        /**
+         * Computes again the memory used by the index, without the
+         * indexes of the hyperlinks. The caller must hold the lock
+         * of the packet indexes, or the object must not be shared
+         * yet by other threads.
+         */
+        void UpdateMemoryUsage();
 
         /**
          * Initializes the object.
@@ -66,18 +167,19 @@ namespace jpeg2000 {
         void Init(const string &path_name, const ImageInfo &image_info);
 
         /**
-         * Initializes the object.
-         * @param path_name Path name of the image.
-         * @param image_info Indexing image information.
-         * @param index Image index.
+         * Builds the complete packet index of all the codestreams.
+         * The object must not be shared yet by other threads.
+         * @param file_manager File manager.
+         * @return <code>true</code> if successful
          */
-        void Init(const string &path_name, const ImageInfo &image_info, int index);
+        bool BuildIndex(FileManager &file_manager);
 
         /**
-         * Empty constructor. Only the index manager can
+         * Empty constructor. Only the file manager can
          * use this constructor.
          */
         ImageIndex() {
+            memory_usage = 0;
         }
 
     public:
@@ -154,6 +256,29 @@ namespace jpeg2000 {
          */
         bool GetPacket(FileManager &file_manager, int num_codestream, const Packet &packet, FileSegment *segment, int *offset = NULL);
 
+        /**
+         * Returns the file segments of several packets of a
+         * codestream at once, acquiring the lock of the packet
+         * indexes only once.
+         * @param num_codestream Codestream number.
+         * @param packets Packets information.
+         * @param segments Receives the file segments.
+         * @param offsets If it is not <code>NULL</code> receives the
+         * offsets of the packets.
+         * @return <code>true</code> if successful.
+         */
+        bool GetPackets(FileManager &file_manager, int num_codestream, const vector<Packet> &packets,
+                        vector<FileSegment> *segments, vector<int> *offsets = NULL);
+
+        /**
+         * Returns the number of bytes of memory allocated by the
+         * index, not including the indexes of the hyperlinks, as
+         * they are accounted separately.
+         */
+        uint64_t GetMemoryUsage() const {
+            return memory_usage;
+        }
+
         friend ostream &operator<<(ostream &out, const ImageIndex &info_node) {
             out << "Image file name: " << info_node.path_name << endl
                 << "Max resolution: ";
@@ -22,8 +22,6 @@ namespace jpeg2000 {
         multimap<string, int> paths;            ///< Paths of the hyperlinks (if any)
         CodingParameters coding_parameters;        ///< Coding parameters
         vector<CodestreamIndex> codestreams;    ///< Codestreams information
-        vector<CodingParameters> coding_parameters_hyperlinks; ///< Coding parameters of the hyperlinks
-        vector<Metadata> meta_data_hyperlinks;    ///< Meta-data of the hyperlinks
 
         /**
          * Empty constructor.
@@ -46,8 +44,6 @@ namespace jpeg2000 {
             paths = info.paths;
             coding_parameters = info.coding_parameters;
             codestreams = info.codestreams;
-            coding_parameters_hyperlinks = info.coding_parameters_hyperlinks;
-            meta_data_hyperlinks = info.meta_data_hyperlinks;
             return *this;
         }
 
@@ -59,8 +55,7 @@ namespace jpeg2000 {
                 for (multimap<string, int>::const_iterator i = info.paths.begin(); i != info.paths.end(); ++i) {
                     out << "Codestream index " << (*i).second + 1 << ":" << endl;
                     out << "------------------------" << endl;
-                    out << "Path: " << (*i).first << endl;
-                    out << info.codestreams[(*i).second] << endl << endl;
+                    out << "Path: " << (*i).first << endl << endl;
                 }
             } else {
                 int ind = 0;
@@ -71,9 +66,6 @@ namespace jpeg2000 {
             }
             out << endl << "Meta-data: ";
             out << info.meta_data << endl << endl;
-            out << endl << "Meta-data-hyperlinks: ";
-            for (size_t i = 0; i < info.meta_data_hyperlinks.size(); ++i)
-                out << info.meta_data_hyperlinks[i] << " ";
 
             return out;
         }
@@ -0,0 +1,308 @@
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include "trace.h"
+#include "index_file.h"
+
+namespace jpeg2000 {
+
+    const char IndexFile::MAGIC[8] = {'J', 'P', 'I', 'P', 'I', 'D', 'X', '\0'};
+
+    template<typename T>
+    static void Put(string &buf, T value) {
+        buf.append((const char *) &value, sizeof(T));
+    }
+
+    static void Put(string &buf, const FileSegment &segment) {
+        Put<uint64_t>(buf, segment.offset);
+        Put<uint64_t>(buf, segment.length);
+    }
+
+    static void Put(string &buf, const Size &size) {
+        Put<int32_t>(buf, size.x);
+        Put<int32_t>(buf, size.y);
+    }
+
+    static void Put(string &buf, const PlaceHolder &place_holder) {
+        Put<int32_t>(buf, place_holder.id);
+        Put<int32_t>(buf, place_holder.is_jp2c ? 1 : 0);
+        Put(buf, place_holder.header);
+        Put<uint64_t>(buf, place_holder.data_length);
+    }
+
+    template<typename T>
+    static void PutVector(string &buf, const vector<T> &items) {
+        Put<uint64_t>(buf, items.size());
+        for (size_t i = 0; i < items.size(); ++i)
+            Put(buf, items[i]);
+    }
+
+    template<typename T>
+    static void PutArray(string &buf, const vector<T> &items) {
+        Put<uint64_t>(buf, items.size());
+        if (!items.empty())
+            buf.append((const char *) &items[0], items.size() * sizeof(T));
+    }
+
+    template<typename T>
+    static bool Get(File &file, T *value) {
+        return file.Read(value);
+    }
+
+    static bool Get(File &file, FileSegment *segment) {
+        return file.Read(&segment->offset) && file.Read(&segment->length);
+    }
+
+    static bool Get(File &file, Size *size) {
+        int32_t x = 0, y = 0;
+        bool res = file.Read(&x) && file.Read(&y);
+        *size = Size(x, y);
+        return res;
+    }
+
+    static bool Get(File &file, PlaceHolder *place_holder) {
+        int32_t id = 0, is_jp2c = 0;
+        bool res = file.Read(&id) && file.Read(&is_jp2c) &&
+                   Get(file, &place_holder->header) && file.Read(&place_holder->data_length);
+        place_holder->id = id;
+        place_holder->is_jp2c = (is_jp2c != 0);
+        return res;
+    }
+
+    /**
+     * Reads the number of items of a vector, checking that the
+     * rest of the file can contain them.
+     */
+    static bool GetVectorSize(File &file, size_t item_size, uint64_t *size) {
+        return file.Read(size) && *size <= (file.GetSize() - file.GetOffset()) / item_size;
+    }
+
+    template<typename T>
+    static bool GetVector(File &file, size_t item_size, vector<T> *items) {
+        uint64_t size;
+        if (!GetVectorSize(file, item_size, &size))
+            return false;
+
+        items->resize(size);
+        for (size_t i = 0; i < items->size(); ++i)
+            if (!Get(file, &(*items)[i])) return false;
+        return true;
+    }
+
+    template<typename T>
+    static bool GetArray(File &file, vector<T> *items) {
+        uint64_t size;
+        if (!GetVectorSize(file, sizeof(T), &size) || size > INT_MAX / sizeof(T))
+            return false;
+
+        items->resize(size);
+        return size == 0 || file.Read(&(*items)[0], size * sizeof(T));
+    }
+
+    void IndexFile::PutPacketIndex(string &buf, const PacketIndex &index) {
+        Put<int32_t>(buf, index.size);
+        Put<uint64_t>(buf, index.last_end);
+        PutArray(buf, index.blocks);
+        PutArray(buf, index.data);
+        PutArray(buf, index.tail);
+        PutArray(buf, index.gaps);
+        PutArray(buf, index.gap_ends);
+    }
+
+    bool IndexFile::GetPacketIndex(File &file, PacketIndex *index) {
+        int32_t size = 0;
+        bool res = file.Read(&size) && file.Read(&index->last_end) &&
+                   GetArray(file, &index->blocks) && GetArray(file, &index->data) &&
+                   GetArray(file, &index->tail) && GetArray(file, &index->gaps) &&
+                   GetArray(file, &index->gap_ends);
+        index->size = size;
+        return res && index->IsValid();
+    }
+
+    bool IndexFile::ReadHeader(File &file, const string &file_name, const string &path_name, const struct stat &image_stat) {
+        char magic[sizeof(MAGIC)];
+        uint32_t version = 0, byte_order = 0, path_length = 0;
+        uint64_t image_size = 0, file_size = 0;
+        int64_t image_mtime = 0;
+
+        bool res = file.Read(magic, sizeof(magic)) && file.Read(&version) && file.Read(&byte_order) &&
+                   file.Read(&image_size) && file.Read(&image_mtime) && file.Read(&file_size) &&
+                   file.Read(&path_length) && path_length <= file.GetSize() - file.GetOffset();
+
+        if (!res || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || version != FORMAT_VERSION ||
+            byte_order != BYTE_ORDER_MARK || file_size != file.GetSize()) {
+            LOG("The index file '" << file_name << "' is not valid");
+            return false;
+        }
+
+        string image_path(path_length, 0);
+        if (path_length > 0 && !file.Read(&image_path[0], path_length)) {
+            LOG("The index file '" << file_name << "' is not valid");
+            return false;
+        }
+
+        if (image_path != path_name) {
+            LOG("The index file '" << file_name << "' belongs to another image: '" << image_path << "'");
+            return false;
+        }
+
+        if (image_size != (uint64_t) image_stat.st_size || image_mtime != (int64_t) image_stat.st_mtime) {
+            TRACE("The index file '" << file_name << "' is stale");
+            return false;
+        }
+
+        return true;
+    }
+
+    bool IndexFile::IsUpToDate(const string &file_name, const string &path_name, const struct stat &image_stat) {
+        struct stat file_stat;
+        if (stat(file_name.c_str(), &file_stat) != 0)
+            return false;
+
+        File file;
+        return file.Open(file_name) && ReadHeader(file, file_name, path_name, image_stat);
+    }
+
+    bool IndexFile::Load(const string &file_name, const string &path_name, const struct stat &image_stat, ImageIndex *image) {
+        struct stat file_stat;
+        if (stat(file_name.c_str(), &file_stat) != 0)
+            return false;
+
+        File file;
+        if (!file.Open(file_name) || !ReadHeader(file, file_name, path_name, image_stat))
+            return false;
+
+        ImageInfo image_info;
+        CodingParameters &params = image_info.coding_parameters;
+        int32_t num_levels = 0, num_layers = 0, progression = 0, num_components = 0;
+
+        bool res = Get(file, &params.size) && Get(file, &params.origin) && file.Read(&num_levels) &&
+                   file.Read(&num_layers) && file.Read(&progression) && file.Read(&num_components) &&
+                   GetVector(file, 8, &params.precinct_size) && GetVector(file, 8, &params.subsampling) &&
+                   GetVector(file, 16, &image_info.meta_data.meta_data) &&
+                   GetVector(file, 32, &image_info.meta_data.place_holders);
+
+        params.num_levels = num_levels;
+        params.num_layers = num_layers;
+        params.progression = progression;
+        params.num_components = num_components;
+
+        res = res && num_levels >= 0 && num_levels <= CodingParameters::MAX_LEVELS && params.precinct_size.size() == (size_t) num_levels + 1 &&
+              num_layers > 0 && num_components > 0 && params.size.x > 0 && params.size.y > 0 &&
+              params.origin.x >= 0 && params.origin.y >= 0 &&
+              params.subsampling.size() == (size_t) num_components && params.IsProgressionSupported();
+
+        for (size_t i = 0; res && i < params.precinct_size.size(); ++i)
+            res = params.precinct_size[i].x > 0 && params.precinct_size[i].y > 0;
+
+        for (size_t i = 0; res && i < params.subsampling.size(); ++i)
+            res = params.subsampling[i].x > 0 && params.subsampling[i].y > 0;
+
+        uint64_t num_codestreams = 0;
+        res = res && GetVectorSize(file, 32, &num_codestreams) && num_codestreams > 0;
+
+        for (uint64_t i = 0; res && i < num_codestreams; ++i) {
+            image_info.codestreams.emplace_back();
+            CodestreamIndex &codestream = image_info.codestreams.back();
+
+            res = Get(file, &codestream.header) &&
+                  GetVector(file, 16, &codestream.packets) &&
+                  GetVector(file, 16, &codestream.PLT_markers);
+        }
+
+        if (!res) {
+            ERROR("The index file '" << file_name << "' is corrupted");
+            return false;
+        }
+
+        params.FillTotalPrecinctsVector();
+        image->Init(path_name, image_info);
+
+        // The offsets of the packets are computed later, only
+        // for the resolution levels requested
+        for (size_t i = 0; res && i < image->packet_indexes.size(); ++i)
+            res = GetPacketIndex(file, &image->packet_indexes[i]) &&
+                  image->packet_indexes[i].Size() > params.GetLastProgressionIndex(num_levels);
+
+        if (!res || file.GetOffset() != file.GetSize()) {
+            ERROR("The index file '" << file_name << "' is corrupted");
+            return false;
+        }
+
+        return true;
+    }
+
+    bool IndexFile::Save(const string &file_name, const struct stat &image_stat, const ImageIndex &image) {
+        const CodingParameters &params = image.coding_parameters;
+
+        for (size_t i = 0; i < image.packet_indexes.size(); ++i)
+            if (image.packet_indexes[i].Size() <= params.GetLastProgressionIndex(params.num_levels)) return false;
+
+        string buf;
+        buf.append(MAGIC, sizeof(MAGIC));
+        Put<uint32_t>(buf, FORMAT_VERSION);
+        Put<uint32_t>(buf, BYTE_ORDER_MARK);
+        Put<uint64_t>(buf, image_stat.st_size);
+        Put<int64_t>(buf, image_stat.st_mtime);
+        size_t file_size_pos = buf.size();
+        Put<uint64_t>(buf, 0);
+        Put<uint32_t>(buf, image.path_name.size());
+        buf.append(image.path_name);
+
+        Put(buf, params.size);
+        Put(buf, params.origin);
+        Put<int32_t>(buf, params.num_levels);
+        Put<int32_t>(buf, params.num_layers);
+        Put<int32_t>(buf, params.progression);
+        Put<int32_t>(buf, params.num_components);
+        PutVector(buf, params.precinct_size);
+        PutVector(buf, params.subsampling);
+        PutVector(buf, image.meta_data.meta_data);
+        PutVector(buf, image.meta_data.place_holders);
+
+        Put<uint64_t>(buf, image.codestreams.size());
+        for (size_t i = 0; i < image.codestreams.size(); ++i) {
+            Put(buf, image.codestreams[i].header);
+            PutVector(buf, image.codestreams[i].packets);
+            PutVector(buf, image.codestreams[i].PLT_markers);
+        }
+
+        for (size_t i = 0; i < image.packet_indexes.size(); ++i)
+            PutPacketIndex(buf, image.packet_indexes[i]);
+
+        uint64_t file_size = buf.size();
+        buf.replace(file_size_pos, sizeof(file_size), (const char *) &file_size, sizeof(file_size));
+
+        // The content is written into a temporary file of the
+        // same directory, and then it is renamed atomically
+        string temp_name = file_name + ".XXXXXX";
+        vector<char> temp_name_buf(temp_name.begin(), temp_name.end());
+        temp_name_buf.push_back(0);
+
+        int fd = mkstemp(&temp_name_buf[0]);
+        if (fd < 0) {
+            ERROR("The index file '" << file_name << "' can not be created: " << strerror(errno));
+            return false;
+        }
+        fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+        size_t written = 0;
+        while (written < buf.size()) {
+            ssize_t res = write(fd, buf.data() + written, buf.size() - written);
+            if (res < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            written += res;
+        }
+
+        if (close(fd) != 0 || written < buf.size() || rename(&temp_name_buf[0], file_name.c_str()) != 0) {
+            ERROR("The index file '" << file_name << "' can not be written: " << strerror(errno));
+            unlink(&temp_name_buf[0]);
+            return false;
+        }
+
+        return true;
+    }
+
+}
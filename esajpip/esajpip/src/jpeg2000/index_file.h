@@ -0,0 +1,115 @@
+#ifndef _JPEG2000_INDEX_FILE_H_
+#define _JPEG2000_INDEX_FILE_H_
+
+#include <string>
+#include <sys/stat.h>
+#include "image_index.h"
+
+namespace jpeg2000 {
+    using namespace std;
+
+    /**
+     * Reads and writes the ".jpipidx" index files, which store
+     * the complete indexing information of an image file: the
+     * coding parameters, the meta-data, the codestream indexes
+     * and the fully built packet index of each codestream. The
+     * index files allow to open an image without parsing it.
+     *
+     * An index file is a binary file, in the byte order of the
+     * machine, that starts with a header containing a magic
+     * string, the format version, a byte order mark, the size
+     * and modification time of the image file, the size of the
+     * index file itself, and the full path name of the image. An
+     * index file is only used if all these fields match, otherwise
+     * it must be generated again. The index files are written into
+     * a temporary file that is renamed afterwards, so a partially
+     * written index file is never read.
+     *
+     * The tables of the packet indexes are stored with the same
+     * layout they have in memory, so they are loaded with a single
+     * copy from the mapping of the file, without parsing them. They
+     * are not used in place from the mapping: the loaded indexes
+     * are then the same objects as the ones built from the image
+     * files, they are accounted by the index manager as any other
+     * index, and the mapping of the file is released after loading.
+     *
+     * Only the images without hyperlinks have an index file. The
+     * images with hyperlinks use the index files of the linked
+     * images.
+     *
+     * @see ImageIndex
+     */
+    class IndexFile {
+    private:
+        /**
+         * Reads and checks the header of an index file.
+         * @param file Index file, at the beginning.
+         * @param file_name Name of the index file.
+         * @param path_name Path name of the image.
+         * @param image_stat Current status of the image file.
+         * @return <code>true</code> if the index file is valid and
+         * up to date.
+         */
+        static bool ReadHeader(File &file, const string &file_name, const string &path_name, const struct stat &image_stat);
+
+        /**
+         * Appends a packet index to a buffer.
+         * @param buf Buffer with the content of the index file.
+         * @param index Packet index.
+         */
+        static void PutPacketIndex(string &buf, const PacketIndex &index);
+
+        /**
+         * Reads a packet index, checking its consistency.
+         * @param file Index file.
+         * @param index Packet index that receives the information.
+         * @return <code>true</code> if successful.
+         */
+        static bool GetPacketIndex(File &file, PacketIndex *index);
+
+    public:
+        enum {
+            FORMAT_VERSION = 7,         ///< Version of the format
+            BYTE_ORDER_MARK = 0x01020304    ///< Byte order mark
+        };
+
+        /**
+         * Magic string at the beginning of an index file.
+         */
+        static const char MAGIC[8];
+
+        /**
+         * Returns <code>true</code> if an index file exists, and it
+         * is valid and up to date. Only the header is read.
+         * @param file_name Name of the index file.
+         * @param path_name Path name of the image.
+         * @param image_stat Current status of the image file.
+         */
+        static bool IsUpToDate(const string &file_name, const string &path_name, const struct stat &image_stat);
+
+        /**
+         * Loads the index of an image from an index file.
+         * @param file_name Name of the index file.
+         * @param path_name Path name of the image.
+         * @param image_stat Current status of the image file.
+         * @param image Uninitialized image index that receives
+         * the information.
+         * @return <code>true</code> if successful, or
+         * <code>false</code> if the index file does not exist,
+         * is stale or is not valid.
+         */
+        static bool Load(const string &file_name, const string &path_name, const struct stat &image_stat, ImageIndex *image);
+
+        /**
+         * Saves the index of an image into an index file. The
+         * packet indexes of the image must be completely built.
+         * @param file_name Name of the index file.
+         * @param image_stat Status of the image file when it was read.
+         * @param image Image index.
+         * @return <code>true</code> if successful.
+         */
+        static bool Save(const string &file_name, const struct stat &image_stat, const ImageIndex &image);
+    };
+}
+
+#endif /* _JPEG2000_INDEX_FILE_H_ */
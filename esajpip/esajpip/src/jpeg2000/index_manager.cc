@@ -0,0 +1,125 @@
+#include "trace.h"
+#include "index_manager.h"
+
+namespace jpeg2000 {
+
+    IndexManager::Node::Node(const string &path_name, const struct stat &file_stat, const ImageIndex::Ptr &image) {
+        this->path_name = path_name;
+        this->device = file_stat.st_dev;
+        this->inode = file_stat.st_ino;
+        this->size = file_stat.st_size;
+        this->mtime = file_stat.st_mtime;
+        this->image = image;
+    }
+
+    bool IndexManager::Node::Matches(const struct stat &file_stat) const {
+        return device == file_stat.st_dev && inode == file_stat.st_ino &&
+               size == file_stat.st_size && mtime == file_stat.st_mtime;
+    }
+
+    list<IndexManager::Node>::iterator IndexManager::Find(const string &path_name) {
+        unordered_map<string, list<Node>::iterator>::iterator i = nodes_map.find(path_name);
+        return i == nodes_map.end() ? nodes.end() : i->second;
+    }
+
+    void IndexManager::Insert(const string &path_name, const struct stat &file_stat, const ImageIndex::Ptr &image) {
+        nodes.emplace_front(path_name, file_stat, image);
+        nodes_map[path_name] = nodes.begin();
+    }
+
+    list<IndexManager::Node>::iterator IndexManager::Erase(list<Node>::iterator i) {
+        nodes_map.erase(i->path_name);
+        return nodes.erase(i);
+    }
+
+    uint64_t IndexManager::GetMemoryUsage(const ImageIndex::Ptr &image, unordered_set<const ImageIndex *> *counted) {
+        if (!counted->insert(image.get()).second)
+            return 0;
+
+        uint64_t memory = image->GetMemoryUsage();
+        for (size_t i = 0; i < image->hyper_links.size(); ++i)
+            memory += GetMemoryUsage(image->hyper_links[i], counted);
+
+        return memory;
+    }
+
+    ImageIndex::Ptr IndexManager::Get(const string &path_name, const struct stat &file_stat) {
+        ImageIndex::Ptr image;
+
+        mutex.Wait();
+        for (;;) {
+            list<Node>::iterator i = Find(path_name);
+
+            if (i == nodes.end()) {
+                // The calling thread reads the image
+                Insert(path_name, file_stat, ImageIndex::Ptr());
+                break;
+            }
+
+            if (i->image == NULL) {
+                TRACE("Waiting for the image file '" << path_name << "' to be read");
+                opened.Wait(mutex);
+
+            } else if (!i->Matches(file_stat)) {
+                TRACE("The image file '" << path_name << "' has been modified");
+                Erase(i);
+
+            } else {
+                image = i->image;
+                nodes.splice(nodes.begin(), nodes, i);
+                break;
+            }
+        }
+        mutex.Release();
+
+        return image;
+    }
+
+    ImageIndex::Ptr IndexManager::Add(const string &path_name, const struct stat &file_stat, const ImageIndex::Ptr &image) {
+        ImageIndex::Ptr res = image;
+
+        mutex.Wait();
+        list<Node>::iterator i = Find(path_name);
+
+        if (i != nodes.end() && i->image != NULL && i->Matches(file_stat)) {
+            res = i->image;
+            nodes.splice(nodes.begin(), nodes, i);
+        } else {
+            if (i != nodes.end()) Erase(i);
+            Insert(path_name, file_stat, image);
+            Purge();
+        }
+        opened.Broadcast();
+        mutex.Release();
+
+        return res;
+    }
+
+    void IndexManager::Cancel(const string &path_name) {
+        mutex.Wait();
+        list<Node>::iterator i = Find(path_name);
+        if (i != nodes.end() && i->image == NULL) Erase(i);
+        opened.Broadcast();
+        mutex.Release();
+    }
+
+    void IndexManager::Purge() {
+        if (max_memory == 0) return;
+
+        uint64_t memory = 0;
+        unordered_set<const ImageIndex *> counted;
+        list<Node>::iterator i = nodes.begin();
+
+        while (i != nodes.end()) {
+            if (i->image != NULL && memory <= max_memory)
+                memory += GetMemoryUsage(i->image, &counted);
+
+            if (i->image == NULL || memory <= max_memory || i == nodes.begin()) ++i;
+            else {
+                TRACE("Removing the index of '" << i->path_name << "' from the list");
+                i = Erase(i);
+            }
+        }
+    }
+
+}
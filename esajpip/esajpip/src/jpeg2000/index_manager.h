@@ -0,0 +1,172 @@
+#ifndef _JPEG2000_INDEX_MANAGER_H_
+#define _JPEG2000_INDEX_MANAGER_H_
+
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/stat.h>
+#include "ipc/mutex.h"
+#include "ipc/condition.h"
+#include "image_index.h"
+
+namespace jpeg2000 {
+    using namespace std;
+
+    /**
+     * Manages the indexes of all the images opened by the client
+     * threads of the child process. The indexes are kept in a list
+     * ordered by the time of the last use, and they are shared by
+     * all the threads that open the same image file. Each image is
+     * identified by its path name together with the device, inode,
+     * size and modification time of the file, so a modified file is
+     * indexed again. When the memory used by the indexes exceeds
+     * the configured budget, the least recently used ones are removed
+     * from the list. The memory of each index is counted only once,
+     * even if it is also hyperlinked by other images of the list, and
+     * it is accounted again when an index is extended. An index removed
+     * from the list is not destroyed until the last thread using it
+     * releases its pointer.
+     *
+     * Only one thread reads a given image file at a time. The other
+     * threads that open the same image meanwhile wait for that one
+     * to finish, and then reuse its index.
+     *
+     * @see ImageIndex
+     */
+    class IndexManager {
+    private:
+        /**
+         * Contains the information of an image of the list.
+         */
+        struct Node {
+            string path_name;       ///< Path name of the image
+            dev_t device;           ///< Device of the image file
+            ino_t inode;            ///< Inode of the image file
+            off_t size;             ///< Size of the image file
+            time_t mtime;           ///< Modification time
+            ImageIndex::Ptr image;  ///< Image index, null while it is read
+
+            /**
+             * Initializes the node.
+             * @param path_name Path name of the image.
+             * @param file_stat Status of the image file.
+             * @param image Image index.
+             */
+            Node(const string &path_name, const struct stat &file_stat, const ImageIndex::Ptr &image);
+
+            /**
+             * Returns <code>true</code> if the node refers to the
+             * given file status.
+             */
+            bool Matches(const struct stat &file_stat) const;
+        };
+
+        ipc::Mutex mutex;       ///< Mutex for the list
+        ipc::Condition opened;  ///< Signaled when an image is read
+        list<Node> nodes;       ///< List of images, most recently used first
+        unordered_map<string, list<Node>::iterator> nodes_map;  ///< Nodes by path name
+        uint64_t max_memory;    ///< Maximum memory for the indexes
+
+        /**
+         * Returns the node of an image, or the end of the list.
+         * @param path_name Path name of the image.
+         */
+        list<Node>::iterator Find(const string &path_name);
+
+        /**
+         * Inserts a node at the beginning of the list.
+         * @param path_name Path name of the image.
+         * @param file_stat Status of the image file.
+         * @param image Image index.
+         */
+        void Insert(const string &path_name, const struct stat &file_stat, const ImageIndex::Ptr &image);
+
+        /**
+         * Removes a node of the list.
+         * @param i Node to remove.
+         * @return The next node of the list.
+         */
+        list<Node>::iterator Erase(list<Node>::iterator i);
+
+        /**
+         * Returns the memory used by an image index and its
+         * hyperlinks, not counting the indexes already counted.
+         * @param image Image index.
+         * @param counted Indexes already counted, to extend.
+         */
+        static uint64_t GetMemoryUsage(const ImageIndex::Ptr &image, unordered_set<const ImageIndex *> *counted);
+
+        /**
+         * Removes the least recently used images of the list until
+         * the memory of the remaining ones is within the budget. The
+         * first image of the list and the images that are being read
+         * are never removed. The mutex must be held by the caller.
+         */
+        void Purge();
+
+    public:
+        /**
+         * Initializes the object without any memory limit.
+         */
+        IndexManager() {
+            max_memory = 0;
+        }
+
+        /**
+         * Sets the maximum memory used by the indexes of the list.
+         * @param max_memory Memory budget in bytes (0 means no limit).
+         */
+        void Init(uint64_t max_memory) {
+            this->max_memory = max_memory;
+        }
+
+        /**
+         * Returns the index of an image file, if it is in the list
+         * and the file has not been modified. If another thread is
+         * reading the image, the calling thread waits for it. When a
+         * null pointer is returned, the calling thread becomes the
+         * one that reads the image, and it must call either
+         * <code>Add</code> or <code>Cancel</code> afterwards.
+         * @param path_name Path name of the image.
+         * @param file_stat Current status of the image file.
+         * @return The image index, or a null pointer.
+         */
+        ImageIndex::Ptr Get(const string &path_name, const struct stat &file_stat);
+
+        /**
+         * Adds the index of an image file to the list, and wakes up
+         * the threads waiting for it. If another thread added the
+         * same image in the meantime, that one is kept and returned.
+         * @param path_name Path name of the image.
+         * @param file_stat Status of the image file when it was read.
+         * @param image Image index.
+         * @return The image index to use.
+         */
+        ImageIndex::Ptr Add(const string &path_name, const struct stat &file_stat, const ImageIndex::Ptr &image);
+
+        /**
+         * Notifies that an image file, for which <code>Get</code>
+         * returned a null pointer, could not be read. One of the
+         * threads waiting for the image, if any, will try to read
+         * it again.
+         * @param path_name Path name of the image.
+         */
+        void Cancel(const string &path_name);
+
+        /**
+         * Accounts again the memory used by the indexes of the list,
+         * removing the least recently used ones if the budget is
+         * exceeded. It must be called when an index is extended.
+         */
+        void Update() {
+            mutex.Wait();
+            Purge();
+            mutex.Release();
+        }
+
+        virtual ~IndexManager() {
+        }
+    };
+}
+
+#endif /* _JPEG2000_INDEX_MANAGER_H_ */
@@ -0,0 +1,89 @@
+#include "trace.h"
+#include "index_file.h"
+#include "index_writer.h"
+#include "file_manager.h"
+
+namespace jpeg2000 {
+
+    bool IndexWriter::Init(IndexManager *index_manager) {
+        this->index_manager = index_manager;
+
+        if (pthread_create(&thread, NULL, ThreadFunction, this) != 0) {
+            ERROR("The index writer thread can not be created");
+            return false;
+        }
+
+        started = true;
+        return true;
+    }
+
+    bool IndexWriter::Add(const ImageIndex::Ptr &image, const string &file_name, const struct stat &file_stat) {
+        if (!started)
+            return false;
+
+        mutex.Wait();
+        if (pending.insert(file_name).second) {
+            jobs.emplace_back();
+            jobs.back().image = image;
+            jobs.back().file_name = file_name;
+            jobs.back().file_stat = file_stat;
+            queued.Broadcast();
+        }
+        mutex.Release();
+
+        return true;
+    }
+
+    void *IndexWriter::ThreadFunction(void *arg) {
+        IndexWriter *writer = (IndexWriter *) arg;
+
+        for (;;) {
+            writer->mutex.Wait();
+            while (writer->jobs.empty())
+                writer->queued.Wait(writer->mutex);
+            Job job = writer->jobs.front();
+            writer->jobs.pop_front();
+            writer->mutex.Release();
+
+            writer->Write(job);
+
+            writer->mutex.Wait();
+            writer->pending.erase(job.file_name);
+            writer->mutex.Release();
+        }
+
+        return NULL;
+    }
+
+    void IndexWriter::Write(const Job &job) {
+        ImageIndex &image = *job.image;
+
+        // Another process could have written it meanwhile
+        if (IndexFile::IsUpToDate(job.file_name, image.path_name, job.file_stat))
+            return;
+
+        // The files are mapped only while the index is completed
+        FileManager file_manager;
+        file_manager.Init("/", "", index_manager);
+
+        bool res = true;
+        // Only the packet index is saved, so the offsets of the packets
+        // are left for the resolution levels requested
+        for (size_t i = 0; res && i < image.codestreams.size(); ++i)
+            res = image.ExtendIndex(file_manager, i, image.coding_parameters.num_levels, false);
+
+        if (!res) {
+            ERROR("The packet index of the image file '" << image.path_name << "' could not be created");
+            return;
+        }
+
+        image.rdwr_lock.WaitForReading();
+        res = IndexFile::Save(job.file_name, job.file_stat, image);
+        image.rdwr_lock.Release();
+
+        if (res) {
+            TRACE("The index of the image file '" << image.path_name << "' has been saved into '" << job.file_name << "'");
+        }
+    }
+
+}
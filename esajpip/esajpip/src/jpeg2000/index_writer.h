@@ -0,0 +1,94 @@
+#ifndef _JPEG2000_INDEX_WRITER_H_
+#define _JPEG2000_INDEX_WRITER_H_
+
+#include <set>
+#include <list>
+#include <string>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "ipc/mutex.h"
+#include "ipc/condition.h"
+#include "image_index.h"
+
+namespace jpeg2000 {
+    using namespace std;
+
+    class IndexManager;
+
+    /**
+     * Writes the index files of the images in a background thread.
+     * When an image without an index file is opened, its index is
+     * built incrementally, as usual, so the first request of the
+     * image is not delayed, and it is queued in this object. The
+     * background thread completes the packet indexes of the queued
+     * images, sharing them with the client threads, and then saves
+     * their index files.
+     *
+     * @see IndexFile
+     * @see FileManager
+     */
+    class IndexWriter {
+    private:
+        /**
+         * Image whose index file must be written.
+         */
+        struct Job {
+            ImageIndex::Ptr image;  ///< Image index
+            string file_name;       ///< Name of the index file
+            struct stat file_stat;  ///< Status of the image file when it was read
+        };
+
+        ipc::Mutex mutex;           ///< Mutex for the queue
+        ipc::Condition queued;      ///< Signaled when an image is queued
+        list<Job> jobs;             ///< Queue of images
+        set<string> pending;        ///< Names of the index files of the queue
+        IndexManager *index_manager;    ///< Index manager of the indexes
+        pthread_t thread;           ///< Background thread
+        bool started;               ///< <code>true</code> if the thread runs
+
+        /**
+         * Main function of the background thread.
+         */
+        static void *ThreadFunction(void *arg);
+
+        /**
+         * Completes the packet indexes of an image and saves
+         * its index file.
+         * @param job Image to write.
+         */
+        void Write(const Job &job);
+
+    public:
+        /**
+         * Initializes the object.
+         */
+        IndexWriter() {
+            index_manager = NULL;
+            started = false;
+        }
+
+        /**
+         * Starts the background thread.
+         * @param index_manager Index manager of the indexes, or
+         * <code>NULL</code> if the indexes are not shared.
+         * @return <code>true</code> if successful.
+         */
+        bool Init(IndexManager *index_manager);
+
+        /**
+         * Queues an image to write its index file. Nothing is done
+         * if the index file of the image is already queued.
+         * @param image Image index, built incrementally.
+         * @param file_name Name of the index file.
+         * @param file_stat Status of the image file when it was read.
+         * @return <code>false</code> if the background thread does
+         * not run.
+         */
+        bool Add(const ImageIndex::Ptr &image, const string &file_name, const struct stat &file_stat);
+
+        virtual ~IndexWriter() {
+        }
+    };
+}
+
+#endif /* _JPEG2000_INDEX_WRITER_H_ */
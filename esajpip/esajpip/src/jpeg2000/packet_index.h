@@ -2,7 +2,9 @@
 #define _JPEG2000_PACKET_INDEX_H_
 
 #include <vector>
-//#include "data/vint_vector.h"
+#include <cstring>
+#include <endian.h>
+#include <algorithm>
 #include "data/file_segment.h"
 
 namespace jpeg2000 {
@@ -10,55 +12,182 @@ namespace jpeg2000 {
 
     /**
      * Class used for indexing the packets of a codestream image.
-     * The class <code>vint_vector</code> is used internally to
-     * store the offsets of the packets with the minimum required
-     * bytes.
+     * The offsets of the packets are stored in blocks of
+     * <code>BLOCK_SIZE</code> packets. Each block keeps the smallest
+     * offset of its packets, and the offsets of all its packets
+     * relative to it, using the minimum number of bytes required by
+     * the block (frame of reference). The header of each block also
+     * contains that number of bytes, so a lookup only reads the
+     * header and then the relative offset. The packets of the last,
+     * incomplete block are kept uncompressed until the block is
+     * completed.
      *
-     * @see data::vint_vector
+     * The length of a packet is obtained from the offset of the
+     * next packet. The packets that are followed by a gap (the
+     * last packet of each tile-part) are marked in a bitmap for
+     * each <code>BLOCK_SIZE</code> packets, and their end offsets
+     * are stored apart. Each bitmap also keeps the position of the
+     * end offset of its first gap, so the end offset of any other
+     * gap is found by counting the bits before it. In this way,
+     * the access to any packet is O(1).
      */
     class PacketIndex {
     private:
-        /**
-         * Vector of packet offsets.
-         */
-        //vint_vector offsets;
-        vector<uint32_t> offsets;
+        friend class IndexFile;
+
+        enum {
+            BLOCK_SIZE = 32,    ///< Number of packets of each block
+            PADDING = 7         ///< Bytes after the last block, to read words
+        };
 
         /**
-         * Vector of file segments to handle the different
-         * sets of packets that are not contiguous.
+         * Header of a block of packets. The data of a block
+         * consists of the relative offsets of its packets.
          */
-        vector<FileSegment> aux;
+        struct Block {
+            uint64_t base;      ///< Smallest offset of the packets
+            uint64_t info;      ///< Position of the data of the block (<< 4) and number of bytes of the offsets
+
+            /**
+             * Returns the position of the data of the block.
+             */
+            uint64_t GetPosition() const {
+                return info >> 4;
+            }
 
-    public:
-        enum {
             /**
-             * All the offsets must be greater than this value.
+             * Returns the number of bytes of the relative offsets.
              */
-                    MINIMUM_OFFSET = 64
+            int GetNumBytes() const {
+                return info & 0xF;
+            }
         };
 
         /**
-         * Empty constructor.
+         * Gaps of <code>BLOCK_SIZE</code> consecutive packets.
          */
-        PacketIndex() {
-        }
+        struct Gaps {
+            uint32_t bitmap;    ///< Bitmap of the packets followed by a gap
+            uint32_t first;     ///< Position in <code>gap_ends</code> of the first gap
+        };
+
+        int size;                       ///< Number of packets
+        uint64_t last_end;              ///< End offset of the last packet
+        vector<Block> blocks;           ///< Headers of the blocks
+        vector<uint8_t> data;           ///< Data of the blocks
+        vector<uint64_t> tail;          ///< Offsets of the packets of the last block
+        vector<Gaps> gaps;              ///< Gaps of each block, including the last one
+        vector<uint64_t> gap_ends;      ///< End offsets of the packets followed by a gap
 
         /**
-         * Initializes the object.
-         * @param max_offset Maximum value for an offset.
+         * Compresses the packets of <code>tail</code> as a new block.
          */
-        PacketIndex(uint64_t max_offset) {
-            assert(max_offset <= UINT32_MAX);
-/*            assert(max_offset > 0);
+        void AddBlock() {
+            Block block;
+            uint64_t position = data.size() - PADDING;
+            block.base = *min_element(tail.begin(), tail.end());
+
+            uint64_t max_delta = *max_element(tail.begin(), tail.end()) - block.base;
 
-            int num_bytes = 0;
-            while (max_offset > 0) {
-                max_offset >>= 8;
+            int num_bytes = 1;
+            while (num_bytes < (int) sizeof(uint64_t) && (max_delta >> (num_bytes * 8)) > 0)
                 num_bytes++;
+
+            block.info = (position << 4) | num_bytes;
+            data.resize(position);
+            for (size_t i = 0; i < tail.size(); ++i) {
+                uint64_t delta = tail[i] - block.base;
+                for (int j = 0; j < num_bytes; ++j, delta >>= 8)
+                    data.push_back((uint8_t) delta);
+            }
+            data.resize(data.size() + PADDING, 0);
+
+            blocks.push_back(block);
+            tail.clear();
+        }
+
+        /**
+         * Returns the offset of a packet, which must exist.
+         * @param i Packet index.
+         */
+        uint64_t GetOffset(int i) const {
+            size_t n = i / BLOCK_SIZE;
+            if (n >= blocks.size())
+                return tail[i % BLOCK_SIZE];
+
+            const Block &block = blocks[n];
+            int num_bytes = block.GetNumBytes();
+
+            uint64_t delta;
+            memcpy(&delta, &data[block.GetPosition() + (i % BLOCK_SIZE) * num_bytes], sizeof(delta));
+
+            return block.base + (le64toh(delta) & (UINT64_MAX >> (64 - num_bytes * 8)));
+        }
+
+        /**
+         * Returns <code>true</code> if a packet is followed by a gap.
+         * @param i Packet index.
+         */
+        bool IsFollowedByGap(int i) const {
+            return (gaps[i / BLOCK_SIZE].bitmap >> (i % BLOCK_SIZE)) & 1;
+        }
+
+        /**
+         * Returns the end offset of a packet followed by a gap.
+         * @param i Packet index.
+         */
+        uint64_t GetGapEnd(int i) const {
+            const Gaps &block_gaps = gaps[i / BLOCK_SIZE];
+            uint32_t before = block_gaps.bitmap & ((1u << (i % BLOCK_SIZE)) - 1);
+            return gap_ends[block_gaps.first + __builtin_popcount(before)];
+        }
+
+        /**
+         * Returns <code>true</code> if the internal structure is
+         * consistent. Used to check the indexes read from files.
+         */
+        bool IsValid() const {
+            if (size < 0 || tail.size() >= BLOCK_SIZE ||
+                (uint64_t) size != blocks.size() * BLOCK_SIZE + tail.size() ||
+                gaps.size() != (size_t) (size + BLOCK_SIZE - 1) / BLOCK_SIZE ||
+                data.size() < PADDING)
+                return false;
+
+            uint64_t position = 0;
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                int num_bytes = blocks[i].GetNumBytes();
+                if (blocks[i].GetPosition() != position || position + PADDING >= data.size() ||
+                    num_bytes < 1 || num_bytes > (int) sizeof(uint64_t))
+                    return false;
+
+                position += BLOCK_SIZE * num_bytes;
+            }
+
+            if (position + PADDING != data.size())
+                return false;
+
+            // The last packet can not be followed by a gap yet
+            if (size > 0 && (gaps.back().bitmap >> ((size - 1) % BLOCK_SIZE)) != 0)
+                return false;
+
+            uint64_t first = 0;
+            for (size_t i = 0; i < gaps.size(); ++i) {
+                if (gaps[i].first != first)
+                    return false;
+
+                first += __builtin_popcount(gaps[i].bitmap);
             }
-            offsets.set_num_bytes(num_bytes);
-*/        }
+
+            return first == gap_ends.size();
+        }
+
+    public:
+        /**
+         * Empty constructor.
+         */
+        PacketIndex() {
+            Clear();
+        }
 
         /**
          * Copy constructor.
@@ -71,37 +200,55 @@ namespace jpeg2000 {
          * Copy assignment.
          */
         const PacketIndex &operator=(const PacketIndex &index) {
-            offsets = index.offsets;
-            aux = index.aux;
+            size = index.size;
+            last_end = index.last_end;
+            blocks = index.blocks;
+            data = index.data;
+            tail = index.tail;
+            gaps = index.gaps;
+            gap_ends = index.gap_ends;
             return *this;
         }
 
+        /**
+         * Exchanges the content with another index.
+         * @param index Index to exchange the content with.
+         */
+        void Swap(PacketIndex &index) {
+            swap(size, index.size);
+            swap(last_end, index.last_end);
+            blocks.swap(index.blocks);
+            data.swap(index.data);
+            tail.swap(index.tail);
+            gaps.swap(index.gaps);
+            gap_ends.swap(index.gap_ends);
+        }
+
         /**
          * Adds a new packet segment to the index.
          * @param segment File segment associated to the packet.
          * @return The object itself.
          */
         PacketIndex &Add(const FileSegment &segment) {
-            assert(segment.offset >= MINIMUM_OFFSET);
-
-            int last = aux.size() - 1;
+            if (size > 0 && last_end != segment.offset) {
+                gaps.back().bitmap |= 1u << ((size - 1) % BLOCK_SIZE);
+                gap_ends.push_back(last_end);
+            }
 
-            if (last < 0) {
-                aux.push_back(segment);
-                offsets.push_back(0);
-            } else {
-                if (aux[last].IsContiguousTo(segment)) {
-                    offsets.back() = aux[last].offset;
-                    offsets.push_back(last);
-                    aux[last] = segment;
-                } else {
-                    assert(last < (MINIMUM_OFFSET - 1));
-
-                    offsets.push_back(last + 1);
-                    aux.push_back(segment);
-                }
+            if (size % BLOCK_SIZE == 0) {
+                Gaps block_gaps;
+                block_gaps.bitmap = 0;
+                block_gaps.first = gap_ends.size();
+                gaps.push_back(block_gaps);
             }
 
+            tail.push_back(segment.offset);
+            if (tail.size() == BLOCK_SIZE)
+                AddBlock();
+
+            last_end = segment.offset + segment.length;
+            size++;
+
             return *this;
         }
 
@@ -109,15 +256,39 @@ namespace jpeg2000 {
          * Returns the number of elements of the vector.
          */
         int Size() const {
-            return offsets.size();
+            return size;
+        }
+
+        /**
+         * Returns the number of bytes of memory allocated by
+         * the index.
+         */
+        uint64_t GetMemoryUsage() const {
+            return blocks.capacity() * sizeof(Block) + data.capacity() + tail.capacity() * sizeof(uint64_t) +
+                   gaps.capacity() * sizeof(Gaps) + gap_ends.capacity() * sizeof(uint64_t);
+        }
+
+        /**
+         * Releases the memory allocated but not used by the index.
+         */
+        void Compact() {
+            blocks.shrink_to_fit();
+            data.shrink_to_fit();
+            gaps.shrink_to_fit();
+            gap_ends.shrink_to_fit();
         }
 
         /**
          * Clears the content.
          */
         void Clear() {
-            offsets.clear();
-            aux.clear();
+            size = 0;
+            last_end = 0;
+            blocks.clear();
+            data.assign(PADDING, 0);
+            tail.clear();
+            gaps.clear();
+            gap_ends.clear();
         }
 
         /**
@@ -126,37 +297,66 @@ namespace jpeg2000 {
          * @return File segment of the packet.
          */
         bool Get(int i, FileSegment *segment) const {
-            if (i < 0 || i >= (int) offsets.size())
+            if (i < 0 || i >= size)
                 return false;
 
-            uint64_t off_i = offsets[i];
+            uint64_t offset, end;
+            size_t n = i / BLOCK_SIZE;
+            int k = i % BLOCK_SIZE;
 
-            if (off_i < MINIMUM_OFFSET) {
-                if (off_i >= aux.size())
-                    return false;
+            // Both offsets are read from the same block when possible
+            if (n < blocks.size() && k < BLOCK_SIZE - 1 && !IsFollowedByGap(i)) {
+                const Block &block = blocks[n];
+                int num_bytes = block.GetNumBytes();
+                uint64_t mask = UINT64_MAX >> (64 - num_bytes * 8), delta, next_delta;
+                const uint8_t *ptr = &data[block.GetPosition() + k * num_bytes];
 
-                *segment = aux[off_i];
-                return true;
+                memcpy(&delta, ptr, sizeof(delta));
+                memcpy(&next_delta, ptr + num_bytes, sizeof(next_delta));
+                offset = block.base + (le64toh(delta) & mask);
+                end = block.base + (le64toh(next_delta) & mask);
+            } else {
+                offset = GetOffset(i);
+
+                if (i == size - 1) end = last_end;
+                else if (!IsFollowedByGap(i)) end = GetOffset(i + 1);
+                else end = GetGapEnd(i);
             }
-            else {
-                if (i + 1 >= (int) offsets.size())
-                    return false;
 
-                uint64_t off_i1 = offsets[i + 1];
+            if (end < offset)
+                return false;
 
-                if (off_i1 < MINIMUM_OFFSET) {
-                    if (off_i1 >= aux.size())
-                        return false;
+            *segment = FileSegment(offset, end - offset);
+            return true;
+        }
 
-                    off_i1 = aux[off_i1].offset;
-                }
+        /**
+         * Returns the total length of a range of packets, if they
+         * are contiguous in the file.
+         * @param first Index of the first packet.
+         * @param last Index of the packet after the last one.
+         * @param length Receives the total length.
+         * @return <code>false</code> if the range is not valid or
+         * there is a gap between the packets.
+         */
+        bool GetContiguousLength(int first, int last, uint64_t *length) const {
+            if (first < 0 || last > size || first > last)
+                return false;
+
+            for (int i = first; i < last;) {
+                int k = i % BLOCK_SIZE, m = min(last - i, BLOCK_SIZE - k);
+                uint32_t mask = (m == BLOCK_SIZE) ? UINT32_MAX : ((1u << m) - 1) << k;
 
-                if (off_i1 < off_i)
+                if ((gaps[i / BLOCK_SIZE].bitmap & mask) != 0)
                     return false;
 
-                *segment = FileSegment(off_i, off_i1 - off_i);
-                return true;
+                i += m;
             }
+
+            if (first == last) *length = 0;
+            else *length = (last == size ? last_end : GetOffset(last)) - GetOffset(first);
+
+            return true;
         }
 
         FileSegment operator[](int i) const {
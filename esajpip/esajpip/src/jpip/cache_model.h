@@ -3,7 +3,9 @@
 
 #include <vector>
 #include <iostream>
+#include <algorithm>
 #include <limits.h>
+#include <stdint.h>
 #include "jpip.h"
 
 namespace jpip {
@@ -28,25 +30,91 @@ namespace jpip {
      */
     class CacheModel {
     public:
+        enum {
+            MAX_ITEMS = 1 << 24     ///< Maximum number of items read from a stream, and of precincts
+        };
+
         /**
          * Sub-class of the cache model class used to identify a
-         * codestream. This class is serializable.
+         * codestream. The complete precincts are recorded in a
+         * bitmap, so the cache models are merged with word-wide
+         * operations, and only the precincts partially sent have
+         * an amount, in a small vector sorted by identifier. This
+         * class is serializable.
          */
         class Codestream {
         private:
-            int header;                ///< Amount for the header
+            /**
+             * Amount of a precinct partially sent.
+             */
+            struct Partial {
+                int id;         ///< Precinct identifier
+                int amount;     ///< Amount, or <code>INT_MAX</code> if removed
+
+                bool operator<(int num_precinct) const {
+                    return id < num_precinct;
+                }
+            };
+
+            int header;                 ///< Amount for the header
             int tile_header;            ///< Amount for the tile-header
-            vector<int> precincts;    ///< Amount for the precincts
+            vector<uint64_t> bitmap;    ///< Bitmap of the complete precincts
 
             /**
-             * Minimum identifier of the non-consecutive precinct
-             * completely sent. All the initial precincts already
-             * sent completely to the client are removed, so this
-             * value contains the next precinct. The vector
-             * <code>precincts</code> is related to the precincts
-             * starting from this index.
+             * Precincts partially sent, sorted by identifier. The
+             * precincts that are completed are only marked as
+             * removed, and they are erased by <code>Pack</code>.
+             */
+            vector<Partial> partials;
+
+            /**
+             * Position of the last partial amount found. The precincts
+             * are usually accessed in increasing order, so the next one
+             * is searched first from this position.
+             */
+            size_t hint;
+
+            /**
+             * Returns <code>true</code> if a precinct is complete.
+             * @param num_precinct Index number of the precinct.
              */
-            int min_precinct;
+            bool IsComplete(int num_precinct) const {
+                size_t word = num_precinct >> 6;
+                return num_precinct < 0 ||
+                       (word < bitmap.size() && (bitmap[word] & (1ULL << (num_precinct & 63))));
+            }
+
+            /**
+             * Marks a precinct as complete. The precincts beyond
+             * <code>MAX_ITEMS</code> are not recorded, so that the
+             * bitmap is never larger than 2 MB.
+             * @param num_precinct Index number of the precinct.
+             */
+            void SetComplete(int num_precinct) {
+                if (num_precinct >= MAX_ITEMS) return;
+
+                size_t word = num_precinct >> 6;
+                if (word >= bitmap.size()) bitmap.resize(word + 1, 0);
+                bitmap[word] |= 1ULL << (num_precinct & 63);
+            }
+
+            /**
+             * Returns the partial amount of a precinct, or
+             * <code>NULL</code> if it has not been sent.
+             * @param num_precinct Index number of the precinct.
+             */
+            Partial *FindPartial(int num_precinct) {
+                if (partials.empty() || partials.back().id < num_precinct)
+                    return NULL;
+
+                if (hint >= partials.size() || partials[hint].id != num_precinct) {
+                    if (hint + 1 < partials.size() && partials[hint + 1].id == num_precinct) hint++;
+                    else hint = lower_bound(partials.begin(), partials.end(), num_precinct) - partials.begin();
+                }
+
+                Partial &partial = partials[hint];
+                return (partial.id == num_precinct && partial.amount != INT_MAX) ? &partial : NULL;
+            }
 
         public:
             /**
@@ -55,7 +123,7 @@ namespace jpip {
             Codestream() {
                 header = 0;
                 tile_header = 0;
-                min_precinct = 0;
+                hint = 0;
             }
 
             /**
@@ -71,8 +139,9 @@ namespace jpip {
             Codestream &operator=(const Codestream &model) {
                 header = model.header;
                 tile_header = model.tile_header;
-                min_precinct = model.min_precinct;
-                precincts = model.precincts;
+                bitmap = model.bitmap;
+                partials = model.partials;
+                hint = 0;
                 return *this;
             }
 
@@ -83,8 +152,17 @@ namespace jpip {
                 AddToMainHeader(model.header);
                 AddToTileHeader(model.tile_header);
 
-                for (size_t i = 0; i < model.precincts.size(); ++i)
-                    AddToPrecinct(model.min_precinct + i, model.precincts[i]);
+                if (bitmap.size() < model.bitmap.size())
+                    bitmap.resize(model.bitmap.size(), 0);
+                for (size_t i = 0; i < model.bitmap.size(); ++i)
+                    bitmap[i] |= model.bitmap[i];
+
+                for (size_t i = 0; i < partials.size(); ++i)
+                    if (IsComplete(partials[i].id)) partials[i].amount = INT_MAX;
+
+                for (size_t i = 0; i < model.partials.size(); ++i)
+                    if (model.partials[i].amount != INT_MAX)
+                        AddToPrecinct(model.partials[i].id, model.partials[i].amount);
                 return *this;
             }
 
@@ -137,16 +215,17 @@ namespace jpip {
              * @param num_precinct Index number of the precinct.
              */
             int GetPrecinct(int num_precinct) {
-                if (num_precinct < min_precinct) return INT_MAX;
+                if (IsComplete(num_precinct)) return INT_MAX;
                 else {
-                    int n = num_precinct - min_precinct;
-                    if (n >= (int) precincts.size()) precincts.resize(n + 1, 0);
-                    return precincts[n];
+                    Partial *partial = FindPartial(num_precinct);
+                    return partial ? partial->amount : 0;
                 }
             }
 
             /**
-             * Increases the amount of a precinct.
+             * Increases the amount of a precinct. The precincts
+             * beyond <code>MAX_ITEMS</code> are not recorded, so they
+             * are sent again if they are requested again.
              * @param num_precinct Index number of the precinct.
              * @param amount Amount increment.
              * @param complete <code>true</code> if the precinct
@@ -154,23 +233,83 @@ namespace jpip {
              * @return the new amount value.
              */
             int AddToPrecinct(int num_precinct, int amount, bool complete = false) {
-                if (num_precinct < min_precinct) return INT_MAX;
-                else {
-                    int n = num_precinct - min_precinct;
-                    if (n >= (int) precincts.size()) precincts.resize(n + 1, 0);
-                    int &p = precincts[n];
-                    if (p != INT_MAX) {
-                        if (complete || (amount == INT_MAX)) p = INT_MAX;
-                        else p += amount;
-                    }
-                    return p;
+                if (IsComplete(num_precinct)) return INT_MAX;
+                else if (num_precinct >= MAX_ITEMS) return (complete || (amount == INT_MAX)) ? INT_MAX : amount;
+
+                Partial *partial = FindPartial(num_precinct);
+
+                if (complete || (amount == INT_MAX)) {
+                    SetComplete(num_precinct);
+                    if (partial) partial->amount = INT_MAX;
+                    return INT_MAX;
+                } else if (partial) {
+                    return partial->amount += amount;
+                } else if (amount == 0) {
+                    return 0;
+                } else {
+                    // The precincts are usually sent in increasing order,
+                    // so the new ones are mostly appended
+                    Partial item = {num_precinct, amount};
+                    if (partials.empty() || partials.back().id < num_precinct) {
+                        hint = partials.size();
+                        partials.push_back(item);
+                    } else if (partials[hint].id == num_precinct) partials[hint] = item;
+                    else partials.insert(partials.begin() + hint, item);
+                    return amount;
+                }
+            }
+
+            /**
+             * Writes the amounts to a binary stream.
+             * @param out Output stream.
+             */
+            void Write(ostream &out) const {
+                int num_partials = 0;
+                for (size_t i = 0; i < partials.size(); ++i)
+                    if (partials[i].amount != INT_MAX) num_partials++;
+
+                int values[4] = {header, tile_header, (int) bitmap.size(), num_partials};
+                out.write((const char *) values, sizeof values);
+                if (!bitmap.empty())
+                    out.write((const char *) &bitmap[0], bitmap.size() * sizeof(uint64_t));
+                for (size_t i = 0; i < partials.size(); ++i)
+                    if (partials[i].amount != INT_MAX)
+                        out.write((const char *) &partials[i], sizeof(Partial));
+            }
+
+            /**
+             * Reads the amounts from a binary stream, written
+             * by the method <code>Write</code>.
+             * @param in Input stream.
+             * @return <code>true</code> if successful.
+             */
+            bool Read(istream &in) {
+                int values[4];
+                if (!in.read((char *) values, sizeof values) || values[2] < 0 || values[2] > (MAX_ITEMS >> 6) ||
+                    values[3] < 0 || values[3] > MAX_ITEMS)
+                    return false;
+
+                header = values[0];
+                tile_header = values[1];
+                bitmap.resize(values[2]);
+                partials.clear();
+                hint = 0;
+                if (!bitmap.empty() && !in.read((char *) &bitmap[0], bitmap.size() * sizeof(uint64_t)))
+                    return false;
+
+                Partial item;
+                for (int i = 0; i < values[3]; ++i) {
+                    if (!in.read((char *) &item, sizeof item) || item.amount == INT_MAX)
+                        return false;
+                    AddToPrecinct(item.id, item.amount);
                 }
+                return true;
             }
 
             /**
              * Packs the information stored regarding the precincts,
-             * removing those initial elements that are consecutive
-             * and completes.
+             * erasing the partial amounts of the precincts already
+             * completed, and the final empty words of the bitmap.
              * @param min_sum Only the packing is performed if there
              * are a number of items equal or greater than this value
              * (1 by default).
@@ -178,15 +317,23 @@ namespace jpip {
             void Pack(int min_sum = 1) {
                 int sum = 0;
 
-                for (size_t i = 0; i < precincts.size(); ++i) {
-                    if (precincts[i] == INT_MAX) sum++;
-                    else break;
-                }
+                for (size_t i = 0; i < partials.size(); ++i)
+                    if (partials[i].amount == INT_MAX) sum++;
 
                 if (sum >= min_sum) {
-                    precincts.erase(precincts.begin(), precincts.begin() + sum);
-                    min_precinct += sum;
+                    size_t n = 0;
+                    for (size_t i = 0; i < partials.size(); ++i)
+                        if (partials[i].amount != INT_MAX) partials[n++] = partials[i];
+
+                    // The memory is released, because the partial amounts
+                    // are usually removed when the WOI is completed
+                    if (n == 0) vector<Partial>().swap(partials);
+                    else partials.resize(n);
+                    hint = 0;
                 }
+
+                while (!bitmap.empty() && bitmap.back() == 0)
+                    bitmap.pop_back();
             }
         };
 
@@ -333,6 +480,43 @@ namespace jpip {
                 codestreams[i].Pack(min_sum);
         }
 
+        /**
+         * Writes the amounts to a binary stream.
+         * @param out Output stream.
+         */
+        void Write(ostream &out) const {
+            int values[3] = {full_meta, (int) meta_data.size(), (int) codestreams.size()};
+            out.write((const char *) values, sizeof values);
+            if (!meta_data.empty())
+                out.write((const char *) &meta_data[0], meta_data.size() * sizeof(int));
+            for (size_t i = 0; i < codestreams.size(); ++i)
+                codestreams[i].Write(out);
+        }
+
+        /**
+         * Reads the amounts from a binary stream, written by
+         * the method <code>Write</code>.
+         * @param in Input stream.
+         * @return <code>true</code> if successful.
+         */
+        bool Read(istream &in) {
+            int values[3];
+            Clear();
+            if (!in.read((char *) values, sizeof values) || values[1] < 0 || values[1] > MAX_ITEMS ||
+                values[2] < 0 || values[2] > MAX_ITEMS)
+                return false;
+
+            full_meta = (values[0] != 0);
+            meta_data.resize(values[1]);
+            if (!meta_data.empty() && !in.read((char *) &meta_data[0], meta_data.size() * sizeof(int)))
+                return false;
+
+            codestreams.resize(values[2]);
+            for (size_t i = 0; i < codestreams.size(); ++i)
+                if (!codestreams[i].Read(in)) return false;
+            return true;
+        }
+
         /**
          * Clear all the amounts.
          */
@@ -5,6 +5,17 @@ namespace jpip {
     void DataBinServer::Reset() {
         metareq = false;
         has_woi = false;
+        end_woi_ = false;
+        preempted = false;
+        pending = 0;
+        current_idx = 0;
+        woi = WOI();
+        codestreams.clear();
+        cache_model.Clear();
+        plan.reset();
+        plan_pos = 0;
+        slice.clear();
+        slice_pos = 0;
     }
 
     bool DataBinServer::SetRequest(FileManager &file_manager, const Request &req) {
@@ -13,10 +24,17 @@ namespace jpip {
         const ImageIndex::Ptr image_index = file_manager.GetImage();
 
         data_writer.ClearPreviousIds();
+        preempted = false;
 
         if (req.mask.items.stream || req.mask.items.context) {
-            if (codestreams != req.codestreams) {
-                codestreams = req.codestreams;
+            // The codestreams that do not exist are ignored
+            vector<int> requested;
+            for (size_t i = 0; i < req.codestreams.size(); ++i)
+                if (req.codestreams[i] < (int) image_index->GetNumCodestreams())
+                    requested.push_back(req.codestreams[i]);
+
+            if (codestreams != requested) {
+                codestreams.swap(requested);
                 current_idx = 0;
                 reset_woi = true;
             }
@@ -28,6 +46,8 @@ namespace jpip {
             WOI new_woi;
             new_woi.size = req.woi_size;
             new_woi.position = req.woi_position;
+            new_woi.layers = req.mask.items.layers ? req.layers : INT_MAX;
+            if (req.mask.items.comps) new_woi.components = req.components;
             req.GetResolution(coding_parameters, &new_woi);
 
             if (new_woi != woi) {
@@ -50,43 +70,216 @@ namespace jpip {
             const CodingParameters *coding_parameters = image_index->GetCodingParameters(codestream);
             end_woi_ = false;
             woi_composer.Reset(coding_parameters, woi);
+            slice.clear();
+            slice_pos = 0;
+            SetPlan(file_manager);
         }
 
         return res;
     }
 
-    bool DataBinServer::GenerateChunk(FileManager &file_manager, char *buf, int *len, bool *last) {
-        int res;
+    void DataBinServer::SetPlan(FileManager &file_manager) {
+        plan.reset();
+        plan_pos = 0;
+
+        if (plan_cache == NULL || codestreams.empty())
+            return;
+
         const ImageIndex::Ptr image_index = file_manager.GetImage();
+        if ((plan = plan_cache->Get(image_index, codestreams, woi)) != NULL)
+            return;
 
-        data_writer.SetBuffer(buf, min(pending, *len));
+        // The packets are counted first, so that the
+        // plans too large are not built
+        const CodingParameters *composer_parameters = image_index->GetCodingParameters(codestreams.front());
+        WOIComposer composer = woi_composer;
+        size_t num_packets = 0;
 
-        if (pending > 0) {
-            eof = false;
+        while (composer.GetNextPacket(composer_parameters))
+            num_packets += codestreams.size();
+        if (num_packets * sizeof(PlanPacket) > PlanCache::MAX_MEMORY / 4)
+            return;
 
-            if (!cache_model.IsFullMetadata()) {
-                File::Ptr file = file_manager.GetFile(image_index->GetPathName());
-                if (image_index->GetNumMetadatas() <= 0)
-                    WriteSegment<DataBinClass::META_DATA>(file, 0, 0, FileSegment::Null);
-                else {
-                    int bin_offset = 0;
-                    size_t num_metadatas = image_index->GetNumMetadatas();
-                    bool last_metadata;
-
-                    for (size_t i = 0; i < num_metadatas; ++i) {
-                        last_metadata = i == num_metadatas - 1;
-                        res = WriteSegment<DataBinClass::META_DATA>(file, 0, 0, image_index->GetMetadata(i), bin_offset, last_metadata);
-                        bin_offset += image_index->GetMetadata(i).length;
-
-                        if (last_metadata) {
-                            if (res > 0) cache_model.SetFullMetadata();
-                        } else {
-                            if (WritePlaceHolder(file, 0, 0, image_index->GetPlaceHolder(i), bin_offset) <= 0) break;
-                            bin_offset += image_index->GetPlaceHolder(i).length();
-                        }
+        shared_ptr<ResponsePlan> new_plan = make_shared<ResponsePlan>();
+        vector<File::Ptr> files(codestreams.size());
+        vector<Packet> packets;
+        size_t max_packets = max<size_t>(1, BATCH_PACKETS / codestreams.size());
+
+        new_plan->reserve(num_packets);
+        composer = woi_composer;
+
+        // If the plan can not be built, the WOI composer
+        // is used, which reports the error
+        while (composer.GetNextPackets(composer_parameters, &packets, max_packets))
+            if (!AddPackets(file_manager, packets, &files, new_plan.get()))
+                return;
+
+        plan = new_plan;
+        plan_cache->Add(image_index, codestreams, woi, plan);
+    }
+
+    bool DataBinServer::AddPackets(FileManager &file_manager, const vector<Packet> &packets, vector<File::Ptr> *files, ResponsePlan *plan) {
+        const ImageIndex::Ptr image_index = file_manager.GetImage();
+        size_t first = plan->size(), num_codestreams = codestreams.size();
+        vector<FileSegment> segments;
+        vector<int> offsets;
+
+        plan->resize(first + packets.size() * num_codestreams);
+
+        for (size_t i = 0; i < num_codestreams; ++i) {
+            const CodingParameters *coding_parameters = image_index->GetCodingParameters(codestreams[i]);
+            File::Ptr &file = (*files)[i];
+
+            if (!image_index->GetPackets(file_manager, codestreams[i], packets, &segments, &offsets)) {
+                plan->resize(first);
+                return false;
+            }
+            if (file == NULL && (file = file_manager.GetFile(image_index->GetPathName(codestreams[i]))) == NULL) {
+                ERROR("Could not open the file of the codestream " << codestreams[i]);
+                plan->resize(first);
+                return false;
+            }
+
+            for (size_t j = 0; j < packets.size(); ++j) {
+                if (segments[j].offset + segments[j].length > file->GetSize()) {
+                    ERROR("Invalid packet segment: codestream=" << codestreams[i]
+                          << ", packet=" << packets[j] << ", segment=" << segments[j] << ", file_size=" << file->GetSize());
+                    plan->resize(first);
+                    return false;
+                }
+
+                // The packets of the codestreams are interleaved
+                PlanPacket &item = (*plan)[first + (j * num_codestreams) + i];
+                item.segment = segments[j];
+                item.bin_id = coding_parameters->GetPrecinctDataBinId(packets[j]);
+                item.bin_offset = offsets[j];
+                item.idx = i;
+                item.last = packets[j].layer >= coding_parameters->num_layers - 1;
+            }
+        }
+
+        return true;
+    }
+
+    bool DataBinServer::WritePackets(FileManager &file_manager, const ResponsePlan &packets, size_t *pos, vector<File::Ptr> *files) {
+        const ImageIndex::Ptr image_index = file_manager.GetImage();
+
+        while (data_writer && !eof && *pos < packets.size()) {
+            const PlanPacket &item = packets[*pos];
+            File::Ptr &file = (*files)[item.idx];
+
+            current_idx = item.idx;
+            if (file == NULL)
+                file = file_manager.GetFile(image_index->GetPathName(codestreams[current_idx]));
+
+            int res = WriteSegment<DataBinClass::PRECINCT>(file, codestreams[current_idx], item.bin_id, item.segment, item.bin_offset, item.last);
+
+            if (res < 0) {
+                ERROR("Could not write packet segment: codestream=" << codestreams[current_idx]
+                      << ", bin=" << item.bin_id << ", segment=" << item.segment);
+                return false;
+            }
+            else if (res > 0) (*pos)++;
+        }
+
+        return true;
+    }
+
+    void DataBinServer::WriteMetadata(FileManager &file_manager) {
+        const ImageIndex::Ptr image_index = file_manager.GetImage();
+
+        if (!cache_model.IsFullMetadata()) {
+            File::Ptr file = file_manager.GetFile(image_index->GetPathName());
+            if (image_index->GetNumMetadatas() <= 0)
+                WriteSegment<DataBinClass::META_DATA>(file, 0, 0, FileSegment::Null);
+            else {
+                int res, bin_offset = 0;
+                size_t num_metadatas = image_index->GetNumMetadatas();
+                bool last_metadata;
+
+                for (size_t i = 0; i < num_metadatas; ++i) {
+                    last_metadata = i == num_metadatas - 1;
+                    res = WriteSegment<DataBinClass::META_DATA>(file, 0, 0, image_index->GetMetadata(i), bin_offset, last_metadata);
+                    bin_offset += image_index->GetMetadata(i).length;
+
+                    if (last_metadata) {
+                        if (res > 0) cache_model.SetFullMetadata();
+                    } else {
+                        if (WritePlaceHolder(file, 0, 0, image_index->GetPlaceHolder(i), bin_offset) <= 0) break;
+                        bin_offset += image_index->GetPlaceHolder(i).length();
                     }
                 }
             }
+        }
+    }
+
+    int DataBinServer::GetMetadataBufferLength(const ImageIndex::Ptr &image_index) {
+        size_t num_metadatas = image_index->GetNumMetadatas();
+        int len = 2 * MINIMUM_SPACE;
+
+        for (size_t i = 0; i < num_metadatas; ++i) {
+            len += image_index->GetMetadata(i).length + 2 * MINIMUM_SPACE;
+            if (i < num_metadatas - 1)
+                len += image_index->GetPlaceHolder(i).length() + 2 * MINIMUM_SPACE;
+        }
+
+        return len;
+    }
+
+    bool DataBinServer::HasMetadataAtOnce(FileManager &file_manager) {
+        // The length must be enough for all the segments and
+        // their headers, so that the meta-data is not split
+        return pending > 0 && !cache_model.IsFullMetadata() &&
+               cache_model.GetDataBin<DataBinClass::META_DATA>(0, 0) == 0 &&
+               GetMetadataBufferLength(file_manager.GetImage()) <= pending - MINIMUM_SPACE - 100;
+    }
+
+    bool DataBinServer::GenerateMetadata(FileManager &file_manager, vector<char> *buf, vector<iovec> *chunk) {
+        chunk->clear();
+
+        if (!HasMetadataAtOnce(file_manager))
+            return false;
+
+        int len = GetMetadataBufferLength(file_manager.GetImage());
+        buf->resize(len);
+        data_writer.SetBuffer(buf->data(), len);
+        eof = false;
+
+        WriteMetadata(file_manager);
+
+        pending -= data_writer.GetCount();
+        data_writer.GetChunk(chunk);
+        return true;
+    }
+
+    void DataBinServer::SetMetadataSent(FileManager &file_manager, int length) {
+        // WriteMetadata completes the data-bin, or sets the full
+        // flag if the image has any meta-data
+        if (file_manager.GetImage()->GetNumMetadatas() <= 0)
+            cache_model.AddToDataBin<DataBinClass::META_DATA>(0, 0, 0, true);
+        else
+            cache_model.SetFullMetadata();
+
+        data_writer.SetCodestream(0);
+        data_writer.SetDataBinClass(DataBinClass::META_DATA);
+        data_writer.SetPreviousIds();
+
+        pending -= length;
+    }
+
+    bool DataBinServer::GenerateChunk(FileManager &file_manager, char *buf, int *len, vector<iovec> *chunk, bool *last) {
+        const ImageIndex::Ptr image_index = file_manager.GetImage();
+
+        data_writer.SetBuffer(buf, min(pending, *len));
+
+        if (preempted) {
+            data_writer.WriteEOR(EOR::WINDOW_CHANGE);
+            preempted = false;
+            pending = 0;
+        } else if (pending > 0) {
+            eof = false;
+
+            WriteMetadata(file_manager);
 
             if (!eof) {
                 for (size_t i = 0; i < codestreams.size(); ++i) {
@@ -95,48 +288,43 @@ namespace jpip {
                     WriteSegment<DataBinClass::TILE_HEADER>(file, codestreams[i], 0, FileSegment::Null);
                 }
 
-                if (has_woi) {
-                    Packet packet;
-                    FileSegment segment;
-                    int bin_id, bin_offset;
-                    bool last_packet;
-                    const CodingParameters *composer_parameters = image_index->GetCodingParameters(codestreams.front());
+                if (has_woi && !codestreams.empty()) {
+                    vector<File::Ptr> files(codestreams.size());
 
-                    while (data_writer && !eof) {
-                        packet = woi_composer.GetCurrentPacket();
-                        const CodingParameters *coding_parameters = image_index->GetCodingParameters(codestreams[current_idx]);
-
-                        if (!image_index->GetPacket(file_manager, codestreams[current_idx], packet, &segment, &bin_offset))
+                    if (plan != NULL) {
+                        if (!WritePackets(file_manager, *plan, &plan_pos, &files))
                             return false;
-                        bin_id = coding_parameters->GetPrecinctDataBinId(packet);
-                        last_packet = packet.layer >= coding_parameters->num_layers - 1;
+                    } else {
+                        // The packets are taken from the WOI composer in
+                        // slices, looked up at once for each codestream
+                        const CodingParameters *composer_parameters = image_index->GetCodingParameters(codestreams.front());
+                        size_t max_packets = max<size_t>(1, BATCH_PACKETS / codestreams.size());
+                        vector<Packet> packets;
 
-                        File::Ptr file = file_manager.GetFile(image_index->GetPathName(codestreams[current_idx]));
-                        if (segment.offset + segment.length > file->GetSize()) {
-                            ERROR("Invalid packet segment: codestream=" << codestreams[current_idx]
-                                  << ", packet=" << packet << ", segment=" << segment << ", file_size=" << file->GetSize());
-                            return false;
-                        }
-                        res = WriteSegment<DataBinClass::PRECINCT>(file, codestreams[current_idx], bin_id, segment, bin_offset, last_packet);
+                        while (data_writer && !eof) {
+                            if (slice_pos >= slice.size()) {
+                                slice.clear();
+                                slice_pos = 0;
 
-                        if (res < 0) {
-                            ERROR("Could not write packet segment: codestream=" << codestreams[current_idx]
-                                  << ", bin=" << bin_id << ", packet=" << packet << ", segment=" << segment);
-                            return false;
-                        }
-                        else if (res > 0) {
-                            if (current_idx != codestreams.size() - 1) current_idx++;
-                            else {
-                                if (!woi_composer.GetNextPacket(composer_parameters)) break;
-                                else current_idx = 0;
+                                if (!woi_composer.GetNextPackets(composer_parameters, &packets, max_packets)) break;
+                                if (!AddPackets(file_manager, packets, &files, &slice)) return false;
                             }
+
+                            if (!WritePackets(file_manager, slice, &slice_pos, &files))
+                                return false;
                         }
                     }
                 }
             }
 
             if (!eof) {
-                data_writer.WriteEOR(EOR::WINDOW_DONE);
+                // The quality limit is only reported if it
+                // has left out any layer of the image
+                if (has_woi && !codestreams.empty() &&
+                    woi.layers < image_index->GetCodingParameters(codestreams.front())->num_layers)
+                    data_writer.WriteEOR(EOR::QUALITY_LIMIT_REACHED);
+                else
+                    data_writer.WriteEOR(EOR::WINDOW_DONE);
                 end_woi_ = true;
                 pending = 0;
             } else {
@@ -149,6 +337,7 @@ namespace jpip {
         }
 
         *len = data_writer.GetCount();
+        data_writer.GetChunk(chunk);
         *last = (pending <= 0);
 
         if (*last) cache_model.Pack();
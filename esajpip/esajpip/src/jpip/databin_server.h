@@ -10,6 +10,7 @@
 #include "woi.h"
 #include "request.h"
 #include "cache_model.h"
+#include "plan_cache.h"
 #include "woi_composer.h"
 #include "databin_writer.h"
 #include "jpeg2000/file_manager.h"
@@ -29,10 +30,11 @@ namespace jpip {
     private:
         WOI woi;             ///< Current WOI
         int pending;         ///< Number of pending bytes
-        vector<int> codestreams;
+        vector<int> codestreams; ///< Codestreams of the current request
         bool has_woi;        ///< <code>true</code> if the last request contained a WOI
         bool metareq;        ///< <code>true</code> if the last request contained a "metareq"
         bool end_woi_;       ///< <code>true</code> if the WOI has been completely sent
+        bool preempted;      ///< <code>true</code> if the response must be ended for a new request
         size_t current_idx;  ///< Current codestream index
 
         /**
@@ -44,9 +46,15 @@ namespace jpip {
         CacheModel cache_model;     ///< Cache model of the client
         WOIComposer woi_composer;   ///< WOI composer for determining the packets
         DataBinWriter data_writer;  ///< Data-bin writer for generating the chunks
+        PlanCache *plan_cache;      ///< Cache of the response plans
+        PlanCache::Ptr plan;        ///< Plan of the current WOI, if any
+        size_t plan_pos;            ///< Current packet of the plan
+        ResponsePlan slice;         ///< Current packets of the WOI composer, without plan
+        size_t slice_pos;           ///< Current packet of the slice
 
         enum {
-            MINIMUM_SPACE = 60        ///< Minimum space in the chunk
+            MINIMUM_SPACE = 60,       ///< Minimum space in the chunk
+            BATCH_PACKETS = 1024      ///< Maximum number of packets of a slice
         };
 
         /**
@@ -128,6 +136,52 @@ namespace jpip {
             return res;
         }
 
+        /**
+         * Appends to a plan the packets of all the requested
+         * codestreams associated to the given packets of the WOI,
+         * looking up their file segments at once for each codestream.
+         * @param file_manager File manager.
+         * @param packets Packets of the WOI.
+         * @param files Files of the requested codestreams, opened
+         * as required.
+         * @param plan Plan to extend.
+         * @return <code>true</code> if successful.
+         */
+        bool AddPackets(FileManager &file_manager, const vector<Packet> &packets, vector<File::Ptr> *files, ResponsePlan *plan);
+
+        /**
+         * Writes the packets of a plan not yet cached by the client,
+         * as much as the free space allows.
+         * @param file_manager File manager.
+         * @param packets Packets to write.
+         * @param pos Current packet, which is updated.
+         * @param files Files of the requested codestreams, opened
+         * as required.
+         * @return <code>true</code> if successful.
+         */
+        bool WritePackets(FileManager &file_manager, const ResponsePlan &packets, size_t *pos, vector<File::Ptr> *files);
+
+        /**
+         * Gets the plan of the current WOI from the cache, or
+         * builds it. The plan is not used if it is too large.
+         * @param file_manager File manager.
+         */
+        void SetPlan(FileManager &file_manager);
+
+        /**
+         * Writes the meta-data of the image not yet cached by the
+         * client, as much as the free space allows.
+         * @param file_manager File manager.
+         */
+        void WriteMetadata(FileManager &file_manager);
+
+        /**
+         * Returns the length of a buffer that is enough for all
+         * the meta-data segments of an image and their headers.
+         * @param image_index Index of the image.
+         */
+        static int GetMetadataBufferLength(const ImageIndex::Ptr &image_index);
+
     public:
         /**
          * Initializes the obect.
@@ -136,9 +190,23 @@ namespace jpip {
             pending = 0;
             has_woi = false;
             end_woi_ = false;
+            preempted = false;
             metareq = false;
             current_idx = 0;
             eof = false;
+            plan_cache = NULL;
+            plan_pos = 0;
+            slice_pos = 0;
+        }
+
+        /**
+         * Sets the cache of the response plans, shared with the
+         * other data-bin servers. If it is not set, the packets
+         * are always determined by the WOI composer.
+         * @param plan_cache Cache of the response plans.
+         */
+        void SetPlanCache(PlanCache *plan_cache) {
+            this->plan_cache = plan_cache;
         }
 
         /**
@@ -149,6 +217,22 @@ namespace jpip {
          */
         void Reset();
 
+        /**
+         * Returns the cache model of the client.
+         */
+        const CacheModel &GetCacheModel() const {
+            return cache_model;
+        }
+
+        /**
+         * Sets the cache model of the client, when a previous
+         * session is resumed.
+         * @param model Cache model.
+         */
+        void SetCacheModel(const CacheModel &model) {
+            cache_model = model;
+        }
+
         /**
          * Sets the new current request to take into account for
          * generating the chunks of data.
@@ -157,18 +241,72 @@ namespace jpip {
          */
         bool SetRequest(FileManager &file_manager, const Request &req);
 
+        /**
+         * Returns the number of codestreams of the current request.
+         */
+        size_t GetNumCodestreams() const {
+            return codestreams.size();
+        }
+
         /**
          * Generates a new chunk of data for the current image and
-         * WOI, according to the last indicated request.
-         * @param buff Pointer to the memory buffer.
-         * @param len Length of the memory buffer. It is modified
-         * by the method to indicate how many bytes have been
-         * written to the buffer.
+         * WOI, according to the last indicated request. The content
+         * of the packets is not copied, but referenced from the
+         * mapped files, which remain open by the file manager.
+         * @param buff Pointer to the memory buffer for the generated
+         * data (headers, place-holders and small segments).
+         * @param len Maximum length of the chunk, which can not be
+         * greater than the length of the memory buffer. It is modified
+         * by the method to indicate the length of the chunk.
+         * @param chunk Receives the memory regions of the chunk.
          * @param last Output parameter to indicates if this is
          * the last chunk of data associated to the last request.
          * @return <code>true</code> if successful.
          */
-        bool GenerateChunk(FileManager &file_manager, char *buf, int *len, bool *last);
+        bool GenerateChunk(FileManager &file_manager, char *buf, int *len, vector<iovec> *chunk, bool *last);
+
+        /**
+         * Ends the current response before completing it, because
+         * a new request has been received. The next chunk generated
+         * is the last one, and it only contains an EOR message with
+         * the reason <code>WINDOW_CHANGE</code>. As the previous
+         * chunks contain complete messages, the cache model remains
+         * consistent with the data sent.
+         */
+        void Preempt() {
+            if (pending > 0)
+                preempted = true;
+        }
+
+        /**
+         * Returns <code>true</code> if all the meta-data of the image
+         * is sent at once before the first chunk of the current
+         * request, that is, if the client has not cached any part of
+         * it and the length of the response allows it. The messages
+         * are then the same for every client, so they can be generated
+         * and compressed only once.
+         */
+        bool HasMetadataAtOnce(FileManager &file_manager);
+
+        /**
+         * Generates all the meta-data of the image at once, if
+         * <code>HasMetadataAtOnce</code> returns <code>true</code>.
+         * @param buf Memory buffer for the generated data, resized
+         * as required.
+         * @param chunk Receives the memory regions of the meta-data.
+         * @return <code>true</code> if the meta-data was generated.
+         */
+        bool GenerateMetadata(FileManager &file_manager, vector<char> *buf, vector<iovec> *chunk);
+
+        /**
+         * Accounts all the meta-data of the image as sent, without
+         * generating it, when the messages that
+         * <code>GenerateMetadata</code> would return are taken from
+         * another response. The cache model and the state of the
+         * data-bin writer are left as if they were generated.
+         * @param length Length of the messages.
+         */
+        void SetMetadataSent(FileManager &file_manager, int length);
 
         virtual ~DataBinServer() {
         }
@@ -66,10 +66,13 @@ namespace jpip {
 
         if (WriteHeader(bin_id, bin_offset, segment.length, last_byte)) {
             if (segment.length > 0) {
-                file.Seek(segment.offset);
-                if ((ptr + segment.length) >= end) eof = true;
-                else if (!file.Read(ptr, segment.length)) eof = true;
-                else ptr += segment.length;
+                const char *data = file.GetData(segment.offset, segment.length);
+                if ((ptr + segment.length) >= end || data == NULL) eof = true;
+                else if (segment.length >= MIN_REFERENCE_LENGTH) AddReference(data, segment.length);
+                else {
+                    memcpy(ptr, data, segment.length);
+                    ptr += segment.length;
+                }
             }
 
             if (eof) ptr = aux_ptr;
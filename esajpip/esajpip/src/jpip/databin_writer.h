@@ -1,7 +1,9 @@
 #ifndef _JPIP_DATABIN_WRITER_H_
 #define _JPIP_DATABIN_WRITER_H_
 
+#include <vector>
 #include <cstdint>
+#include <sys/uio.h>
 #include "jpip.h"
 #include "data/file.h"
 #include "data/file_segment.h"
@@ -14,7 +16,12 @@ namespace jpip {
 
     /**
      * Class used to generate data-bin segments and write them
-     * into a memory buffer.
+     * into a memory buffer. The content of the segments is not
+     * copied into the buffer, but referenced from the mapped
+     * files, so the data written is composed by a list of memory
+     * regions (<code>iovec</code>) that interleaves the generated
+     * headers with the file content. Only the segments shorter
+     * than <code>MIN_REFERENCE_LENGTH</code> are copied.
      *
      * @see DataBinServer
      * @see DataBinClass
@@ -30,12 +37,47 @@ namespace jpip {
         char *ini;            ///< Pointer to the beginning of the buffer
         char *ptr;            ///< Current position of the buffer
         char *end;            ///< Pointer to the end of the buffer
+        char *mark;           ///< Beginning of the bytes not yet added to the chunk
+        ptrdiff_t referenced; ///< Number of bytes referenced from files
+        vector<iovec> chunk;  ///< Memory regions of the data written
 
         int databin_class;            ///< Current data-bin class
         int codestream_idx;            ///< Current codestream index number
         int prev_databin_class;        ///< Previous data-bin class
         int prev_codestream_idx;    ///< Previous codestream index number
 
+        enum {
+            MIN_REFERENCE_LENGTH = 64   ///< Minimum length of the referenced segments
+        };
+
+        /**
+         * Adds a memory region to the chunk.
+         * @param data Pointer to the data.
+         * @param length Length of the data.
+         */
+        void AddRegion(const char *data, size_t length) {
+            iovec region;
+            region.iov_base = (void *) data;
+            region.iov_len = length;
+            chunk.push_back(region);
+        }
+
+        /**
+         * Adds to the chunk the content of a file, without copying
+         * it. The end of the buffer is moved back, so that the
+         * referenced bytes also count for the length limit.
+         * @param data Pointer to the mapped content.
+         * @param length Length of the content.
+         */
+        void AddReference(const char *data, size_t length) {
+            if (ptr > mark) AddRegion(mark, ptr - mark);
+            AddRegion(data, length);
+
+            mark = ptr;
+            end -= length;
+            referenced += length;
+        }
+
         /**
          * Writes a value into the buffer.
          * @param value Value to write.
@@ -83,19 +125,23 @@ namespace jpip {
             codestream_idx = -1;
             prev_databin_class = -1;
             prev_codestream_idx = -1;
-            ini = ptr = end = NULL;
+            ini = ptr = end = mark = NULL;
+            referenced = 0;
         }
 
         /**
-         * Sets the associated memory buffer.
+         * Sets the associated memory buffer. Its length is also
+         * the maximum number of bytes that can be written.
          * @param buf Memory buffer.
          * @param buf_len Length of the memory buffer.
          * @return The object itself.
          */
         DataBinWriter &SetBuffer(char *buf, int buf_len) {
             eof = false;
-            ini = ptr = buf;
+            ini = ptr = mark = buf;
             end = ini + buf_len;
+            referenced = 0;
+            chunk.clear();
 
             return *this;
         }
@@ -114,6 +160,19 @@ namespace jpip {
             return *this;
         }
 
+        /**
+         * Sets the previous identifiers of data-bin class and
+         * codestream index number to the current ones, as if a
+         * message had been written with them.
+         * @return The object itself.
+         */
+        DataBinWriter &SetPreviousIds() {
+            prev_databin_class = databin_class;
+            prev_codestream_idx = codestream_idx;
+
+            return *this;
+        }
+
         /**
          * Sets the current codestream.
          * @param value Index number of the codestream.
@@ -167,7 +226,7 @@ namespace jpip {
          * Returns the number of bytes written.
          */
         ptrdiff_t GetCount() const {
-            return ptr - ini;
+            return (ptr - ini) + referenced;
         }
 
         /**
@@ -177,6 +236,20 @@ namespace jpip {
             return end - ptr;
         }
 
+        /**
+         * Returns the memory regions of the data written, in
+         * order. The regions point to the buffer and to the
+         * mapped files.
+         * @param regions Receives the memory regions.
+         */
+        void GetChunk(vector<iovec> *regions) {
+            if (ptr > mark) AddRegion(mark, ptr - mark);
+            mark = ptr;
+
+            regions->swap(chunk);
+            chunk.clear();
+        }
+
         /**
          * Writes a EOR message into the buffer.
          * @param reason Reason of the message.
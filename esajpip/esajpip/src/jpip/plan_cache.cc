@@ -0,0 +1,90 @@
+#include "trace.h"
+#include "plan_cache.h"
+
+namespace jpip {
+
+    /**
+     * Combines a value into a hash.
+     */
+    static void HashCombine(size_t *hash, size_t value) {
+        *hash ^= value + 0x9E3779B9 + (*hash << 6) + (*hash >> 2);
+    }
+
+    size_t PlanCache::KeyHash::operator()(const Key &key) const {
+        size_t res = std::hash<const void *>()(key.image);
+
+        for (size_t i = 0; i < key.codestreams.size(); ++i)
+            HashCombine(&res, key.codestreams[i]);
+
+        HashCombine(&res, key.woi.position.x);
+        HashCombine(&res, key.woi.position.y);
+        HashCombine(&res, key.woi.size.x);
+        HashCombine(&res, key.woi.size.y);
+        HashCombine(&res, key.woi.resolution);
+        HashCombine(&res, key.woi.layers);
+
+        for (size_t i = 0; i < key.woi.components.size(); ++i) {
+            HashCombine(&res, key.woi.components[i].first);
+            HashCombine(&res, key.woi.components[i].last);
+        }
+
+        return res;
+    }
+
+    list<PlanCache::Entry>::iterator PlanCache::Find(const Key &key) {
+        unordered_map<Key, list<Entry>::iterator, KeyHash>::iterator i = entries_map.find(key);
+        return i == entries_map.end() ? entries.end() : i->second;
+    }
+
+    list<PlanCache::Entry>::iterator PlanCache::Erase(list<Entry>::iterator i) {
+        memory -= i->plan->capacity() * sizeof(PlanPacket);
+        entries_map.erase(i->key);
+        return entries.erase(i);
+    }
+
+    PlanCache::Ptr PlanCache::Get(const ImageIndex::Ptr &image, const vector<int> &codestreams, const WOI &woi) {
+        Ptr plan;
+        Key key = {image.get(), codestreams, woi};
+
+        mutex.Wait();
+        list<Entry>::iterator i = Find(key);
+        if (i != entries.end()) {
+            // The address of a destroyed index can be reused
+            // by another one
+            if (i->image.lock() != image) Erase(i);
+            else {
+                plan = i->plan;
+                entries.splice(entries.begin(), entries, i);
+            }
+        }
+        mutex.Release();
+
+        return plan;
+    }
+
+    void PlanCache::Add(const ImageIndex::Ptr &image, const vector<int> &codestreams, const WOI &woi, const Ptr &plan) {
+        Key key = {image.get(), codestreams, woi};
+
+        mutex.Wait();
+        list<Entry>::iterator i = Find(key);
+        if (i != entries.end())
+            Erase(i);
+
+        entries.emplace_front();
+        Entry &entry = entries.front();
+        entry.key = key;
+        entry.image = image;
+        entry.plan = plan;
+        entries_map[key] = entries.begin();
+        memory += plan->capacity() * sizeof(PlanPacket);
+
+        // The plans of the images no longer indexed are not used
+        // again, so they reach the end of the list and are removed
+        while (memory > MAX_MEMORY && entries.size() > 1) {
+            TRACE("Removing the response plan of the WOI " << entries.back().key.woi);
+            Erase(--entries.end());
+        }
+        mutex.Release();
+    }
+
+}
@@ -0,0 +1,139 @@
+#ifndef _JPIP_PLAN_CACHE_H_
+#define _JPIP_PLAN_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include "woi.h"
+#include "ipc/mutex.h"
+#include "data/file_segment.h"
+#include "jpeg2000/image_index.h"
+
+namespace jpip {
+    using namespace std;
+    using namespace data;
+    using namespace jpeg2000;
+
+    /**
+     * Packet of a response plan, with all the information
+     * required to write it.
+     */
+    struct PlanPacket {
+        FileSegment segment;    ///< File segment of the packet
+        int bin_id;             ///< Precinct data-bin identifier
+        int bin_offset;         ///< Offset within the data-bin
+        int idx;                ///< Index within the requested codestreams
+        bool last;              ///< <code>true</code> if it is the last packet of the data-bin
+    };
+
+    /**
+     * Ordered list of the packets of a WOI, as they are sent to
+     * a client without any data cached.
+     */
+    typedef vector<PlanPacket> ResponsePlan;
+
+    /**
+     * Keeps the response plans of the most recently requested
+     * WOIs, shared by all the connections of the child process.
+     * For a given image, list of codestreams and WOI (resolution
+     * included), the packets are always the same, so the clients
+     * only have to filter a plan against their cache model. The
+     * images are identified by their index objects, which are
+     * replaced when the image files are modified.
+     *
+     * @see DataBinServer
+     */
+    class PlanCache {
+    public:
+        /**
+         * Pointer to a plan, which is kept while it is used
+         * even if it is removed from the cache.
+         */
+        typedef shared_ptr<const ResponsePlan> Ptr;
+
+        enum {
+            MAX_MEMORY = 128 * 1024 * 1024  ///< Maximum memory of the plans
+        };
+
+    private:
+        /**
+         * Identifies a WOI of an image. The image is identified
+         * by the address of its index.
+         */
+        struct Key {
+            const ImageIndex *image;    ///< Image index
+            vector<int> codestreams;    ///< Requested codestreams
+            WOI woi;                    ///< Requested WOI
+
+            bool operator==(const Key &key) const {
+                return image == key.image && woi == key.woi && codestreams == key.codestreams;
+            }
+        };
+
+        /**
+         * Hash function of the keys.
+         */
+        struct KeyHash {
+            size_t operator()(const Key &key) const;
+        };
+
+        /**
+         * Plan of a WOI of an image.
+         */
+        struct Entry {
+            Key key;                    ///< WOI of the image
+            weak_ptr<ImageIndex> image; ///< Image index
+            Ptr plan;                   ///< Packets of the WOI
+        };
+
+        ipc::Mutex mutex;       ///< Mutex for the list
+        list<Entry> entries;    ///< Entries, most recently used first
+        unordered_map<Key, list<Entry>::iterator, KeyHash> entries_map;   ///< Entries by WOI
+        size_t memory;          ///< Memory of the plans
+
+        /**
+         * Returns the entry of a WOI, or the end of the list.
+         */
+        list<Entry>::iterator Find(const Key &key);
+
+        /**
+         * Removes an entry.
+         * @param i Entry to remove.
+         * @return The next entry.
+         */
+        list<Entry>::iterator Erase(list<Entry>::iterator i);
+
+    public:
+        /**
+         * Initializes the object.
+         */
+        PlanCache() {
+            memory = 0;
+        }
+
+        /**
+         * Returns the plan of a WOI, if it is in the cache.
+         * @param image Image index.
+         * @param codestreams Requested codestreams.
+         * @param woi Requested WOI.
+         * @return The plan, or a null pointer.
+         */
+        Ptr Get(const ImageIndex::Ptr &image, const vector<int> &codestreams, const WOI &woi);
+
+        /**
+         * Adds the plan of a WOI, and removes the least recently
+         * used plans when the memory exceeds the limit.
+         * @param image Image index.
+         * @param codestreams Requested codestreams.
+         * @param woi Requested WOI.
+         * @param plan Packets of the WOI.
+         */
+        void Add(const ImageIndex::Ptr &image, const vector<int> &codestreams, const WOI &woi, const Ptr &plan);
+
+        virtual ~PlanCache() {
+        }
+    };
+}
+
+#endif /* _JPIP_PLAN_CACHE_H_ */
@@ -1,78 +1,259 @@
 #include "trace.h"
+#include <cctype>
+#include <algorithm>
 #include "request.h"
 
 #define MAXC 100000
+#define MAX_MODEL_SIZE (1 << 24)
+#define MAX_COMPONENTS 16384
 #define CLAMP(a, min, max) ((a) < (min) ? (min) : ((a) > (max) ? (max) : (a)))
 
 namespace jpip {
 
-    void Request::ParseParameters(istream &stream) {
+    /**
+     * Reads the characters of a parameter value, decoding the
+     * escaped ones (%xx), directly from the request buffer.
+     */
+    class Scanner {
+    private:
+        const char *p;      ///< Current position
+        const char *end;    ///< End of the value
+        bool failed;        ///< <code>true</code> if an invalid escape was found
+
+        /**
+         * Returns the value of a hexadecimal digit, or -1.
+         */
+        static int HexValue(char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            else if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            else return -1;
+        }
+
+        /**
+         * Decodes the next character.
+         * @param c Receives the character, or <code>EOF</code>.
+         * @return The number of bytes of the character.
+         */
+        int Decode(int *c) {
+            int high, low;
+
+            if (p >= end) {
+                *c = EOF;
+                return 0;
+            } else if (*p != '%') {
+                *c = (unsigned char) *p;
+                return 1;
+            } else if (end - p < 3 || (high = HexValue(p[1])) < 0 || (low = HexValue(p[2])) < 0) {
+                failed = true;
+                *c = EOF;
+                return 0;
+            } else {
+                *c = (high << 4) | low;
+                return 3;
+            }
+        }
+
+    public:
+        /**
+         * Initializes the object.
+         * @param begin Beginning of the value.
+         * @param end End of the value.
+         */
+        Scanner(const char *begin, const char *end) {
+            this->p = begin;
+            this->end = end;
+            failed = false;
+        }
+
+        /**
+         * Returns the next character without consuming it, or
+         * <code>EOF</code> if there are no more.
+         */
+        int Peek() {
+            int c;
+            Decode(&c);
+            return c;
+        }
+
+        /**
+         * Returns and consumes the next character, or
+         * <code>EOF</code> if there are no more.
+         */
+        int Get() {
+            int c;
+            p += Decode(&c);
+            return c;
+        }
+
+        /**
+         * Reads an integer number, as the stream operator does.
+         * @param x Receives the number.
+         * @return <code>true</code> if successful.
+         */
+        bool GetInt(int *x) {
+            long long value = 0;
+            bool negative = false, digits = false;
+
+            while (isspace(Peek())) Get();
+            if (Peek() == '-' || Peek() == '+') negative = (Get() == '-');
+
+            while (isdigit(Peek())) {
+                value = value * 10 + (Get() - '0');
+                if (value > (long long) INT_MAX + 1) return false;
+                digits = true;
+            }
+
+            if (negative) value = -value;
+            if (!digits || value > INT_MAX || value < INT_MIN) return false;
+
+            *x = (int) value;
+            return true;
+        }
+
+        /**
+         * Consumes the given string if the next characters match it.
+         * @param cad String to match.
+         * @return <code>true</code> if successful.
+         */
+        bool Match(const char *cad) {
+            const char *begin = p;
+
+            for (; *cad; ++cad) {
+                if (Get() != (unsigned char) *cad) {
+                    p = begin;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Returns <code>true</code> if an invalid escaped
+         * character has been found.
+         */
+        bool Failed() const {
+            return failed;
+        }
+    };
+
+    /**
+     * Returns <code>true</code> if a parameter has the given name.
+     */
+    static inline bool IsParam(const char *param, size_t param_len, const char *name) {
+        return param_len == strlen(name) && !memcmp(param, name, param_len);
+    }
+
+    void Request::ParseParameters(const char *begin, const char *end) {
         mask.Clear();
         codestreams.clear();
-        http::Request::ParseParameters(stream);
+        components.clear();
+        http::Request::ParseParameters(begin, end);
     }
 
-    void Request::ParseParameter(istream &stream, const string &param, string &value) {
-        char c;
+    void Request::ParseParameter(const char *param, size_t param_len, const char *value, size_t value_len) {
         int x, y;
-        string aux;
-
-        if (param == "target") mask.items.target = 1;
-        else if (param == "cid") mask.items.cid = 1;
-        else if (param == "cnew") mask.items.cnew = 1;
-        else if (param == "cclose") mask.items.cclose = 1;
-        else if (param == "metareq") mask.items.metareq = 1;
-        else if (param == "fsiz") {
-            if ((stream >> x >> c >> y) && (c == ',')) {
+        Scanner in(value, value + value_len);
+
+        if (IsParam(param, param_len, "target")) {
+            target.assign(value, value_len);
+            mask.items.target = 1;
+        } else if (IsParam(param, param_len, "cid")) {
+            cid.assign(value, value_len);
+            mask.items.cid = 1;
+        } else if (IsParam(param, param_len, "cnew")) mask.items.cnew = 1;
+        else if (IsParam(param, param_len, "cclose")) {
+            cclose.assign(value, value_len);
+            mask.items.cclose = 1;
+        } else if (IsParam(param, param_len, "metareq")) mask.items.metareq = 1;
+        else if (IsParam(param, param_len, "fsiz")) {
+            if (in.GetInt(&x) && in.Get() == ',' && in.GetInt(&y)) {
                 resolution_size.x = x;
                 resolution_size.y = y;
                 mask.items.fsiz = 1;
 
-                if (stream.peek() == ',') {
-                    std::getline(stream.ignore(1), aux, '&');
-                    if (!stream.eof()) stream.unget();
-
-                    if (aux == "round-up") round_direction = ROUNDUP;
-                    else if (aux == "round-down") round_direction = ROUNDDOWN;
+                if (in.Get() == ',') {
+                    if (in.Match("round-up") && in.Peek() == EOF) round_direction = ROUNDUP;
+                    else if (in.Match("round-down") && in.Peek() == EOF) round_direction = ROUNDDOWN;
                     else round_direction = CLOSEST;
                 }
 
-                TRACE("JPIP parameter: fsiz=" << resolution_size.x << "," << resolution_size.y << "," << aux);
+                TRACE("JPIP parameter: fsiz=" << resolution_size.x << "," << resolution_size.y << "," << round_direction);
             }
-        } else if (param == "roff") {
-            if ((stream >> x >> c >> y) && (c == ',')) {
+        } else if (IsParam(param, param_len, "roff")) {
+            if (in.GetInt(&x) && in.Get() == ',' && in.GetInt(&y)) {
                 woi_position.x = x;
                 woi_position.y = y;
                 mask.items.roff = 1;
 
                 TRACE("JPIP parameter: roff=" << woi_position.x << "," << woi_position.y);
             }
-        } else if (param == "rsiz") {
-            if ((stream >> x >> c >> y) && (c == ',')) {
+        } else if (IsParam(param, param_len, "rsiz")) {
+            if (in.GetInt(&x) && in.Get() == ',' && in.GetInt(&y)) {
                 woi_size.x = x;
                 woi_size.y = y;
                 mask.items.rsiz = 1;
 
                 TRACE("JPIP parameter: rsiz=" << woi_size.x << "," << woi_size.y);
             }
-        } else if (param == "len") {
-            if (stream >> x) {
+        } else if (IsParam(param, param_len, "len")) {
+            if (in.GetInt(&x)) {
                 length_response = x;
                 mask.items.len = 1;
 
                 TRACE("JPIP parameter: len=" << length_response);
             }
-        } else if (param == "stream") {
-            if (stream >> x) {
+        } else if (IsParam(param, param_len, "layers")) {
+            if (in.GetInt(&x) && x >= 0) {
+                layers = x;
+                mask.items.layers = 1;
+
+                TRACE("JPIP parameter: layers=" << layers);
+            }
+        } else if (IsParam(param, param_len, "comps")) {
+            // List of ranges of components, the last one may be open.
+            // The ranges are stored merged, not expanded, and a list
+            // with too many of them or with a reversed one is ignored
+            bool res = true;
+            do {
+                if (!(res = in.GetInt(&x) && x >= 0)) break;
+                y = x;
+
+                if (in.Peek() == '-') {
+                    in.Get();
+                    if (in.Peek() == ',' || in.Peek() == EOF) y = MAX_COMPONENTS - 1;
+                    else if (!(res = in.GetInt(&y) && y >= x)) break;
+                }
+
+                x = min(x, MAX_COMPONENTS - 1);
+                y = min(y, MAX_COMPONENTS - 1);
+
+                if (!(res = WOI::AddComponentRange(&components, x, y))) {
+                    ERROR("Too many ranges of components in the request");
+                    break;
+                }
+            } while (in.Get() == ',');
+
+            if (res && !in.Failed()) {
+                mask.items.comps = 1;
+
+                TRACE("JPIP parameter: comps=" << string(value, value_len));
+            } else {
+                components.clear();
+            }
+        } else if (IsParam(param, param_len, "stream")) {
+            if (in.GetInt(&x)) {
                 x = CLAMP(x, 0, MAXC);
                 y = x;
 
-                if (stream.peek() == ':') {
-                    stream.ignore(1) >> y;
+                bool res = true;
+                if (in.Peek() == ':') {
+                    in.Get();
+                    res = in.GetInt(&y);
                     y = CLAMP(y, 0, MAXC);
                 }
 
-                if (stream) {
+                if (res) {
                     if (x > y) { // not standard
                         for (int i = x; i >= y; --i)
                             codestreams.push_back(i);
@@ -85,142 +266,135 @@ namespace jpip {
 
                 TRACE("JPIP parameter: stream=" << x << ":" << y);
             }
-        } else if (param == "model") {
-            if (ParseModel(stream))
+        } else if (IsParam(param, param_len, "model")) {
+            if (ParseModel(value, value + value_len))
                 mask.items.model = 1;
-        } else if (param == "context") {
-            char jpxl_param[5];
-            stream.get(jpxl_param, 5);
-
-            if (!strcmp(jpxl_param, "jpxl")) {
-                GetCodedChar(stream, c);
-                if (c == '<') {
-                    if (stream >> x) {
-                        x = CLAMP(x, 0, MAXC);
-                        y = x;
-
-                        if (stream.peek() == '-') {
-                            stream.ignore(1) >> y;
-                            y = CLAMP(y, 0, MAXC);
-                        }
+        } else if (IsParam(param, param_len, "context")) {
+            if (in.Match("jpxl") && in.Get() == '<' && in.GetInt(&x)) {
+                x = CLAMP(x, 0, MAXC);
+                y = x;
 
-                        GetCodedChar(stream, c);
-                        if (c == '>') {
-                            if (x > y) { // not standard
-                                for (int i = x; i >= y; --i)
-                                    codestreams.push_back(i);
-                            } else {
-                                for (int i = x; i <= y; ++i)
-                                    codestreams.push_back(i);
-                            }
-                            mask.items.context = 1;
-                        }
-                    }
+                bool res = true;
+                if (in.Peek() == '-') {
+                    in.Get();
+                    res = in.GetInt(&y);
+                    y = CLAMP(y, 0, MAXC);
                 }
-                TRACE("JPIP parameter: context=" << x << ":" << y);
-            }
-        }
-
-        getline(stream, value, '&');
 
-        if (!value.empty()) { TRACE("JPIP parameter: " << param << "=" << value); }
-    }
-
-    istream &Request::GetCodedChar(istream &in, char &c) {
-        if (in.get(c)) {
-            if (c == '%') {
-                int cval;
-                stringstream hex_str;
-
-                hex_str.put(in.get());
-                hex_str.put(in.get());
-
-                if (hex_str >> hex >> cval) c = (char) cval;
-                else {
-                    in.setstate(istream::failbit);
-                    c = EOF;
+                if (res && in.Get() == '>') {
+                    if (x > y) { // not standard
+                        for (int i = x; i >= y; --i)
+                            codestreams.push_back(i);
+                    } else {
+                        for (int i = x; i <= y; ++i)
+                            codestreams.push_back(i);
+                    }
+                    mask.items.context = 1;
                 }
+
+                TRACE("JPIP parameter: context=" << x << ":" << y);
             }
         }
-        return in;
     }
 
-    istream &Request::ParseModel(istream &in) {
-        char c;
-        int id, amount;
+    bool Request::ParseModel(const char *begin, const char *end) {
+        Scanner in(begin, end);
+        int c, id = 0, amount;
         int minc = 0, maxc = 0;
 
-        cache_model.Clear();
+        // Upper bounds of the memory of the cache model and of the
+        // updates, so that a short request can not allocate more than
+        // MAX_MODEL_SIZE bytes, even with many codestreams
+        int max_codestream = -1, max_precinct = -1, max_metadata = -1;
+        uint64_t partials = 0, updates = 0;
 
-        while (in.good()) {
-            GetCodedChar(in, c);
+        cache_model.Clear();
 
+        while ((c = in.Get()) != EOF) {
             if (c == ',') continue;
-            else if (c == '&') {
-                in.unget();
-                break;
-            } else if (c == '[') {
-                if (in >> minc) {
-                    minc = CLAMP(minc, 0, MAXC);
-                    maxc = minc;
-
-                    if (in.peek() == '-') {
-                        in.ignore(1) >> maxc;
-                        maxc = CLAMP(maxc, minc, MAXC);
-                    }
-                    if (!GetCodedChar(in, c) || (c != ']'))
-                        in.setstate(istream::failbit);
-
-                    TRACE("Model updating: [" << minc << "-" << maxc << "]");
+            else if (c == '[') {
+                if (!in.GetInt(&minc))
+                    return false;
+
+                minc = CLAMP(minc, 0, MAXC);
+                maxc = minc;
+
+                if (in.Peek() == '-') {
+                    in.Get();
+                    if (!in.GetInt(&maxc))
+                        return false;
+                    maxc = CLAMP(maxc, minc, MAXC);
                 }
+                if (in.Get() != ']')
+                    return false;
+
+                TRACE("Model updating: [" << minc << "-" << maxc << "]");
             } else if (c == '-') {
                 ERROR("Subtractive bin-descriptors are not supported for model updating");
-                in.setstate(istream::failbit);
+                return false;
             } else {
-                if ((c == 'H') && (in.peek() == 'm')) {
-                    in.ignore(1);
+                if ((c == 'H') && (in.Peek() == 'm')) {
+                    in.Get();
                     c = 'h';
-                } else {
-                    in >> id;
+                } else if (!in.GetInt(&id) || id < 0 || id >= CacheModel::MAX_ITEMS) {
+                    // The identifiers are used as indexes of the cache model
+                    return false;
                 }
 
                 amount = INT_MAX;
-                if (in.peek() == ':') {
-                    if (in.ignore(1).peek() != 'L') in >> amount;
-                    else {
+                if (in.Peek() == ':') {
+                    in.Get();
+                    if (in.Peek() == 'L') {
                         ERROR("Number of layers can not be used for model updating");
-                        in.setstate(istream::failbit);
+                        return false;
+                    } else if (!in.GetInt(&amount)) {
+                        return false;
                     }
                 }
 
-                if (in) {
-                    if (c == 'M') {
-                        cache_model.AddToMetadata(id, amount);
-                        TRACE("Model updating: M" << id << ":" << (amount == INT_MAX ? -1 : amount));
-                    } else {
-                        for (int i = minc; i <= maxc; ++i) {
-                            CacheModel::Codestream &cod = cache_model.GetCodestream(i);
-
-                            if (c == 'h') {
-                                cod.AddToMainHeader(amount);
-                                TRACE("Model updating: Hm" << ":" << (amount == INT_MAX ? -1 : amount));
-                            } else if (c == 'H') {
-                                cod.AddToTileHeader(amount);
-                                TRACE("Model updating: H" << id << ":" << (amount == INT_MAX ? -1 : amount));
-                            } else if (c == 'P') {
-                                cod.AddToPrecinct(id, amount);
-                                TRACE("Model updating: P" << id << ":" << (amount == INT_MAX ? -1 : amount));
-                            } else {
-                                ERROR("The bin-descriptor '" << c << "' is not supported for model updating");
-                                in.setstate(istream::failbit);
-                                break;
-                            }
+                if (c == 'M') max_metadata = max(max_metadata, id);
+                else {
+                    max_codestream = max(max_codestream, maxc);
+                    if (c == 'P') max_precinct = max(max_precinct, id);
+                    if (c == 'P' && amount != INT_MAX) partials += maxc - minc + 1;
+                    updates += maxc - minc + 1;
+                }
+
+                uint64_t num_codestreams = max_codestream + 1, bitmap_words = (max_precinct + 64) >> 6;
+                uint64_t size = num_codestreams * (sizeof(CacheModel::Codestream) + bitmap_words * sizeof(uint64_t)) +
+                                (uint64_t) (max_metadata + 1) * sizeof(int) + partials * 2 * sizeof(int);
+
+                if (size > MAX_MODEL_SIZE || updates > MAX_MODEL_SIZE) {
+                    ERROR("The cache model of the request is too large");
+                    cache_model.Clear();
+                    return false;
+                }
+
+                if (c == 'M') {
+                    cache_model.AddToMetadata(id, amount);
+                    TRACE("Model updating: M" << id << ":" << (amount == INT_MAX ? -1 : amount));
+                } else {
+                    for (int i = minc; i <= maxc; ++i) {
+                        CacheModel::Codestream &cod = cache_model.GetCodestream(i);
+
+                        if (c == 'h') {
+                            cod.AddToMainHeader(amount);
+                            TRACE("Model updating: Hm" << ":" << (amount == INT_MAX ? -1 : amount));
+                        } else if (c == 'H') {
+                            cod.AddToTileHeader(amount);
+                            TRACE("Model updating: H" << id << ":" << (amount == INT_MAX ? -1 : amount));
+                        } else if (c == 'P') {
+                            cod.AddToPrecinct(id, amount);
+                            TRACE("Model updating: P" << id << ":" << (amount == INT_MAX ? -1 : amount));
+                        } else {
+                            ERROR("The bin-descriptor '" << (char) c << "' is not supported for model updating");
+                            return false;
                         }
                     }
                 }
             }
         }
 
-        return in;
+        return !in.Failed();
     }
 }
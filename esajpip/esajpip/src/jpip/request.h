@@ -18,6 +18,9 @@ namespace jpip {
      * Class derived from the HTTP <code>Request</code> class
      * that contains the required code for properly analyzing
      * a JPIP request, when this protocol is used over the HTTP.
+     * The parameters are parsed from the request buffer and
+     * stored in the members, without using the map of the
+     * base class.
      *
      * @see http::Request
      * @see CacheModel
@@ -25,33 +28,29 @@ namespace jpip {
     class Request : public http::Request {
     public:
         /**
-         * Parses a cache model from an input stream.
-         * @param stream Input stream.
-         * @return The same input stream after the parsing.
+         * Parses a cache model.
+         * @param begin Beginning of the value of the parameter.
+         * @param end End of the value of the parameter.
+         * @return <code>true</code> if successful.
          */
-        istream &ParseModel(istream &stream);
+        bool ParseModel(const char *begin, const char *end);
 
         /**
-         * Gets a coded char from an input stream.
-         * @param in Input stream.
-         * @param c Reference to store the char.
-         * @return The same input stream.
+         * Parses one parameter of a CGI HTTP request, storing
+         * its value in the corresponding member.
+         * @param param Parameter name.
+         * @param param_len Length of the parameter name.
+         * @param value Parameter value.
+         * @param value_len Length of the parameter value.
          */
-        istream &GetCodedChar(istream &in, char &c);
+        virtual void ParseParameter(const char *param, size_t param_len, const char *value, size_t value_len);
 
         /**
          * Parses the parameters of a CGI HTTP request.
-         * @param stream Input stream.
+         * @param begin Beginning of the parameters.
+         * @param end End of the parameters.
          */
-        virtual void ParseParameters(istream &stream);
-
-        /**
-         * Parses one parameter of a CGI HTTP request.
-         * @param stream Input stream.
-         * @param param String to store the parameter name.
-         * @param value String to store the parameter value.
-         */
-        virtual void ParseParameter(istream &stream, const string &param, string &value);
+        virtual void ParseParameters(const char *begin, const char *end);
 
         /**
          * Union used to control the presence of the different
@@ -74,6 +73,8 @@ namespace jpip {
                 unsigned model   : 1;
                 unsigned stream  : 1;
                 unsigned context : 1;
+                unsigned layers  : 1;
+                unsigned comps   : 1;
             } items;
 
             /**
@@ -115,10 +116,15 @@ namespace jpip {
             CLOSEST       ///< Closest
         };
 
+        string target;           ///< Value of the parameter <code>target</code>
+        string cid;              ///< Value of the parameter <code>cid</code>
+        string cclose;           ///< Value of the parameter <code>cclose</code>
         Size woi_size;           ///< WOI size
         Point woi_position;      ///< WOI position
         vector<int> codestreams; ///< Requested codestreams
         int length_response;     ///< Maximum response length
+        int layers;              ///< Maximum number of quality layers
+        vector<ComponentRange> components; ///< Requested components, sorted ranges
         ParametersMask mask;     ///< Parameters mask
         Size resolution_size;    ///< Size of the resolution level
         CacheModel cache_model;  ///< Cache model
@@ -133,6 +139,7 @@ namespace jpip {
          */
         Request() {
             length_response = 0;
+            layers = INT_MAX;
             round_direction = CLOSEST;
             codestreams.reserve(100);
         }
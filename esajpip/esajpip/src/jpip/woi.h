@@ -1,6 +1,9 @@
 #ifndef _JPIP_WOI_H_
 #define _JPIP_WOI_H_
 
+#include <vector>
+#include <climits>
+#include <algorithm>
 #include <iostream>
 #include "jpeg2000/point.h"
 
@@ -8,10 +11,29 @@ namespace jpip {
     using namespace std;
     using namespace jpeg2000;
 
+    /**
+     * Range of image components, from <code>first</code> to
+     * <code>last</code>, both included.
+     */
+    struct ComponentRange {
+        int first;    ///< First component
+        int last;     ///< Last component
+
+        ComponentRange(int first = 0, int last = 0) {
+            this->first = first;
+            this->last = last;
+        }
+
+        friend bool operator==(const ComponentRange &a, const ComponentRange &b) {
+            return (a.first == b.first) && (a.last == b.last);
+        }
+    };
+
     /**
      * Class that identifies a WOI (Window Of Interest). This term
      * refers, from the point of view of the JPIP protocol, to a
-     * rectangular region of an image, for a resolution level. This
+     * rectangular region of an image, for a resolution level, a
+     * number of quality layers and a set of image components. This
      * class can be printed.
      *
      * @see Point
@@ -21,12 +43,20 @@ namespace jpip {
         Size size;        ///< Size of the WOI (width and height)
         Point position;    ///< Position of the upper-left corner of the WOI
         int resolution;    ///< Resolution level where the WOI is located (0 == the highest)
+        int layers;        ///< Maximum number of quality layers (<code>INT_MAX</code> == all)
+        vector<ComponentRange> components; ///< Requested components, sorted ranges (empty == all)
+
+        enum {
+            MAX_COMPONENT_RANGES = 16   ///< Maximum number of ranges of components
+        };
 
         /**
-         * Initializes the resolution level to zero.
+         * Initializes the resolution level to zero, without
+         * limit of quality layers.
          */
         WOI() {
             resolution = 0;
+            layers = INT_MAX;
         }
 
         /**
@@ -39,6 +69,47 @@ namespace jpip {
             this->size = size;
             this->position = position;
             this->resolution = resolution;
+            this->layers = INT_MAX;
+        }
+
+        /**
+         * Adds a range of components to a selection, keeping its
+         * ranges sorted and merging the ones that overlap or are
+         * adjacent.
+         * @param ranges Ranges of the selection.
+         * @param first First component of the range.
+         * @param last Last component of the range.
+         * @return <code>false</code> if the selection would have
+         * more than <code>MAX_COMPONENT_RANGES</code> ranges.
+         */
+        static bool AddComponentRange(vector<ComponentRange> *ranges, int first, int last) {
+            vector<ComponentRange>::iterator i = ranges->begin();
+            while (i != ranges->end() && i->last < first - 1) ++i;
+
+            vector<ComponentRange>::iterator j = i;
+            while (j != ranges->end() && j->first <= last + 1) {
+                first = min(first, j->first);
+                last = max(last, j->last);
+                ++j;
+            }
+
+            i = ranges->erase(i, j);
+            if (ranges->size() >= MAX_COMPONENT_RANGES) return false;
+            ranges->insert(i, ComponentRange(first, last));
+            return true;
+        }
+
+        /**
+         * Returns <code>true</code> if a component is requested.
+         */
+        bool HasComponent(int component) const {
+            if (components.empty()) return true;
+
+            for (size_t i = 0; i < components.size(); ++i) {
+                if (component < components[i].first) return false;
+                else if (component <= components[i].last) return true;
+            }
+            return false;
         }
 
         /**
@@ -55,6 +126,8 @@ namespace jpip {
             size = woi.size;
             position = woi.position;
             resolution = woi.resolution;
+            layers = woi.layers;
+            components = woi.components;
             return *this;
         }
 
@@ -63,7 +136,8 @@ namespace jpip {
          * are equal.
          */
         friend bool operator==(const WOI &a, const WOI &b) {
-            return ((a.position == b.position) && (a.size == b.size) && (a.resolution == b.resolution));
+            return ((a.position == b.position) && (a.size == b.size) && (a.resolution == b.resolution) &&
+                    (a.layers == b.layers) && (a.components == b.components));
         }
 
         /**
@@ -76,7 +150,9 @@ namespace jpip {
 
         friend ostream &operator<<(ostream &out, const WOI &woi) {
             out << "(" << woi.position.x << ", " << woi.position.y << ", "
-                << woi.size.x << ", " << woi.size.y << ", " << woi.resolution << ")";
+                << woi.size.x << ", " << woi.size.y << ", " << woi.resolution;
+            if (woi.layers != INT_MAX) out << ", " << woi.layers;
+            out << ")";
             return out;
         }
 
@@ -1,6 +1,8 @@
 #ifndef _JPIP_WOI_COMPOSER_H_
 #define _JPIP_WOI_COMPOSER_H_
 
+#include <vector>
+#include <algorithm>
 #include "woi.h"
 #include "jpeg2000/packet.h"
 #include "jpeg2000/coding_parameters.h"
@@ -25,6 +27,9 @@ namespace jpip {
         Point pxy2;            ///< Bottom-right corner of the WOI
         bool more_packets;     ///< Flag to control the last packet
         int max_resolution;    ///< Maximum resolution
+        int max_layer;         ///< Maximum quality layer
+        vector<int> components; ///< Components of the WOI
+        size_t component_idx;  ///< Index of the current component
         Size min_precinct_xy;  ///< Minimum precinct
         Size max_precinct_xy;  ///< Maximum precinct
         Packet current_packet; ///< Current packet
@@ -36,6 +41,8 @@ namespace jpip {
         WOIComposer() {
             more_packets = false;
             max_resolution = 0;
+            max_layer = 0;
+            component_idx = 0;
         }
 
         /**
@@ -48,14 +55,25 @@ namespace jpip {
         /**
          * Resets the packets navigation and starts a new one. Sets the
          * current packet to the first packet of the WOI, assuming a
-         * LRCP order.
+         * LRCP order. Only the components of the WOI that exist in the
+         * image are explored. If the WOI limits the quality layers to
+         * zero, or none of its components exist, no packets are available.
          * @param coding_parameters Coding parameters to use.
          * @param woi New WOI to use.
          */
         void Reset(const CodingParameters *coding_parameters, const WOI &woi) {
-            more_packets = true;
             current_packet = Packet();
             max_resolution = woi.resolution;
+            max_layer = min(woi.layers, coding_parameters->num_layers) - 1;
+
+            components.clear();
+            for (int c = 0; c < coding_parameters->num_components; ++c) {
+                if (woi.HasComponent(c)) components.push_back(c);
+            }
+
+            component_idx = 0;
+            more_packets = (max_layer >= 0 && !components.empty());
+            if (more_packets) current_packet.component = components.front();
 
             pxy1 = woi.position * (1L << (coding_parameters->num_levels - woi.resolution));
             pxy2 = (woi.position + woi.size - 1) * (1L << (coding_parameters->num_levels - woi.resolution));
@@ -79,6 +97,9 @@ namespace jpip {
             pxy2 = composer.pxy2;
             more_packets = composer.more_packets;
             max_resolution = composer.max_resolution;
+            max_layer = composer.max_layer;
+            components = composer.components;
+            component_idx = composer.component_idx;
             current_packet = composer.current_packet;
             min_precinct_xy = composer.min_precinct_xy;
             max_precinct_xy = composer.max_precinct_xy;
@@ -110,20 +131,22 @@ namespace jpip {
                     else {
                         current_packet.precinct_xy.y = min_precinct_xy.y;
 
-                        if (current_packet.component < (coding_parameters->num_components - 1))
-                            current_packet.component++;
+                        if (component_idx < components.size() - 1)
+                            current_packet.component = components[++component_idx];
                         else {
-                            current_packet.component = 0;
+                            component_idx = 0;
+                            current_packet.component = components.front();
 
                             if (current_packet.resolution < max_resolution) current_packet.resolution++;
                             else {
-                                current_packet.resolution = 0;
-
-                                if (current_packet.layer < (coding_parameters->num_layers - 1)) current_packet.layer++;
-                                else {
+                                // The current packet is kept valid after the last one
+                                if (current_packet.layer >= max_layer) {
                                     more_packets = false;
                                     return true;
                                 }
+
+                                current_packet.resolution = 0;
+                                current_packet.layer++;
                             }
 
                             min_precinct_xy = coding_parameters->GetPrecincts(current_packet.resolution, pxy1);
@@ -142,6 +165,37 @@ namespace jpip {
             }
         }
 
+        /**
+         * Moves to the next packets of the WOI, until the end of the
+         * current slice of packets, i.e., those with the same quality
+         * layer, resolution level and component. The packets of a
+         * slice are returned in a contiguous array, so that they can
+         * be processed at once.
+         * @param packets Receives the packets.
+         * @param max_packets Maximum number of packets to return.
+         * @return <code>false</code> if there are no more packets.
+         */
+        bool GetNextPackets(const CodingParameters *coding_parameters, vector<Packet> *packets, size_t max_packets) {
+            packets->clear();
+            if (!more_packets) return false;
+
+            Size &precinct_xy = current_packet.precinct_xy;
+            while (packets->size() < max_packets) {
+                packets->push_back(current_packet);
+
+                if (precinct_xy.x < max_precinct_xy.x) precinct_xy.x++;
+                else if (precinct_xy.y < max_precinct_xy.y) {
+                    precinct_xy.x = min_precinct_xy.x;
+                    precinct_xy.y++;
+                } else {
+                    // Last packet of the slice
+                    GetNextPacket(coding_parameters);
+                    break;
+                }
+            }
+            return true;
+        }
+
         virtual ~WOIComposer() {
         }
     };
@@ -0,0 +1,246 @@
+#include <set>
+#include <deque>
+#include <string>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "app_config.h"
+#include "ipc/mutex.h"
+#include "ipc/condition.h"
+#include "jpeg2000/file_manager.h"
+
+using namespace std;
+using namespace jpeg2000;
+
+#define CONFIG_FILE       "server.cfg"
+#define MAX_QUEUE_SIZE    (1024)
+
+/**
+ * Statistics of the indexing process.
+ */
+struct IndexStats {
+    uint64_t num_files;     ///< Number of files processed
+    uint64_t num_indexed;   ///< Number of index files generated
+    uint64_t num_failed;    ///< Number of files that failed
+    uint64_t image_bytes;   ///< Bytes of the images indexed
+    uint64_t plt_bytes;     ///< Bytes of PLT markers parsed
+
+    IndexStats() {
+        num_files = num_indexed = num_failed = image_bytes = plt_bytes = 0;
+    }
+};
+
+static AppConfig cfg;
+static string images_folder;
+static string caching_folder;
+
+static ipc::Mutex mutex;
+static ipc::Condition queue_changed;
+static deque<string> queue;
+static bool queue_closed = false;
+static IndexStats stats;
+static set<pair<dev_t, ino_t>> visited_dirs;
+
+static void Usage(const char *app_name) {
+    cerr << "Usage: " << app_name << " [-j threads] [-i images_folder] [-c caching_folder] [path ...]" << endl << endl
+         << "Generates the index files of the JP2/JPX images of the given files" << endl
+         << "and directories (recursively). If no path is given, the paths of" << endl
+         << "the images are read from the standard input, one per line. The" << endl
+         << "relative paths are taken from the images folder. By default, the" << endl
+         << "folders are read from the '" << CONFIG_FILE << "' file, if it exists." << endl;
+}
+
+static bool IsImageFile(const string &path_name) {
+    size_t pos = path_name.find_last_of('.');
+    if (pos == string::npos) return false;
+
+    string extension = path_name.substr(pos);
+    return extension == ".jp2" || extension == ".jpx";
+}
+
+static void PushFile(const string &path_name) {
+    mutex.Wait();
+    while (queue.size() >= MAX_QUEUE_SIZE)
+        queue_changed.Wait(mutex);
+    queue.push_back(path_name);
+    queue_changed.Broadcast();
+    mutex.Release();
+}
+
+static bool PopFile(string *path_name) {
+    bool res = false;
+
+    mutex.Wait();
+    while (queue.empty() && !queue_closed)
+        queue_changed.Wait(mutex);
+    if (!queue.empty()) {
+        *path_name = queue.front();
+        queue.pop_front();
+        queue_changed.Broadcast();
+        res = true;
+    }
+    mutex.Release();
+
+    return res;
+}
+
+static void CloseQueue() {
+    mutex.Wait();
+    queue_closed = true;
+    queue_changed.Broadcast();
+    mutex.Release();
+}
+
+static void AddPath(string path_name) {
+    if (path_name.empty()) return;
+    if (path_name[0] != '/') path_name = images_folder + path_name;
+
+    struct stat file_stat;
+    if (stat(path_name.c_str(), &file_stat) != 0) {
+        ERROR("The path '" << path_name << "' does not exist");
+        return;
+    }
+
+    if (S_ISREG(file_stat.st_mode)) {
+        if (IsImageFile(path_name)) PushFile(path_name);
+
+    } else if (S_ISDIR(file_stat.st_mode)) {
+        // The symbolic links can make a directory be reached
+        // again, even from itself
+        if (!visited_dirs.insert(make_pair(file_stat.st_dev, file_stat.st_ino)).second) {
+            LOG("The directory '" << path_name << "' has already been visited");
+            return;
+        }
+
+        DIR *dir = opendir(path_name.c_str());
+        if (dir == NULL) {
+            ERROR("The directory '" << path_name << "' can not be read: " << strerror(errno));
+            return;
+        }
+
+        if (path_name[path_name.size() - 1] != '/') path_name += '/';
+
+        for (struct dirent *entry; (entry = readdir(dir)) != NULL;) {
+            string name = entry->d_name;
+            if (name != "." && name != "..") AddPath(path_name + name);
+        }
+        closedir(dir);
+    }
+}
+
+static void *IndexThread(void *arg) {
+    string path_name;
+
+    while (PopFile(&path_name)) {
+        // A new file manager is used for each image, so
+        // that the mapped files are released
+        FileManager file_manager;
+
+        struct stat file_stat;
+        uint64_t plt_bytes = 0;
+        bool res = file_manager.Init(images_folder, caching_folder) &&
+                   (stat(path_name.c_str(), &file_stat) == 0) &&
+                   file_manager.UpdateIndexFile(path_name, &plt_bytes);
+
+        if (!res) ERROR("The index file of '" << path_name << "' can not be generated");
+
+        mutex.Wait();
+        stats.num_files++;
+        if (!res) stats.num_failed++;
+        else if (plt_bytes > 0) {
+            stats.num_indexed++;
+            stats.image_bytes += file_stat.st_size;
+            stats.plt_bytes += plt_bytes;
+        }
+        mutex.Release();
+    }
+
+    return NULL;
+}
+
+static double GetTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (access(CONFIG_FILE, R_OK) == 0) {
+        if (!cfg.Load(CONFIG_FILE))
+            return CERR("The configuration file '" << CONFIG_FILE << "' can not be read");
+
+        images_folder = cfg.images_folder();
+        caching_folder = cfg.caching_folder();
+    }
+
+    for (int opt; (opt = getopt(argc, argv, "j:i:c:h")) != -1;) {
+        switch (opt) {
+            case 'j':
+                num_threads = atoi(optarg);
+                break;
+            case 'i':
+                images_folder = optarg;
+                break;
+            case 'c':
+                caching_folder = optarg;
+                break;
+            default:
+                Usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (caching_folder.empty())
+        return CERR("The caching folder is not defined");
+    if (num_threads <= 0)
+        num_threads = 1;
+
+    if (images_folder.empty()) images_folder = "/";
+    else if (images_folder[images_folder.size() - 1] != '/') images_folder += '/';
+
+    FileManager file_manager;
+    if (!file_manager.Init(images_folder, caching_folder))
+        return CERR("The file manager can not be initialized");
+
+    vector<pthread_t> threads(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+        if (pthread_create(&threads[i], NULL, IndexThread, NULL) != 0)
+            return CERR("The indexing threads can not be created");
+    }
+
+    double start_time = GetTime();
+
+    if (optind < argc) {
+        for (int i = optind; i < argc; ++i)
+            AddPath(argv[i]);
+    } else {
+        for (string line; getline(cin, line);)
+            AddPath(line);
+    }
+
+    CloseQueue();
+    for (int i = 0; i < num_threads; ++i)
+        pthread_join(threads[i], NULL);
+
+    double time = GetTime() - start_time;
+    if (time <= 0) time = 1e-9;
+
+    cout << setiosflags(ios::fixed) << setprecision(2)
+         << "Files: " << stats.num_files << " (" << stats.num_indexed << " indexed, "
+         << (stats.num_files - stats.num_indexed - stats.num_failed) << " up to date, "
+         << stats.num_failed << " failed)" << endl
+         << "Time: " << time << " s (" << num_threads << " threads)" << endl
+         << "Throughput: " << (stats.num_files / time) << " files/s, "
+         << (stats.image_bytes / (1024.0 * 1024.0) / time) << " MB/s" << endl
+         << "PLT bytes parsed: " << stats.plt_bytes << endl;
+
+    return stats.num_failed > 0 ? 1 : 0;
+}
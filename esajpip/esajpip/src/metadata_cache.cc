@@ -0,0 +1,69 @@
+#include <zlib.h>
+#include "trace.h"
+#include "metadata_cache.h"
+
+using namespace std;
+using namespace jpeg2000;
+
+unsigned long MetadataCache::GetCRC(const vector<iovec> &regions, size_t *length) {
+    unsigned long crc = crc32(0L, Z_NULL, 0);
+
+    *length = 0;
+    for (size_t i = 0; i < regions.size(); ++i) {
+        crc = crc32(crc, (const Bytef *) regions[i].iov_base, (uInt) regions[i].iov_len);
+        *length += regions[i].iov_len;
+    }
+
+    return crc;
+}
+
+void MetadataCache::Erase(list<Entry>::iterator i) {
+    memory -= i->data->size();
+    entries_map.erase(i->image);
+    entries.erase(i);
+}
+
+MetadataCache::Ptr MetadataCache::Get(const ImageIndex::Ptr &image, unsigned long *crc, size_t *length) {
+    Ptr data;
+
+    mutex.Wait();
+    unordered_map<const ImageIndex *, list<Entry>::iterator>::iterator i = entries_map.find(image.get());
+    if (i != entries_map.end()) {
+        // The address of a destroyed index can be reused
+        // by another one
+        if (i->second->image_ref.lock() != image) Erase(i->second);
+        else {
+            data = i->second->data;
+            *crc = i->second->crc;
+            *length = i->second->length;
+            entries.splice(entries.begin(), entries, i->second);
+        }
+    }
+    mutex.Release();
+
+    return data;
+}
+
+void MetadataCache::Add(const ImageIndex::Ptr &image, unsigned long crc, size_t length, const Ptr &data) {
+    mutex.Wait();
+    unordered_map<const ImageIndex *, list<Entry>::iterator>::iterator i = entries_map.find(image.get());
+    if (i != entries_map.end())
+        Erase(i->second);
+
+    entries.emplace_front();
+    Entry &entry = entries.front();
+    entry.image = image.get();
+    entry.image_ref = image;
+    entry.crc = crc;
+    entry.length = length;
+    entry.data = data;
+    entries_map[entry.image] = entries.begin();
+    memory += data->size();
+
+    // The entry just added is never removed
+    while (memory > MAX_MEMORY && entries.size() > 1) {
+        TRACE("Removing the compressed meta-data of an image");
+        Erase(--entries.end());
+    }
+    mutex.Release();
+}
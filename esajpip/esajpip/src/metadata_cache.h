@@ -0,0 +1,105 @@
+#ifndef _METADATA_CACHE_H_
+#define _METADATA_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <unordered_map>
+#include "ipc/mutex.h"
+#include "jpeg2000/image_index.h"
+
+using namespace std;
+
+/**
+ * Keeps the gzip-compressed meta-data of the most recently
+ * requested images, shared by all the connections of the child
+ * process. Only the meta-data messages sent to a client without
+ * any meta-data cached are kept, as they are the same for every
+ * client, so they are only generated and compressed once. Each
+ * image is identified by its index object, which is replaced by
+ * the index manager when the image file is modified, so the
+ * messages are never compared. The CRC-32 and length of the
+ * uncompressed messages are kept to continue the gzip stream.
+ *
+ * @see ClientManager
+ */
+class MetadataCache {
+public:
+    /**
+     * Pointer to the compressed data, which is kept while it
+     * is used even if it is removed from the cache.
+     */
+    typedef shared_ptr<const string> Ptr;
+
+private:
+    /**
+     * Compressed meta-data of an image.
+     */
+    struct Entry {
+        const jpeg2000::ImageIndex *image;      ///< Index of the image
+        weak_ptr<jpeg2000::ImageIndex> image_ref;   ///< Checks that the index still exists
+        unsigned long crc;      ///< CRC-32 of the messages
+        size_t length;          ///< Length of the messages
+        Ptr data;               ///< Compressed messages
+    };
+
+    enum {
+        MAX_MEMORY = 64 * 1024 * 1024   ///< Maximum memory of the compressed data
+    };
+
+    ipc::Mutex mutex;       ///< Mutex for the list
+    list<Entry> entries;    ///< Entries, most recently used first
+    unordered_map<const jpeg2000::ImageIndex *, list<Entry>::iterator> entries_map;   ///< Entries by index
+    size_t memory;          ///< Memory of the compressed data
+
+    /**
+     * Removes an entry.
+     * @param i Entry to remove.
+     */
+    void Erase(list<Entry>::iterator i);
+
+public:
+    /**
+     * Initializes the object.
+     */
+    MetadataCache() {
+        memory = 0;
+    }
+
+    /**
+     * Computes the CRC-32 of the data of some memory regions.
+     * @param regions Memory regions.
+     * @param length Receives the total length of the data.
+     * @return The CRC-32 value.
+     */
+    static unsigned long GetCRC(const vector<iovec> &regions, size_t *length);
+
+    /**
+     * Returns the compressed meta-data of an image, if it is
+     * in the cache.
+     * @param image Index of the image.
+     * @param crc Receives the CRC-32 of the messages.
+     * @param length Receives the length of the messages.
+     * @return The compressed data, or a null pointer.
+     */
+    Ptr Get(const jpeg2000::ImageIndex::Ptr &image, unsigned long *crc, size_t *length);
+
+    /**
+     * Adds the compressed meta-data of an image, replacing the
+     * previous one, and removes the least recently used entries
+     * when the memory exceeds the limit.
+     * @param image Index of the image.
+     * @param crc CRC-32 of the messages.
+     * @param length Length of the messages.
+     * @param data Compressed messages.
+     */
+    void Add(const jpeg2000::ImageIndex::Ptr &image, unsigned long crc, size_t length, const Ptr &data);
+
+    virtual ~MetadataCache() {
+    }
+};
+
+#endif /* _METADATA_CACHE_H_ */
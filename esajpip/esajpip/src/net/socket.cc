@@ -1,6 +1,7 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
 #include <cassert>
 #include <cstring>
 #include "socket.h"
@@ -15,7 +16,7 @@ namespace net {
     bool Socket::SetBlockingMode(bool state) {
         int cur = fcntl(sid, F_GETFL, 0);
 
-        if (state) cur |= O_NONBLOCK;
+        if (!state) cur |= O_NONBLOCK;
         else if (cur & O_NONBLOCK)
             cur ^= O_NONBLOCK;
 
@@ -24,7 +25,7 @@ namespace net {
 
     bool Socket::IsBlockingMode() {
         int cur = fcntl(sid, F_GETFL, 0);
-        return (bool) (cur & O_NONBLOCK);
+        return !(cur & O_NONBLOCK);
     }
 
     bool Socket::IsValid() {
@@ -32,6 +33,21 @@ namespace net {
         return (poll(&poll_fd, 1, 0) == 0);
     }
 
+    bool Socket::GetSendState(int *queued, int *window) {
+#ifdef _PLATFORM_LINUX
+        tcp_info info;
+        socklen_t len = sizeof(info);
+
+        if (ioctl(sid, TIOCOUTQ, queued) != 0 || getsockopt(sid, IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+            return false;
+
+        *window = info.tcpi_snd_cwnd * info.tcpi_snd_mss;
+        return true;
+#else
+        return false;
+#endif
+    }
+
     int Socket::WaitForInput(int time_out) {
         PollFD poll_fd(sid, POLLIN);
         return poll(&poll_fd, 1, time_out);
@@ -71,6 +87,15 @@ namespace net {
         return send(sid, buf, len, 0);
     }
 
+    ssize_t Socket::SendRegions(const iovec *iov, int iov_len) {
+        msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov = (iovec *) iov;
+        msg.msg_iovlen = iov_len;
+
+        return sendmsg(sid, &msg, 0);
+    }
+
     ssize_t Socket::SendTo(const Address &address, const void *buf, size_t len, bool prevent_block) {
         if (!prevent_block)
             return sendto(sid, buf, len, 0, address.GetSockAddr(), address.GetSize());
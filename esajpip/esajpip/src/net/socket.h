@@ -3,6 +3,7 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/time.h>
 #include <sys/times.h>
 #include <unistd.h>
@@ -85,11 +86,15 @@ namespace net {
           Configures the socket for listening incoming connections.
           @param address Address used to listen.
           @param nstack Maximum number of clients in listening stack.
+          @param reuse_port <code>true</code> if several sockets can
+          listen at the same address (<code>SO_REUSEPORT</code>), which
+          share the incoming connections.
           @return <code>true</code> if successful.
         */
-        bool ListenAt(const Address &address, int nstack = 10) {
+        bool ListenAt(const Address &address, int nstack = 10, bool reuse_port = false) {
             int flags = 1;
             if (setsockopt(sid, SOL_SOCKET, SO_REUSEADDR, &flags, sizeof(flags)) != 0) return false;
+            if (reuse_port && setsockopt(sid, SOL_SOCKET, SO_REUSEPORT, &flags, sizeof(flags)) != 0) return false;
             if (::bind(sid, address.GetSockAddr(), address.GetSize()) != 0) return false;
             return listen(sid, nstack) == 0;
         }
@@ -171,6 +176,15 @@ namespace net {
         */
         ssize_t Send(const void *buf, size_t len, bool prevent_block = false);
 
+        /**
+          Sends the bytes of a list of memory regions with a single
+          system call (gather write).
+          @param iov Memory regions with the bytes to sent.
+          @param iov_len Number of memory regions.
+          @return The number of sent bytes.
+        */
+        ssize_t SendRegions(const iovec *iov, int iov_len);
+
         /**
           Sends a number of bytes to a specific address. This methods
           allows to prevent blocking, without having into account the
@@ -193,6 +207,17 @@ namespace net {
          */
         bool SendDescriptor(const Address &address, int fd, int aux = 0);
 
+        /**
+         * Obtains the state of the sending side of a TCP connection.
+         * It is only supported in Linux.
+         * @param queued Receives the number of bytes of the send
+         * queue, sent but not acknowledged or not sent yet.
+         * @param window Receives the congestion window, in bytes,
+         * that is, the bytes that can be sent in a round trip.
+         * @return <code>true</code> if successful.
+         */
+        bool GetSendState(int *queued, int *window);
+
         /**
          * Returns <code>true</code> if the sockets is valid, that is,
          * if after a polling regarding error status is not successful.
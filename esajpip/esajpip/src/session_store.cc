@@ -0,0 +1,113 @@
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "trace.h"
+#include "session_store.h"
+
+using namespace std;
+using namespace jpip;
+
+#define BACKUP_EXT      ".backup"
+#define BACKUP_MAGIC    "ESAJPIP-SESSION-2"
+
+/**
+ * Returns <code>true</code> if a file modified at the given time
+ * has expired.
+ */
+static bool IsExpired(const AppConfig &cfg, time_t mtime) {
+    return cfg.cache_max_time() >= 0 && (time(NULL) - mtime) > cfg.cache_max_time();
+}
+
+string SessionStore::GetPathName(const AppConfig &cfg, const string &channel) {
+    // Without an expiration time the files would be kept forever
+    if (cfg.caching_folder().empty() || cfg.cache_max_time() < 0 || channel.empty())
+        return "";
+
+    // The identifier comes from the client, so it can not
+    // contain any character that changes the path
+    for (size_t i = 0; i < channel.size(); ++i)
+        if (!isalnum(channel[i]) && channel[i] != '-') return "";
+
+    return cfg.caching_folder() + channel + BACKUP_EXT;
+}
+
+bool SessionStore::Save(const AppConfig &cfg, const string &channel, const string &target, const CacheModel &cache_model) {
+    string path_name = GetPathName(cfg, channel);
+    if (path_name.empty())
+        return false;
+
+    // The file is written with another name and renamed, so
+    // that a process never reads an incomplete session
+    string tmp_name = path_name + "." + to_string(getpid());
+    ofstream out(tmp_name.c_str(), ios::binary | ios::trunc);
+
+    out << BACKUP_MAGIC << '\n' << target << '\n';
+    cache_model.Write(out);
+    out.close();
+
+    if (!out || rename(tmp_name.c_str(), path_name.c_str()) != 0) {
+        ERROR("The session of the channel " << channel << " can not be stored in '" << path_name << "'");
+        remove(tmp_name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool SessionStore::Load(const AppConfig &cfg, const string &channel, string *target, CacheModel *cache_model) {
+    string path_name = GetPathName(cfg, channel);
+    struct stat file_stat;
+
+    if (path_name.empty() || stat(path_name.c_str(), &file_stat) != 0)
+        return false;
+
+    if (IsExpired(cfg, file_stat.st_mtime)) {
+        remove(path_name.c_str());
+        return false;
+    }
+
+    ifstream in(path_name.c_str(), ios::binary);
+    string magic;
+
+    if (!getline(in, magic) || magic != BACKUP_MAGIC || !getline(in, *target) || !cache_model->Read(in)) {
+        ERROR("The session file '" << path_name << "' is not valid");
+        return false;
+    }
+
+    return true;
+}
+
+void SessionStore::Remove(const AppConfig &cfg, const string &channel) {
+    string path_name = GetPathName(cfg, channel);
+    if (!path_name.empty())
+        remove(path_name.c_str());
+}
+
+int SessionStore::Clean(const AppConfig &cfg) {
+    DIR *dir;
+    int num_removed = 0;
+
+    if (cfg.caching_folder().empty() || (dir = opendir(cfg.caching_folder().c_str())) == NULL)
+        return 0;
+
+    size_t ext_len = strlen(BACKUP_EXT);
+    struct dirent *entry;
+    struct stat file_stat;
+
+    while ((entry = readdir(dir)) != NULL) {
+        string name = entry->d_name;
+        if (name.size() <= ext_len || name.compare(name.size() - ext_len, ext_len, BACKUP_EXT) != 0)
+            continue;
+
+        string path_name = cfg.caching_folder() + name;
+        if (stat(path_name.c_str(), &file_stat) == 0 && IsExpired(cfg, file_stat.st_mtime))
+            if (remove(path_name.c_str()) == 0) num_removed++;
+    }
+
+    closedir(dir);
+    return num_removed;
+}
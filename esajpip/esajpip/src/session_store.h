@@ -0,0 +1,71 @@
+#ifndef _SESSION_STORE_H_
+#define _SESSION_STORE_H_
+
+#include <string>
+#include "app_config.h"
+#include "jpip/cache_model.h"
+
+using namespace std;
+
+/**
+ * Keeps the sessions of the clients after their connections are
+ * closed, so that a client that reconnects with the same channel
+ * identifier resumes the session with its previous cache model,
+ * without sending it again. Each session is stored in a ``.backup''
+ * file of the caching folder, so it can be resumed by any child
+ * process, and it expires after the time configured with the field
+ * <code>cache_max_time</code>. The sessions are not stored if the
+ * caching folder is not configured, or if the expiration time is
+ * negative.
+ *
+ * @see ClientManager
+ */
+class SessionStore {
+private:
+    /**
+     * Returns the path name of the file of a session, or an
+     * empty string if the sessions are not stored or the channel
+     * identifier is not valid.
+     * @param cfg Application configuration.
+     * @param channel Channel identifier.
+     */
+    static string GetPathName(const AppConfig &cfg, const string &channel);
+
+public:
+    /**
+     * Stores the session of a channel.
+     * @param cfg Application configuration.
+     * @param channel Channel identifier.
+     * @param target Image of the channel.
+     * @param cache_model Cache model of the client.
+     * @return <code>true</code> if successful.
+     */
+    static bool Save(const AppConfig &cfg, const string &channel, const string &target, const jpip::CacheModel &cache_model);
+
+    /**
+     * Loads the session of a channel, if it has been stored
+     * and it has not expired.
+     * @param cfg Application configuration.
+     * @param channel Channel identifier.
+     * @param target Receives the image of the channel.
+     * @param cache_model Receives the cache model of the client.
+     * @return <code>true</code> if successful.
+     */
+    static bool Load(const AppConfig &cfg, const string &channel, string *target, jpip::CacheModel *cache_model);
+
+    /**
+     * Removes the session of a channel.
+     * @param cfg Application configuration.
+     * @param channel Channel identifier.
+     */
+    static void Remove(const AppConfig &cfg, const string &channel);
+
+    /**
+     * Removes all the sessions that have expired.
+     * @param cfg Application configuration.
+     * @return The number of sessions removed.
+     */
+    static int Clean(const AppConfig &cfg);
+};
+
+#endif /* _SESSION_STORE_H_ */
@@ -1,40 +1,146 @@
-
-#include <glib.h>
-#include <glib-object.h>
-#include <gsf/gsf-output-memory.h>
-#include <gsf/gsf-output-gzip.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
 
 #include "zfilter.h"
 
 /* ---------------------------------------------------------------------- */
 
-void *zfilter_new(void) {
-    GsfOutputMemory *sink = GSF_OUTPUT_MEMORY(gsf_output_memory_new());
-    return gsf_output_gzip_new(GSF_OUTPUT(sink), NULL);
+#define ZFILTER_MIN_SPACE 4096
+
+/* The deflate stream is raw, and the gzip header and trailer are
+   written here, so that a stream can continue a cached beginning */
+static const unsigned char zfilter_header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+
+typedef struct {
+    z_stream strm;
+    unsigned char *out;
+    size_t out_len;     /* bytes produced since the last flush */
+    size_t out_size;
+    int reset;          /* the output was returned by the last flush */
+    uLong crc;          /* CRC-32 of the data */
+    size_t total;       /* length of the data */
+} zfilter;
+
+static int zfilter_reserve(zfilter *z, size_t space) {
+    if (z->out_size - z->out_len < space) {
+        size_t size = 2 * z->out_size + space;
+        unsigned char *out = realloc(z->out, size);
+        if (out == NULL)
+            return 0;
+        z->out = out;
+        z->out_size = size;
+    }
+    return 1;
+}
+
+static int zfilter_deflate(zfilter *z, int flush) {
+    int ret;
+
+    if (z->reset) {
+        z->out_len = 0;
+        z->reset = 0;
+    }
+
+    do {
+        if (!zfilter_reserve(z, ZFILTER_MIN_SPACE))
+            return 0;
+
+        z->strm.next_out = z->out + z->out_len;
+        z->strm.avail_out = (uInt) (z->out_size - z->out_len);
+
+        ret = deflate(&z->strm, flush);
+        z->out_len = z->out_size - z->strm.avail_out;
+
+        if (ret == Z_STREAM_ERROR)
+            return 0;
+    } while (z->strm.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+
+    return 1;
+}
+
+void *zfilter_new(int level) {
+    zfilter *z = calloc(1, sizeof(zfilter));
+    if (z == NULL)
+        return NULL;
+
+    if (deflateInit2(&z->strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK ||
+        !zfilter_reserve(z, ZFILTER_MIN_SPACE)) {
+        zfilter_del(z);
+        return NULL;
+    }
+
+    memcpy(z->out, zfilter_header, sizeof(zfilter_header));
+    z->out_len = sizeof(zfilter_header);
+    z->crc = crc32(0L, Z_NULL, 0);
+
+    return z;
+}
+
+void zfilter_resume(void *obj, unsigned long crc, size_t nbytes) {
+    zfilter *z = obj;
+
+    z->out_len = 0;
+    z->crc = crc;
+    z->total = nbytes;
 }
 
 int zfilter_write(void *obj, const void *data, size_t nbytes) {
-    return gsf_output_write(GSF_OUTPUT(obj), nbytes, (guint8 *) data);
+    zfilter *z = obj;
+    const unsigned char *ptr = data;
+
+    z->total += nbytes;
+
+    /* avail_in is 32 bits */
+    while (nbytes > 0) {
+        size_t len = nbytes > 1073741824 ? 1073741824 : nbytes;
+
+        z->crc = crc32(z->crc, ptr, (uInt) len);
+        z->strm.next_in = (unsigned char *) ptr;
+        z->strm.avail_in = (uInt) len;
+        if (!zfilter_deflate(z, Z_NO_FLUSH))
+            return 0;
+
+        ptr += len;
+        nbytes -= len;
+    }
+
+    return 1;
 }
 
-const void *zfilter_bytes(void *obj, size_t *nbytes) {
-    GObject *gobj = G_OBJECT(obj), *sink;
-    gsf_output_close(GSF_OUTPUT(gobj));
+const void *zfilter_flush(void *obj, int finish, size_t *nbytes) {
+    zfilter *z = obj;
+
+    if (!zfilter_deflate(z, finish ? Z_FINISH : Z_SYNC_FLUSH))
+        return NULL;
+
+    if (finish) {
+        unsigned char *ptr;
+        int i;
 
-    g_object_get(gobj, "sink", &sink, NULL);
-    *nbytes = gsf_output_size(GSF_OUTPUT(sink));
+        if (!zfilter_reserve(z, 8))
+            return NULL;
 
-    const void *ret = gsf_output_memory_get_bytes(GSF_OUTPUT_MEMORY(sink));
-    g_object_unref(sink); // g_object_get
+        /* CRC-32 and length modulo 2^32, little-endian */
+        ptr = z->out + z->out_len;
+        for (i = 0; i < 4; ++i) {
+            ptr[i] = (unsigned char) (z->crc >> (8 * i));
+            ptr[i + 4] = (unsigned char) ((uint64_t) z->total >> (8 * i));
+        }
+        z->out_len += 8;
+    }
 
-    return ret;
+    *nbytes = z->out_len;
+    z->reset = 1;
+    return z->out;
 }
 
 void zfilter_del(void *obj) {
-    GObject *gobj = G_OBJECT(obj), *sink;
+    zfilter *z = obj;
 
-    g_object_get(gobj, "sink", &sink, NULL);
-    g_object_unref(gobj);
-    g_object_unref(sink); // g_object_get
-    g_object_unref(sink);
+    if (z->strm.state != Z_NULL)
+        deflateEnd(&z->strm);
+    free(z->out);
+    free(z);
 }
@@ -1,17 +1,30 @@
 #ifndef __ZFILTER_H__
 #define __ZFILTER_H__
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /* ---------------------------------------------------------------------- */
 
-void *zfilter_new(void);
+/* Creates a gzip stream with the given compression level (0-9, or -1
+   for the zlib default). Returns NULL if it can not be created. */
+void *zfilter_new(int level);
+
+/* Continues a stream whose beginning (gzip header included) was
+   compressed and sent before, with the CRC-32 and the length of the
+   data it contains. It must be called before writing any data. */
+void zfilter_resume(void *obj, unsigned long crc, size_t nbytes);
 
+/* Compresses the data. The output is kept until the next flush. */
 int zfilter_write(void *obj, const void *data, size_t nbytes);
 
-const void *zfilter_bytes(void *obj, size_t *num_bytes);
+/* Flushes the stream, finishing it if required, and returns the
+   compressed bytes produced since the last flush. The pointer is
+   valid until the next call to zfilter_write or zfilter_del. */
+const void *zfilter_flush(void *obj, int finish, size_t *nbytes);
 
 void zfilter_del(void *obj);
 